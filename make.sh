@@ -16,6 +16,25 @@ if [ "$1" = "server" ]; then
   elif [ "$2" = "debug-run" ]; then
     ../lldbg/bin/lldbgui ./build/server
   fi
+elif [ "$1" = "bench" ]; then
+  # ./make.sh bench [name] [run]: every src/bench/*.c (or just src/bench/name.c), with optimizations on
+  echo "building benchmarks"
+  for src in src/bench/*.c; do
+    name=$(basename "$src" .c)
+    if [ -n "$2" ] && [ "$2" != "$name" ]; then
+      continue
+    fi
+    echo " $name"
+    rm -f ./build/bench_$name
+    if [[ $(uname) == "Darwin" ]]; then
+      gcc -std=c99 -O2 -g -o build/bench_$name $src -lpthread
+    else
+      gcc -std=c99 -D_POSIX_C_SOURCE=200809L -O2 -g -o build/bench_$name $src -lpthread
+    fi
+    if [ "$3" = "run" ]; then
+      ./build/bench_$name
+    fi
+  done
 elif [ "$1" = "editor" ]; then
   echo "building editor"
   rm ./build/editor
@@ -219,6 +219,7 @@
 #define QueuePush(f,l,n) (((f)==NULL) ? ((f)=(l)=(n)) : ((l)->next=(n),(l)=(n),(n)->next = NULL))
 
 #define DEFAULT_ALIGNMENT sizeof(void*)
+#define CACHE_LINE_SIZE 64
 #define isPowerOfTwo(x) ((x & (x-1)) == 0)
 
 #define XYToPos(x, y, w) ((u32)(((u32)(x)) + (((u32)(y)) * (w))))
@@ -231,6 +232,24 @@
 #  error thread_static not defined for this compiler.
 #endif
 
+// atomics, for the lock-free bits that are shared between threads
+#if COMPILER_CLANG || COMPILER_GCC
+#  define AtomicLoadRelaxed(p)      __atomic_load_n((p), __ATOMIC_RELAXED)
+#  define AtomicLoadAcquire(p)      __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#  define AtomicStoreRelaxed(p, v)  __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#  define AtomicStoreRelease(p, v)  __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#  define AtomicAdd(p, v)           __atomic_add_fetch((p), (v), __ATOMIC_ACQ_REL) // returns the new value
+#  define AtomicCompareExchange(p, expected_ptr, desired) __atomic_compare_exchange_n((p), (expected_ptr), (desired), false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#  define AtomicFence()             __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#  if ARCH_X64 || ARCH_X86
+#    define CpuPause()              __builtin_ia32_pause()
+#  else
+#    define CpuPause()              __asm__ __volatile__("yield")
+#  endif
+#else
+#  error atomics not defined for this compiler.
+#endif
+
 // only valid if there's an in-scope variable bool `debug_mode`
 #define dbg(fmt, ...) osDebugPrint(debug_mode, fmt, ##__VA_ARGS__)
 
@@ -449,11 +468,20 @@ typedef struct ScratchMem {
 	u64 pos;
 } ScratchMem;
 
+// broadcast memory is shared by the whole lane group and split in two halves of broadcast_size bytes.
+// syncs alternate between the halves, so a lane can't overwrite what it wrote last sync while someone
+// is still reading it, which is what lets a broadcast get away with a single barrier
+#ifndef LANE_BROADCAST_SIZE
+#define LANE_BROADCAST_SIZE KB(4)
+#endif
+
 typedef struct LaneCtx {
   u64 lane_idx;
   u64 lane_count;
   Barrier barrier;
-  u64 *broadcast_memory;
+  u8* broadcast_memory; // 2*broadcast_size bytes
+  u64 broadcast_size;
+  u64 sync_count; // # of syncs this lane has been through, every lane in the group agrees on it
 } LaneCtx;
 
 typedef struct ThreadContext {
@@ -483,6 +511,7 @@ fn Range1u64 range1u64Create(u64 min, u64 max);
 fn Range1u64 mRangeFromNIdxMCount(u64 n_idx, u64 n_count, u64 m_count);
 fn void u32Quicksort(u32 arr[], u32 low, u32 high);
 fn void u32ReverseArray(u32 arr[], u32 size);
+fn u64 u64Sqrt(u64 x); // floor(sqrt(x)), without needing libm
 
 ///// MEMORY (Arenas)
 #define ARENA_MAX GB(1)
@@ -499,6 +528,7 @@ fn void  arenaDealloc(Arena* arena, u64 size);
 fn void  arenaDeallocTo(Arena* arena, u64 pos);
 fn void* arenaRaise(Arena* arena, void* ptr, u64 size);
 fn void* arenaAllocArraySized(Arena* arena, u64 elem_size, u64 count);
+fn void* arenaAllocAligned(Arena* arena, u64 size, u64 align);
 #define arenaAllocArray(arena, elem_type, count) arenaAllocArraySized(arena, sizeof(elem_type), count)
 
 fn void arenaInit(Arena* arena);
@@ -519,6 +549,7 @@ void scratchReturn(ScratchMem* scratch);
 #define ASCII_BACKSPACE (8)
 
 fn bool stringsEq(String* a, String* b);
+fn String stringCopy(Arena* a, String string); // 0-terminated, like the String literals
 fn bool cStringEqString(str a, String* b);
 fn Utf8Character classifyUtf8Character(u8 c);
 fn bool isUtf8Ascii(u8 c);
@@ -531,15 +562,77 @@ fn StringUTF16Const str16FromStr8(Arena* a, String string);
 fn bool isAlphaUnderscoreSpace(u8 c);
 fn bool isSimplePrintable(u8 c);
 
+///// HASHING
+#define U64_MAP_EMPTY_KEY MAX_u64
+// open-addressing (linear probing) u64 -> u64 map, grows itself out of `arena`
+typedef struct U64Map {
+  Arena* arena;
+  u64 capacity; // always a power of 2
+  u64 length;
+  u64* keys;
+  u64* values;
+} U64Map;
+
+fn u64 u64Hash(u64 x);
+fn u64 stringHash(String s);
+fn void u64MapInit(U64Map* map, Arena* arena, u64 capacity);
+fn bool u64MapGet(U64Map* map, u64 key, u64* value);
+fn void u64MapPut(U64Map* map, u64 key, u64 value);
+fn void u64MapReserve(U64Map* map, u64 count);
+fn bool u64MapRemove(U64Map* map, u64 key);
+
+///// SERIALIZATION
+// bit streams: fields are packed LSB first with no padding in between, so a 2-bit enum costs 2 bits.
+// varints are LEB128 (7 bits + a "more" bit per byte), signed ones zigzag'd first so small negatives stay small.
+// running off the end never reads/writes out of bounds, it sets `overflow` (sticky) and reads return 0,
+// so a message only has to be checked once, after the last field
+typedef struct BitWriter {
+  u8* bytes;
+  u64 capacity; // in bytes
+  u64 bit_pos;
+  bool overflow;
+} BitWriter;
+
+typedef struct BitReader {
+  u8* bytes;
+  u64 len; // in bytes
+  u64 bit_pos;
+  bool overflow;
+} BitReader;
+
+fn BitWriter bitWriter(u8* bytes, u64 capacity);
+fn void bitWrite(BitWriter* w, u64 value, u32 bits); // the low `bits` (<= 64) bits of value
+fn void bitWriteBool(BitWriter* w, bool value);
+fn void bitWriteVarU64(BitWriter* w, u64 value);
+fn void bitWriteVarI64(BitWriter* w, i64 value);
+fn void bitWriteBytes(BitWriter* w, u8* bytes, u64 len);
+fn void bitWriteAlign(BitWriter* w); // 0s up to the next byte boundary
+fn u64  bitWriterBytes(BitWriter* w); // # of bytes written to so far (a partial one counts)
+fn BitReader bitReader(u8* bytes, u64 len);
+fn u64  bitRead(BitReader* r, u32 bits);
+fn bool bitReadBool(BitReader* r);
+fn u64  bitReadVarU64(BitReader* r);
+fn i64  bitReadVarI64(BitReader* r);
+fn void bitReadBytes(BitReader* r, u8* bytes, u64 len);
+fn u8*  bitReadView(BitReader* r, u64 len); // the next len bytes in place, NULL (and overflow) unless byte aligned
+fn void bitReadAlign(BitReader* r);
+fn u64  bitReaderBytes(BitReader* r);
+fn u32  bitsForCount(u64 count); // # of bits needed for the values 0..count-1
+
 ///// OS-wrapped apis
 void osInit();
 void* osThreadContextGet();
 void osThreadContextSet(void* ctx);
 
+// every barrier is its own object, so separate groups of lanes can each have one
 fn Barrier osBarrierAlloc(u64 count);
 fn void osBarrierRelease(Barrier barrier);
 fn void osBarrierWait(Barrier barrier);
 
+// linux only. sleeps while *addr == expected, until woken or timeout_us passes (MAX_u64 = forever)
+fn void osFutexWait(u32* addr, u32 expected, u64 timeout_us);
+fn void osFutexWakeAll(u32* addr);
+
 // Memory
 fn void* osMemoryReserve(u64 size);
 fn void  osMemoryCommit(void* memory, u64 size);
@@ -547,12 +640,30 @@ fn void  osMemoryDecommit(void* memory, u64 size);
 fn void  osMemoryRelease(void* memory, u64 size);
 fn u64   osTimeMicrosecondsNow();
 fn void  osSleepMicroseconds(u32 t);
+fn void  osSleepUntilMicroseconds(u64 deadline_us); // deadline is on the osTimeMicrosecondsNow() clock
+
+// CPUs + NUMA
+fn u32  osCpusAvailable(u32* cpus, u32 max); // the ids of the cpus this process may run on, returns how many
+fn u32  osCpuNumaNode(u32 cpu); // 0 if unknown
+fn bool osThreadSetAffinity(u32* cpus, u32 count); // restricts the CALLING thread to `cpus`, false if that's not supported/failed
+fn void osMemoryPreferNumaNode(void* memory, u64 size, u32 node); // a hint: pages in the range that haven't been touched yet come from `node`
 
 fn bool osFileExists(String filename);
 fn String osFileRead(Arena* arena, ptr filepath);
 fn bool osFileCreate(String filename);
 fn bool osFileCreateWrite(String filename, String data);
 fn bool osFileWrite(String filename, String data);
+// lower-level file handles, for things like append-only logs
+fn i32  osFileOpenAppend(ptr filepath); // creates the file if needed, -1 on failure
+fn bool osFileAppend(i32 handle, u8* bytes, u64 len);
+fn void osFileSync(i32 handle);
+fn void osFileClose(i32 handle);
+fn bool osFileTruncate(ptr filepath, u64 size);
+fn bool osFileRename(ptr from, ptr to); // atomically replaces `to`
+fn bool osFileDelete(ptr filepath);
+fn u8*  osFileMap(ptr filepath, u64* size); // read-only mapping, NULL if the file is missing or empty
+fn void osFileUnmap(u8* memory, u64 size);
+fn bool osDirectoryCreate(ptr path);
 
 fn void osDebugPrint(bool debug_mode, const char* format, ...);
 
@@ -574,6 +685,7 @@ Cond newCond();
 void lockMutex(Mutex* m);
 void unlockMutex(Mutex* m);
 void signalCond(Cond* cond);
+void broadcastCond(Cond* cond);
 void waitForCondSignal(Cond* cond, Mutex* mutex);
 
 ///// Multi-Core by Default ThreadContext stuff
@@ -585,14 +697,20 @@ ScratchMem tctxScratchGet(ThreadContext* ctx);
 void tctxScratchReset(ThreadContext* ctx, ScratchMem* scratch);
 void tctxScratchReturn(ThreadContext* ctx, ScratchMem* scratch);
 
+fn LaneCtx* laneGroupAlloc(Arena* a, u64 lane_count, u64 broadcast_size); // a barrier + broadcast memory, lane i gets the i-th LaneCtx
 fn LaneCtx tctxSetLaneCtx(LaneCtx lane_ctx);
 fn void tctxLaneBarrierWait(void *broadcast_ptr, u64 broadcast_size, u64 broadcast_src_lane_idx);
+// costs one barrier. each lane's `size` bytes, laid out by lane index in shared memory that stays valid until
+// the next sync
+fn void* tctxLaneGather(void* value, u64 size);
 #define LaneIdx() (tctxSelected()->lane_ctx.lane_idx)
 #define LaneCount() (tctxSelected()->lane_ctx.lane_count)
 #define LaneFromTaskIdx(idx) ((idx)%LaneCount())
 #define LaneCtx(ctx) tctxSetLaneCtx((ctx))
 #define LaneSync() tctxLaneBarrierWait(0, 0, 0)
 #define LaneSyncu64(pointer, src_lane_idx) tctxLaneBarrierWait((pointer), sizeof(*(pointer)), (src_lane_idx))
+#define LaneBroadcast(pointer, src_lane_idx) tctxLaneBarrierWait((pointer), sizeof(*(pointer)), (src_lane_idx)) // any struct up to broadcast_size
+#define LaneGather(pointer) tctxLaneGather((pointer), sizeof(*(pointer)))
 #define LaneRange(count) mRangeFromNIdxMCount(LaneIdx(), LaneCount(), (count))
 
 
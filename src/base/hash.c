@@ -0,0 +1,109 @@
+#include "all.h"
+
+// splitmix64's finalizer, good enough spread for ids/addresses that are mostly sequential
+fn u64 u64Hash(u64 x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ull;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebull;
+  x ^= x >> 31;
+  return x;
+}
+
+// FNV-1a
+fn u64 stringHash(String s) {
+  u64 result = 0xcbf29ce484222325ull;
+  for (u32 i = 0; i < s.length; i++) {
+    result ^= (u8)s.bytes[i];
+    result *= 0x100000001b3ull;
+  }
+  return result;
+}
+
+fn void u64MapInit(U64Map* map, Arena* arena, u64 capacity) {
+  assert(isPowerOfTwo(capacity));
+  map->arena = arena;
+  map->capacity = capacity;
+  map->length = 0;
+  map->keys = arenaAllocArray(arena, u64, capacity);
+  map->values = arenaAllocArray(arena, u64, capacity);
+  for (u64 i = 0; i < capacity; i++) {
+    map->keys[i] = U64_MAP_EMPTY_KEY;
+  }
+}
+
+fn bool u64MapGet(U64Map* map, u64 key, u64* value) {
+  u64 mask = map->capacity - 1;
+  for (u64 i = u64Hash(key) & mask; map->keys[i] != U64_MAP_EMPTY_KEY; i = (i + 1) & mask) {
+    if (map->keys[i] == key) {
+      *value = map->values[i];
+      return true;
+    }
+  }
+  return false;
+}
+
+fn void u64MapRehash(U64Map* map, u64 capacity) {
+  U64Map old = *map;
+  u64MapInit(map, old.arena, capacity);
+  for (u64 i = 0; i < old.capacity; i++) {
+    if (old.keys[i] != U64_MAP_EMPTY_KEY) {
+      u64MapPut(map, old.keys[i], old.values[i]);
+    }
+  }
+}
+
+// grow once up front when the final size is known, instead of rehashing through every doubling on the way
+fn void u64MapReserve(U64Map* map, u64 count) {
+  u64 capacity = map->capacity;
+  while (count * 2 > capacity) {
+    capacity *= 2;
+  }
+  if (capacity != map->capacity) {
+    u64MapRehash(map, capacity);
+  }
+}
+
+fn void u64MapPut(U64Map* map, u64 key, u64 value) {
+  assert(key != U64_MAP_EMPTY_KEY);
+  // keep the load factor under 1/2 so probe chains stay short
+  if ((map->length + 1) * 2 > map->capacity) {
+    u64MapRehash(map, map->capacity * 2);
+  }
+  u64 mask = map->capacity - 1;
+  u64 i = u64Hash(key) & mask;
+  for (; map->keys[i] != U64_MAP_EMPTY_KEY; i = (i + 1) & mask) {
+    if (map->keys[i] == key) {
+      map->values[i] = value;
+      return;
+    }
+  }
+  map->keys[i] = key;
+  map->values[i] = value;
+  map->length += 1;
+}
+
+fn bool u64MapRemove(U64Map* map, u64 key) {
+  u64 mask = map->capacity - 1;
+  u64 i = u64Hash(key) & mask;
+  for (; map->keys[i] != key; i = (i + 1) & mask) {
+    if (map->keys[i] == U64_MAP_EMPTY_KEY) {
+      return false;
+    }
+  }
+  // backward-shift deletion: pull later entries of the probe chain into the hole so lookups never need tombstones
+  u64 hole = i;
+  for (u64 j = (i + 1) & mask; map->keys[j] != U64_MAP_EMPTY_KEY; j = (j + 1) & mask) {
+    u64 home = u64Hash(map->keys[j]) & mask;
+    // can entry j move back to the hole without jumping in front of its home slot?
+    bool movable = (hole <= j) ? (home <= hole || home > j) : (home <= hole && home > j);
+    if (movable) {
+      map->keys[hole] = map->keys[j];
+      map->values[hole] = map->values[j];
+      hole = j;
+    }
+  }
+  map->keys[hole] = U64_MAP_EMPTY_KEY;
+  map->length -= 1;
+  return true;
+}
@@ -2,6 +2,7 @@
 #define BASE_IMPL_C
 
 #include "math.c"
+#include "hash.c"
 #include "os.c"
 #include "memory.c"
 #include "serialize.c"
@@ -4,33 +4,152 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <time.h>
+#include <errno.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <dirent.h>
 #include "all.h"
 
-global pthread_barrier_t linux_thread_barrier;
+// a sense-reversing barrier: the last thread to arrive resets the count and flips `phase`, which is what
+// everyone else is waiting on. waiters spin on it for a little while first, since between lanes the wait is
+// usually shorter than a futex wake-up, and only then go to sleep on it. with more threads than cpus
+// the spinning would just eat the time slices of whoever we're waiting on, so then they sleep right away
+#ifndef OS_BARRIER_SPIN_COUNT
+#define OS_BARRIER_SPIN_COUNT 1024
+#endif
+
+typedef struct LinuxBarrier {
+  u32 arrived; // # of threads in the current phase so far
+  u8 arrived_pad[CACHE_LINE_SIZE - sizeof(u32)];
+  u32 phase; // the futex word, bumped when the last thread arrives
+  u32 sleepers; // # of threads (about to be) asleep on `phase`, so the last one can skip the wake syscall
+  u32 count;
+  u32 spin_count;
+} LinuxBarrier;
 
 fn Barrier osBarrierAlloc(u64 count) {
-  pthread_barrier_init(&linux_thread_barrier, NULL, count);
-  Barrier result = {(u64)&linux_thread_barrier};
+  assert(count > 0 && count <= MAX_u32);
+  LinuxBarrier* barrier = osMemoryReserve(sizeof(LinuxBarrier));
+  osMemoryCommit(barrier, sizeof(LinuxBarrier));
+  MemoryZero(barrier, sizeof(LinuxBarrier));
+  barrier->count = (u32)count;
+  i64 cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  barrier->spin_count = cpus > 0 && count <= (u64)cpus ? OS_BARRIER_SPIN_COUNT : 0;
+  Barrier result = {(u64)barrier};
   return result;
 }
 
 fn void osBarrierRelease(Barrier barrier) {
-  pthread_barrier_t* addr = (pthread_barrier_t*)barrier.a[0];
-  pthread_barrier_destroy(addr);
+  osMemoryRelease((LinuxBarrier*)barrier.a[0], sizeof(LinuxBarrier));
+}
+
+fn void osBarrierWait(Barrier handle) {
+  LinuxBarrier* barrier = (LinuxBarrier*)handle.a[0];
+  // can't change until we've arrived, so this is the phase we're waiting out
+  u32 phase = AtomicLoadAcquire(&barrier->phase);
+  if (AtomicAdd(&barrier->arrived, 1) == barrier->count) {
+    // nobody can arrive for the next phase before they see the flip, so it's safe to reset first
+    AtomicStoreRelaxed(&barrier->arrived, 0);
+    AtomicAdd(&barrier->phase, 1);
+    // pairs with the fence below: either we see their sleeper count, or they see the new phase
+    AtomicFence();
+    if (AtomicLoadRelaxed(&barrier->sleepers) > 0) {
+      osFutexWakeAll(&barrier->phase);
+    }
+    return;
+  }
+  for (u32 i = 0; i < barrier->spin_count; i++) {
+    if (AtomicLoadAcquire(&barrier->phase) != phase) {
+      return;
+    }
+    CpuPause();
+  }
+  AtomicAdd(&barrier->sleepers, 1);
+  AtomicFence();
+  while (AtomicLoadAcquire(&barrier->phase) == phase) {
+    osFutexWait(&barrier->phase, phase, MAX_u64);
+  }
+  AtomicAdd(&barrier->sleepers, -1);
+}
+
+// Futex
+fn void osFutexWait(u32* addr, u32 expected, u64 timeout_us) {
+  if (timeout_us == MAX_u64) {
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+  } else {
+    struct timespec ts = { timeout_us / 1000000, (timeout_us % 1000000) * 1000 };
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, expected, &ts, NULL, 0);
+  }
+}
+
+fn void osFutexWakeAll(u32* addr) {
+  syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+// CPUs + NUMA. straight syscalls on plain bitmasks, so none of this needs _GNU_SOURCE's cpu_set_t
+#define LINUX_MAX_CPUS 1024
+
+fn u32 osCpusAvailable(u32* cpus, u32 max) {
+  u64 mask[LINUX_MAX_CPUS/64] = {0};
+  i64 bytes = syscall(SYS_sched_getaffinity, 0, sizeof(mask), mask);
+  if (bytes <= 0) {
+    return 0;
+  }
+  u32 result = 0;
+  for (u32 cpu = 0; cpu < (u32)bytes*8 && result < max; cpu++) {
+    if (mask[cpu / 64] & (1ull << (cpu % 64))) {
+      cpus[result++] = cpu;
+    }
+  }
+  return result;
+}
+
+// every cpu's sysfs directory has a "node<N>" link to the node it's on (when the kernel has NUMA support at all)
+fn u32 osCpuNumaNode(u32 cpu) {
+  char path[64];
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u", cpu);
+  DIR* dir = opendir(path);
+  if (dir == NULL) {
+    return 0;
+  }
+  u32 result = 0;
+  for (struct dirent* entry = readdir(dir); entry != NULL; entry = readdir(dir)) {
+    if (strncmp(entry->d_name, "node", 4) == 0 && entry->d_name[4] >= '0' && entry->d_name[4] <= '9') {
+      result = (u32)strtoul(entry->d_name + 4, NULL, 10);
+      break;
+    }
+  }
+  closedir(dir);
+  return result;
 }
 
-fn void osBarrierWait(Barrier barrier) {
-  pthread_barrier_t* addr = (pthread_barrier_t*)barrier.a[0];
-  pthread_barrier_wait(addr);
+fn bool osThreadSetAffinity(u32* cpus, u32 count) {
+  u64 mask[LINUX_MAX_CPUS/64] = {0};
+  for (u32 i = 0; i < count; i++) {
+    assert(cpus[i] < LINUX_MAX_CPUS);
+    mask[cpus[i] / 64] |= 1ull << (cpus[i] % 64);
+  }
+  return syscall(SYS_sched_setaffinity, 0, sizeof(mask), mask) == 0;
+}
+
+fn void osMemoryPreferNumaNode(void* memory, u64 size, u32 node) {
+  if (node >= 64) {
+    return;
+  }
+  u64 nodemask = 1ull << node;
+  syscall(SYS_mbind, memory, size, MPOL_PREFERRED, &nodemask, 64 + 1, 0);
 }
 
 // Time
 fn u64 osTimeMicrosecondsNow() {
   struct timespec ts;
   clock_gettime(CLOCK_MONOTONIC, &ts);
-	return ((u64)ts.tv_sec * 1000000) + ((u64)ts.tv_nsec / 1000000);
+	return ((u64)ts.tv_sec * 1000000) + ((u64)ts.tv_nsec / 1000);
 }
 
 #define MICROSECONDS_PER_SECOND 1000000
@@ -40,6 +159,12 @@ fn void osSleepMicroseconds(u32 t) {
   nanosleep(&ts, NULL);
 }
 
+fn void osSleepUntilMicroseconds(u64 deadline_us) {
+  struct timespec ts = { deadline_us / MICROSECONDS_PER_SECOND, (deadline_us % MICROSECONDS_PER_SECOND)*NANOSECONDS_PER_MICROSECOND };
+  // absolute, so waking up early from a signal and going back to sleep doesn't drift
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {}
+}
+
 // Files
 fn bool osFileExists(String filename) {
   bool result = access((str)filename.bytes, F_OK) == 0;
@@ -8,17 +8,19 @@
 #include "all.h"
 #include "pthread_barrier.h"
 
-global pthread_barrier_t macos_thread_barrier;
-
+// no futex on mac, so barriers are still pthread barriers (each with its own memory now)
 fn Barrier osBarrierAlloc(u64 count) {
-  pthread_barrier_init(&macos_thread_barrier, NULL, count);
-  Barrier result = {(u64)&macos_thread_barrier};
+  pthread_barrier_t* addr = osMemoryReserve(sizeof(pthread_barrier_t));
+  osMemoryCommit(addr, sizeof(pthread_barrier_t));
+  pthread_barrier_init(addr, NULL, count);
+  Barrier result = {(u64)addr};
   return result;
 }
 
 fn void osBarrierRelease(Barrier barrier) {
   pthread_barrier_t* addr = (pthread_barrier_t*)barrier.a[0];
   pthread_barrier_destroy(addr);
+  osMemoryRelease(addr, sizeof(pthread_barrier_t));
 }
 
 fn void osBarrierWait(Barrier barrier) {
@@ -26,17 +28,46 @@ fn void osBarrierWait(Barrier barrier) {
   pthread_barrier_wait(addr);
 }
 
+// CPUs + NUMA. macs are a single node and don't let you pin threads
+fn u32 osCpusAvailable(u32* cpus, u32 max) {
+  i64 count = sysconf(_SC_NPROCESSORS_ONLN);
+  u32 result = 0;
+  for (; result < (u32)Max(count, 0) && result < max; result++) {
+    cpus[result] = result;
+  }
+  return result;
+}
+
+fn u32 osCpuNumaNode(u32 cpu) {
+  return 0;
+}
+
+fn bool osThreadSetAffinity(u32* cpus, u32 count) {
+  return false;
+}
+
+fn void osMemoryPreferNumaNode(void* memory, u64 size, u32 node) {
+}
+
 // Time
 fn u64 osTimeMicrosecondsNow() {
   struct timespec ts;
   clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
-	return ((u64)ts.tv_sec * 1000000) + ((u64)ts.tv_nsec / 1000000);
+	return ((u64)ts.tv_sec * 1000000) + ((u64)ts.tv_nsec / 1000);
 }
 
 fn void osSleepMicroseconds(u32 t) {
   usleep(t);
 }
 
+// no clock_nanosleep() on mac, so this is relative under the hood
+fn void osSleepUntilMicroseconds(u64 deadline_us) {
+  u64 now = osTimeMicrosecondsNow();
+  if (deadline_us > now) {
+    usleep(deadline_us - now);
+  }
+}
+
 // Files
 fn bool osFileExists(String filename) {
   bool result = access((str)filename.bytes, F_OK) == 0;
@@ -12,6 +12,20 @@ fn Range1u64 range1u64Create(u64 min, u64 max) {
   return result;
 }
 
+// Newton's method, starting above the root so it only ever comes down
+fn u64 u64Sqrt(u64 x) {
+  if (x < 2) {
+    return x;
+  }
+  u64 result = x;
+  u64 next = x / 2 + (x & 1); // (x + x/x) / 2 without overflowing
+  while (next < result) {
+    result = next;
+    next = (result + x / result) / 2;
+  }
+  return result;
+}
+
 fn Range1u64 mRangeFromNIdxMCount(u64 n_idx, u64 n_count, u64 m_count) {
   u64 main_idxes_per_lane = m_count / n_count;
   u64 leftover_idxes_count = m_count - main_idxes_per_lane * n_count;
@@ -44,6 +44,13 @@ fn void* arenaAllocArraySized(Arena* arena, u64 elem_size, u64 count) {
     return arenaAlloc(arena, elem_size * count);
 }
 
+// for things that need to start on their own cache line
+fn void* arenaAllocAligned(Arena* arena, u64 size, u64 align) {
+  u64 padding = alignForward((u64)(arena->memory + arena->alloc_position), align) - (u64)(arena->memory + arena->alloc_position);
+  arenaAlloc(arena, padding);
+  return arenaAlloc(arena, size);
+}
+
 fn void arenaDealloc(Arena* arena, u64 size) {
   if (size > arena->alloc_position) size = arena->alloc_position;
   arena->alloc_position -= size;
@@ -64,3 +64,200 @@ fn u16 readU16FromBufferLE(u8 *buffer) {
            ((u16)buffer[1] << 8);
 }
 
+
+fn BitWriter bitWriter(u8* bytes, u64 capacity) {
+  BitWriter result = {
+    .bytes = bytes,
+    .capacity = capacity,
+  };
+  return result;
+}
+
+// LSB first. everything from bit_pos up is overwritten rather than OR'd into, so rewinding bit_pos and
+// writing again is fine.
+// away from the end of the buffer it's one unaligned 8-byte read-modify-write (assumes a little-endian
+// cpu, like everything else here), otherwise a byte at a time
+fn void bitWrite(BitWriter* w, u64 value, u32 bits) {
+  assert(bits <= 64);
+  if (w->overflow || w->bit_pos + bits > w->capacity * 8) {
+    w->overflow = true;
+    return;
+  }
+  if (bits > 56) {
+    bitWrite(w, value, 32);
+    bitWrite(w, value >> 32, bits - 32);
+    return;
+  }
+  u64 byte = w->bit_pos >> 3;
+  if (byte + 8 <= w->capacity) {
+    u32 shift = w->bit_pos & 7;
+    u64 word;
+    MemoryCopy(&word, w->bytes + byte, 8);
+    word = (word & ((1ULL << shift) - 1)) | ((value & ((1ULL << bits) - 1)) << shift);
+    MemoryCopy(w->bytes + byte, &word, 8);
+    w->bit_pos += bits;
+    return;
+  }
+  while (bits > 0) {
+    u64 byte = w->bit_pos >> 3;
+    u32 shift = w->bit_pos & 7;
+    u32 take = Min(8 - shift, bits);
+    u8 mask = (u8)((1u << take) - 1);
+    w->bytes[byte] = (u8)((w->bytes[byte] & ((1u << shift) - 1)) | ((value & mask) << shift));
+    value >>= take;
+    bits -= take;
+    w->bit_pos += take;
+  }
+}
+
+fn void bitWriteBool(BitWriter* w, bool value) {
+  bitWrite(w, value ? 1 : 0, 1);
+}
+
+fn void bitWriteVarU64(BitWriter* w, u64 value) {
+  // up to 7 groups go out in one bitWrite()
+  do {
+    u64 chunk = 0;
+    u32 bits = 0;
+    do {
+      u64 group = value & 0x7F;
+      value >>= 7;
+      chunk |= (group | (value != 0 ? 0x80 : 0)) << bits;
+      bits += 8;
+    } while (value != 0 && bits < 56);
+    bitWrite(w, chunk, bits);
+  } while (value != 0);
+}
+
+fn void bitWriteVarI64(BitWriter* w, i64 value) {
+  bitWriteVarU64(w, ((u64)value << 1) ^ (u64)(value >> 63));
+}
+
+fn void bitWriteBytes(BitWriter* w, u8* bytes, u64 len) {
+  if ((w->bit_pos & 7) == 0) {
+    if (w->overflow || w->bit_pos / 8 + len > w->capacity) {
+      w->overflow = true;
+      return;
+    }
+    MemoryCopy(w->bytes + w->bit_pos / 8, bytes, len);
+    w->bit_pos += len * 8;
+    return;
+  }
+  for (u64 i = 0; i < len; i++) {
+    bitWrite(w, bytes[i], 8);
+  }
+}
+
+fn void bitWriteAlign(BitWriter* w) {
+  u32 pad = (8 - (w->bit_pos & 7)) & 7;
+  bitWrite(w, 0, pad);
+}
+
+fn u64 bitWriterBytes(BitWriter* w) {
+  return (w->bit_pos + 7) / 8;
+}
+
+fn BitReader bitReader(u8* bytes, u64 len) {
+  BitReader result = {
+    .bytes = bytes,
+    .len = len,
+  };
+  return result;
+}
+
+fn u64 bitRead(BitReader* r, u32 bits) {
+  assert(bits <= 64);
+  if (r->overflow || r->bit_pos + bits > r->len * 8) {
+    r->overflow = true;
+    return 0;
+  }
+  if (bits > 56) {
+    u64 low = bitRead(r, 32);
+    return low | (bitRead(r, bits - 32) << 32);
+  }
+  u64 byte = r->bit_pos >> 3;
+  if (byte + 8 <= r->len) {
+    u32 shift = r->bit_pos & 7;
+    u64 word;
+    MemoryCopy(&word, r->bytes + byte, 8);
+    r->bit_pos += bits;
+    return (word >> shift) & ((1ULL << bits) - 1);
+  }
+  u64 result = 0;
+  u32 done = 0;
+  while (done < bits) {
+    u64 byte = r->bit_pos >> 3;
+    u32 shift = r->bit_pos & 7;
+    u32 take = Min(8 - shift, bits - done);
+    u64 chunk = (r->bytes[byte] >> shift) & ((1u << take) - 1);
+    result |= chunk << done;
+    done += take;
+    r->bit_pos += take;
+  }
+  return result;
+}
+
+fn bool bitReadBool(BitReader* r) {
+  return bitRead(r, 1) != 0;
+}
+
+fn u64 bitReadVarU64(BitReader* r) {
+  u64 result = 0;
+  for (u32 shift = 0; shift < 64; shift += 7) {
+    u64 group = bitRead(r, 8);
+    result |= (group & 0x7F) << shift;
+    if ((group & 0x80) == 0) {
+      return result;
+    }
+  }
+  r->overflow = true; // more than 10 groups, it's garbage
+  return 0;
+}
+
+fn i64 bitReadVarI64(BitReader* r) {
+  u64 zigzag = bitReadVarU64(r);
+  return (i64)(zigzag >> 1) ^ -(i64)(zigzag & 1);
+}
+
+fn void bitReadBytes(BitReader* r, u8* bytes, u64 len) {
+  if ((r->bit_pos & 7) == 0) {
+    if (r->overflow || r->bit_pos / 8 + len > r->len) {
+      r->overflow = true;
+      return;
+    }
+    MemoryCopy(bytes, r->bytes + r->bit_pos / 8, len);
+    r->bit_pos += len * 8;
+    return;
+  }
+  for (u64 i = 0; i < len; i++) {
+    bytes[i] = (u8)bitRead(r, 8);
+  }
+}
+
+fn u8* bitReadView(BitReader* r, u64 len) {
+  if (r->overflow || (r->bit_pos & 7) != 0 || r->bit_pos / 8 + len > r->len) {
+    r->overflow = true;
+    return NULL;
+  }
+  u8* result = r->bytes + r->bit_pos / 8;
+  r->bit_pos += len * 8;
+  return result;
+}
+
+// the padding's skipped, not read
+fn void bitReadAlign(BitReader* r) {
+  r->bit_pos = (r->bit_pos + 7) & ~7ULL;
+  r->overflow |= r->bit_pos > r->len * 8;
+}
+
+fn u64 bitReaderBytes(BitReader* r) {
+  return (r->bit_pos + 7) / 8;
+}
+
+fn u32 bitsForCount(u64 count) {
+  u32 result = 0;
+  while (count > (1ULL << result) && result < 64) {
+    result += 1;
+  }
+  return result;
+}
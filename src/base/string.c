@@ -4,12 +4,18 @@ fn bool stringsEq(String* a, String* b) {
   if (a->length != b->length) {
     return false;
   }
-  for (i32 i = 0; i < a->length; i++) {
-    if (a->bytes[i] != b->bytes[i]) {
-      return false;
-    }
-  }
-  return true;
+  return memcmp(a->bytes, b->bytes, a->length) == 0;
+}
+
+fn String stringCopy(Arena* a, String string) {
+  String result = {
+    .length = string.length,
+    .capacity = string.length + 1,
+    .bytes = arenaAllocArray(a, char, string.length + 1),
+  };
+  MemoryCopy(result.bytes, string.bytes, string.length);
+  result.bytes[string.length] = 0;
+  return result;
 }
 
 fn bool cStringEqString(str a, String* b) {
@@ -57,27 +57,55 @@ fn LaneCtx tctxSetLaneCtx(LaneCtx lane_ctx) {
   return restore;
 }
 
+fn LaneCtx* laneGroupAlloc(Arena* a, u64 lane_count, u64 broadcast_size) {
+  LaneCtx* result = arenaAllocArray(a, LaneCtx, lane_count);
+  Barrier barrier = osBarrierAlloc(lane_count);
+  u8* broadcast_memory = arenaAllocAligned(a, 2*broadcast_size, CACHE_LINE_SIZE);
+  MemoryZero(broadcast_memory, 2*broadcast_size);
+  for (u64 i = 0; i < lane_count; i++) {
+    result[i] = (LaneCtx){
+      .lane_idx = i,
+      .lane_count = lane_count,
+      .barrier = barrier,
+      .broadcast_memory = broadcast_memory,
+      .broadcast_size = broadcast_size,
+    };
+  }
+  return result;
+}
+
+// the half of the broadcast memory this sync gets, lanes can't write to it again until two syncs from now,
+// which they only reach once everyone is done with this one
+fn u8* tctxLaneBroadcastBegin(LaneCtx* lane_ctx) {
+  u8* result = lane_ctx->broadcast_memory + (lane_ctx->sync_count & 1) * lane_ctx->broadcast_size;
+  lane_ctx->sync_count += 1;
+  return result;
+}
+
 fn void tctxLaneBarrierWait(void *broadcast_ptr, u64 broadcast_size, u64 broadcast_src_lane_idx) {
-  ThreadContext *tctx = tctxSelected();
+  LaneCtx* lane_ctx = &tctxSelected()->lane_ctx;
+  u8* broadcast_memory = tctxLaneBroadcastBegin(lane_ctx);
+  assert(broadcast_size <= lane_ctx->broadcast_size);
 
   // broadcasting -> copy to broadcast memory on source lane
-  u64 broadcast_size_clamped = Min(broadcast_size, sizeof(tctx->lane_ctx.broadcast_memory[0]));
-  if(broadcast_ptr != 0 && LaneIdx() == broadcast_src_lane_idx) {
-    MemoryCopy(tctx->lane_ctx.broadcast_memory, broadcast_ptr, broadcast_size_clamped);
+  if (broadcast_ptr != 0 && LaneIdx() == broadcast_src_lane_idx) {
+    MemoryCopy(broadcast_memory, broadcast_ptr, broadcast_size);
   }
 
   // all cases: barrier
-  osBarrierWait(tctx->lane_ctx.barrier);
+  osBarrierWait(lane_ctx->barrier);
 
   // broadcasting -> copy from broadcast memory on destination lanes
-  if(broadcast_ptr != 0 && LaneIdx() != broadcast_src_lane_idx)
-  {
-    MemoryCopy(broadcast_ptr, tctx->lane_ctx.broadcast_memory, broadcast_size_clamped);
+  if (broadcast_ptr != 0 && LaneIdx() != broadcast_src_lane_idx) {
+    MemoryCopy(broadcast_ptr, broadcast_memory, broadcast_size);
   }
+}
 
-  // broadcasting -> barrier on all lanes
-  if(broadcast_ptr != 0)
-  {
-    osBarrierWait(tctx->lane_ctx.barrier);
-  }
+fn void* tctxLaneGather(void* value, u64 size) {
+  LaneCtx* lane_ctx = &tctxSelected()->lane_ctx;
+  u8* broadcast_memory = tctxLaneBroadcastBegin(lane_ctx);
+  assert(size * lane_ctx->lane_count <= lane_ctx->broadcast_size);
+  MemoryCopy(broadcast_memory + LaneIdx() * size, value, size);
+  osBarrierWait(lane_ctx->barrier);
+  return broadcast_memory;
 }
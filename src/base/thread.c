@@ -30,6 +30,10 @@ void signalCond(Cond* cond) {
   pthread_cond_signal(&cond->cond);
 }
 
+void broadcastCond(Cond* cond) {
+  pthread_cond_broadcast(&cond->cond);
+}
+
 void waitForCondSignal(Cond* cond, Mutex* mutex) {
   pthread_cond_wait(&cond->cond, &mutex->mutex);
 }
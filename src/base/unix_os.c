@@ -1,3 +1,4 @@
+#include <errno.h>
 #include "all.h"
 
 global pthread_key_t linux_thread_context_key;
@@ -50,6 +51,71 @@ fn void osMemoryRelease(void* memory, u64 size) {
     munmap(memory, size);
 }
 
+// Files
+fn i32 osFileOpenAppend(ptr filepath) {
+  return open(filepath, O_WRONLY | O_CREAT | O_APPEND, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+}
+
+fn bool osFileAppend(i32 handle, u8* bytes, u64 len) {
+  u64 total = 0;
+  while (total < len) {
+    i64 written_bytes = write(handle, bytes + total, len - total);
+    if (written_bytes < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    total += written_bytes;
+  }
+  return true;
+}
+
+fn void osFileSync(i32 handle) {
+  fsync(handle);
+}
+
+fn void osFileClose(i32 handle) {
+  close(handle);
+}
+
+fn bool osFileTruncate(ptr filepath, u64 size) {
+  return truncate(filepath, size) == 0;
+}
+
+fn bool osFileRename(ptr from, ptr to) {
+  return rename(from, to) == 0;
+}
+
+fn bool osFileDelete(ptr filepath) {
+  return unlink(filepath) == 0;
+}
+
+fn u8* osFileMap(ptr filepath, u64* size) {
+  *size = 0;
+  i32 handle = open(filepath, O_RDONLY);
+  if (handle == -1) {
+    return NULL;
+  }
+  struct stat st;
+  u8* result = NULL;
+  if (fstat(handle, &st) == 0 && st.st_size > 0) {
+    void* memory = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, handle, 0);
+    if (memory != MAP_FAILED) {
+      result = memory;
+      *size = st.st_size;
+    }
+  }
+  close(handle); // the mapping keeps the file alive on its own
+  return result;
+}
+
+fn void osFileUnmap(u8* memory, u64 size) {
+  munmap(memory, size);
+}
+
+fn bool osDirectoryCreate(ptr path) {
+  return mkdir(path, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) == 0 || errno == EEXIST;
+}
+
 // TUI
 TermIOs osStartTUI(bool blocking) {
   // set up the TUI incantations
@@ -41,6 +41,35 @@ fn void osMemoryRelease(void* memory, u64 size) {
   VirtualFree(memory, 0, MEM_RELEASE);
 }
 
+// CPUs + NUMA. only the first processor group, and no numa placement yet
+fn u32 osCpusAvailable(u32* cpus, u32 max) {
+  DWORD_PTR process_mask = 0;
+  DWORD_PTR system_mask = 0;
+  GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask);
+  u32 result = 0;
+  for (u32 cpu = 0; cpu < sizeof(DWORD_PTR)*8 && result < max; cpu++) {
+    if (process_mask & ((DWORD_PTR)1 << cpu)) {
+      cpus[result++] = cpu;
+    }
+  }
+  return result;
+}
+
+fn u32 osCpuNumaNode(u32 cpu) {
+  return 0;
+}
+
+fn bool osThreadSetAffinity(u32* cpus, u32 count) {
+  DWORD_PTR mask = 0;
+  for (u32 i = 0; i < count; i++) {
+    mask |= (DWORD_PTR)1 << cpus[i];
+  }
+  return SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+}
+
+fn void osMemoryPreferNumaNode(void* memory, u64 size, u32 node) {
+}
+
 // Time
 fn u64 osTimeMicrosecondsNow() {
   u64 result = 0;
@@ -57,6 +86,13 @@ fn void osSleepMicroseconds(u32 t) {
   Sleep(t / MICROSECONDS_PER_MILLISECOND);
 }
 
+fn void osSleepUntilMicroseconds(u64 deadline_us) {
+  u64 now = osTimeMicrosecondsNow();
+  if (deadline_us > now) {
+    Sleep((deadline_us - now) / MICROSECONDS_PER_MILLISECOND);
+  }
+}
+
 // Files
 fn bool osFileExists(String filename) {
   assert(false && "Not Implemented");
@@ -90,6 +126,54 @@ fn bool osFileWrite(String filename, String data) {
   return result;
 }
 
+fn i32 osFileOpenAppend(ptr filepath) {
+  assert(false && "Not Implemented");
+  return -1;
+}
+
+fn bool osFileAppend(i32 handle, u8* bytes, u64 len) {
+  assert(false && "Not Implemented");
+  return false;
+}
+
+fn void osFileSync(i32 handle) {
+  assert(false && "Not Implemented");
+}
+
+fn void osFileClose(i32 handle) {
+  assert(false && "Not Implemented");
+}
+
+fn bool osFileTruncate(ptr filepath, u64 size) {
+  assert(false && "Not Implemented");
+  return false;
+}
+
+fn bool osFileRename(ptr from, ptr to) {
+  assert(false && "Not Implemented");
+  return false;
+}
+
+fn bool osFileDelete(ptr filepath) {
+  assert(false && "Not Implemented");
+  return false;
+}
+
+fn u8* osFileMap(ptr filepath, u64* size) {
+  assert(false && "Not Implemented");
+  *size = 0;
+  return NULL;
+}
+
+fn void osFileUnmap(u8* memory, u64 size) {
+  assert(false && "Not Implemented");
+}
+
+fn bool osDirectoryCreate(ptr path) {
+  assert(false && "Not Implemented");
+  return false;
+}
+
 
 // Misc
 fn void osDebugPrint(bool debug_mode, const char * format, ... ) {
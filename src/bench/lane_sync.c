@@ -0,0 +1,91 @@
+// LaneSync() round trips with 2/4/8/16 lanes vs a plain pthread barrier (what osBarrierWait() used to be), plus
+// LaneBroadcast() of a u64 since that's how most of the game loop's syncs go. build + run with
+// ./make.sh bench lane_sync run
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include "../base/impl.c"
+
+#define BENCH_ROUNDS 20000
+#define BENCH_MAX_LANES 16
+
+typedef enum BenchSyncKind {
+  BenchSyncPthread,
+  BenchSyncLane,
+  BenchSyncBroadcast,
+  BenchSyncKind_Count,
+} BenchSyncKind;
+
+static const char* bench_sync_kind_strings[] = {
+  "pthread barrier",
+  "LaneSync",
+  "LaneBroadcast",
+};
+
+global BenchSyncKind bench_kind;
+global pthread_barrier_t bench_pthread_barrier;
+global u64 bench_turns; // bumped by one lane per round, so a round that lets two lanes through shows up
+global u64 bench_bad_broadcasts;
+global u64 bench_elapsed_us;
+
+fn void* benchLane(void* params) {
+  LaneCtx* lane_ctx = (LaneCtx*)params;
+  ThreadContext tctx = {
+    .lane_ctx = *lane_ctx,
+  };
+  tctxInit(&tctx);
+  LaneSync();
+  u64 start = osTimeMicrosecondsNow();
+  for (u64 i = 0; i < BENCH_ROUNDS; i++) {
+    if (bench_kind == BenchSyncPthread) {
+      pthread_barrier_wait(&bench_pthread_barrier);
+    } else if (bench_kind == BenchSyncLane) {
+      LaneSync();
+    } else {
+      u64 value = i * 7 + 1;
+      LaneBroadcast(&value, i % LaneCount());
+      bench_bad_broadcasts += value != i * 7 + 1; // only ever written by the lane whose turn it is
+    }
+    if (LaneIdx() == i % LaneCount()) {
+      bench_turns += 1;
+    }
+  }
+  if (LaneIdx() == 0) {
+    bench_elapsed_us = osTimeMicrosecondsNow() - start;
+  }
+  return NULL;
+}
+
+i32 main(i32 argc, ptr argv[]) {
+  osInit();
+  Arena a = {0};
+  arenaInit(&a);
+  printf("%d round trips per run, %ld cpus\n", BENCH_ROUNDS, sysconf(_SC_NPROCESSORS_ONLN));
+  for (u64 lane_count = 2; lane_count <= BENCH_MAX_LANES; lane_count *= 2) {
+    printf("  %2lld lanes:", lane_count);
+    for (u32 kind = 0; kind < BenchSyncKind_Count; kind++) {
+      arenaClear(&a);
+      bench_kind = (BenchSyncKind)kind;
+      bench_turns = 0;
+      bench_bad_broadcasts = 0;
+      pthread_barrier_init(&bench_pthread_barrier, NULL, lane_count);
+      LaneCtx* lane_ctxs = laneGroupAlloc(&a, lane_count, LANE_BROADCAST_SIZE);
+      Thread threads[BENCH_MAX_LANES];
+      for (u64 i = 0; i < lane_count; i++) {
+        threads[i] = spawnThread(&benchLane, &lane_ctxs[i]);
+      }
+      for (u64 i = 0; i < lane_count; i++) {
+        osThreadJoin(threads[i], MAX_u64);
+      }
+      osBarrierRelease(lane_ctxs[0].barrier);
+      pthread_barrier_destroy(&bench_pthread_barrier);
+      if (bench_turns != BENCH_ROUNDS || bench_bad_broadcasts > 0) {
+        printf("\n%s let lanes through early\n", bench_sync_kind_strings[kind]);
+        return 1;
+      }
+      printf("  %s %6.2fus", bench_sync_kind_strings[kind], (f64)bench_elapsed_us / BENCH_ROUNDS);
+    }
+    printf("\n");
+  }
+  return 0;
+}
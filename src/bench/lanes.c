@@ -0,0 +1,175 @@
+// game loop ticks/s with 1/2/4/8 lanes, each simulating its share of BENCH_ENTITIES wanderers, the way gameLoop()
+// does minus the client commands. first spread evenly over the rooms, then skewed (most of them crowded into a few
+// rooms) with and without the lanes stealing each other's rooms, for the p99 tick. every run is in its own process
+// so they all start from a fresh world. build + run with ./make.sh bench lanes run
+#define _GNU_SOURCE
+#include <time.h>
+#include <sys/wait.h>
+#define main server_main // just the server's functions and state, not its main
+#include "../server.c"
+#undef main
+
+#define BENCH_ENTITIES 1000000
+#define BENCH_TICKS 200
+#define BENCH_MAX_LANES 8
+#define BENCH_CROWDED_ROOMS (MAX_ROOMS / 10) // when skewed, these get 90% of the wanderers
+
+typedef struct BenchConfig {
+  u64 lane_count;
+  bool skewed;
+  bool steal; // workNext() like gameLoop(), or each lane only does its own LaneRange()
+} BenchConfig;
+
+global BenchConfig bench_config;
+
+global u64 bench_lane_cpu_us[BENCH_MAX_LANES][BENCH_TICKS];
+global u64 bench_wall_us;
+
+// cpu time rather than wall time, so lanes that share a core don't get charged for each other
+fn u64 benchThreadCpuUs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (u64)ts.tv_sec * 1000000 + (u64)ts.tv_nsec / 1000;
+}
+
+fn int benchCompareU64(const void* a, const void* b) {
+  u64 x = *(u64*)a;
+  u64 y = *(u64*)b;
+  return x < y ? -1 : x > y;
+}
+
+// like spawnWanderers(), but 90% of them in the first BENCH_CROWDED_ROOMS rooms
+fn void benchSpawnSkewed(RoomList* rooms, Range1u64 lane_rooms) {
+  u64 crowded_count = BENCH_ENTITIES / 10 * 9;
+  for (u64 room_idx = lane_rooms.min; room_idx < lane_rooms.max; room_idx++) {
+    EntityStore* store = &rooms->items[room_idx].entities;
+    entityStoreSetLane(store, laneChunks());
+    u64 count = room_idx < BENCH_CROWDED_ROOMS
+      ? crowded_count / BENCH_CROWDED_ROOMS
+      : (BENCH_ENTITIES - crowded_count) / (rooms->length - BENCH_CROWDED_ROOMS);
+    for (u64 i = 0; i < count; i++) {
+      u64 r = u64Hash(room_idx * BENCH_ENTITIES + i);
+      RoomTransfer wanderer = {
+        .to_room = (u32)room_idx,
+        .x = (u8)r,
+        .y = (u8)(r >> 8),
+        .type = EntityCharacter,
+        .color = (u8)(r >> 16),
+        .features = entityFeaturesFromType(EntityCharacter),
+      };
+      roomAddEntity(store, &wanderer);
+    }
+  }
+}
+
+fn void* benchLane(void* params) {
+  LaneCtx* lane_ctx = (LaneCtx*)params;
+  ThreadContext tctx = {
+    .lane_ctx = *lane_ctx,
+  };
+  tctxInit(&tctx);
+  Arena scratch_arena = {0};
+  arenaInit(&scratch_arena);
+  Range1u64 lane_rooms = LaneRange(state.rooms.length);
+  if (bench_config.skewed) {
+    benchSpawnSkewed(&state.rooms, lane_rooms);
+  } else {
+    spawnWanderers(&state.rooms, lane_rooms, BENCH_ENTITIES);
+  }
+  LaneSync();
+  u64 start = osTimeMicrosecondsNow();
+  for (u64 frame = 1; frame <= BENCH_TICKS; frame++) {
+    if (bench_config.steal) {
+      workBegin(&state.room_work, state.rooms.length);
+    }
+    LaneSync();
+    arenaClear(&scratch_arena);
+    u64 cpu_start = benchThreadCpuUs();
+    RoomOutbox outbox = {0};
+    if (bench_config.steal) {
+      for (u64 room_idx; workNext(&state.room_work, &room_idx);) {
+        simulateRoom(&state.rooms.items[room_idx], frame, &outbox, &scratch_arena);
+      }
+    } else {
+      for (u64 room_idx = lane_rooms.min; room_idx < lane_rooms.max; room_idx++) {
+        simulateRoom(&state.rooms.items[room_idx], frame, &outbox, &scratch_arena);
+      }
+    }
+    RoomOutbox* outboxes = LaneGather(&outbox);
+    mergeRoomTransfers(&state.rooms, lane_rooms, outboxes);
+    bench_lane_cpu_us[LaneIdx()][frame - 1] = benchThreadCpuUs() - cpu_start;
+    LaneSync();
+  }
+  if (LaneIdx() == 0) {
+    bench_wall_us = osTimeMicrosecondsNow() - start;
+  }
+  return NULL;
+}
+
+fn void benchLanes(BenchConfig config) {
+  bench_config = config;
+  u64 lane_count = config.lane_count;
+  arenaInit(&permanent_arena);
+  chunkPoolInit(&state.chunk_pool, &permanent_arena, lane_count);
+  workInit(&state.room_work, &permanent_arena, lane_count, MAX_ROOMS);
+  roomsInit(&state.rooms, &permanent_arena);
+  LaneCtx* lane_ctxs = laneGroupAlloc(&permanent_arena, lane_count, LANE_BROADCAST_SIZE);
+  Thread threads[BENCH_MAX_LANES];
+  for (u64 i = 0; i < lane_count; i++) {
+    threads[i] = spawnThread(&benchLane, &lane_ctxs[i]);
+  }
+  for (u64 i = 0; i < lane_count; i++) {
+    osThreadJoin(threads[i], MAX_u64);
+  }
+
+  // with a core per lane a tick takes as long as its busiest lane (the syncs aside), which is what this machine
+  // can't show if it has fewer cores than lanes
+  u64 busiest_us[BENCH_TICKS];
+  u64 total_us = 0;
+  for (u64 f = 0; f < BENCH_TICKS; f++) {
+    busiest_us[f] = 0;
+    for (u64 l = 0; l < lane_count; l++) {
+      busiest_us[f] = Max(busiest_us[f], bench_lane_cpu_us[l][f]);
+      total_us += bench_lane_cpu_us[l][f];
+    }
+  }
+  qsort(busiest_us, BENCH_TICKS, sizeof(u64), benchCompareU64);
+  u64 p50 = Max(busiest_us[BENCH_TICKS / 2], 1);
+  u64 p99 = busiest_us[BENCH_TICKS * 99 / 100];
+  printf("  %lld lane%s: %7.1f ticks/s here, busiest lane p50 %6.2fms p99 %6.2fms (%7.1f ticks/s with a core per lane), all lanes %6.2fms/tick\n",
+         lane_count, lane_count == 1 ? " " : "s", BENCH_TICKS / ((f64)Max(bench_wall_us, 1) / 1000000.0),
+         p50 / 1000.0, p99 / 1000.0, 1000000.0 / p50, (f64)total_us / BENCH_TICKS / 1000.0);
+}
+
+i32 main(i32 argc, ptr argv[]) {
+  osInit();
+  u32 cpus[MAX_PLACEMENT_CPUS];
+  printf("%d wanderers in %d rooms, %d ticks per lane count, %d cpus\n", BENCH_ENTITIES, MAX_ROOMS, BENCH_TICKS,
+         osCpusAvailable(cpus, MAX_PLACEMENT_CPUS));
+  BenchConfig modes[] = {
+    { .skewed = false, .steal = true },
+    { .skewed = true, .steal = false },
+    { .skewed = true, .steal = true },
+  };
+  for (u32 m = 0; m < arrayLen(modes); m++) {
+    printf("%s, %s:\n", modes[m].skewed ? "skewed" : "even", modes[m].steal ? "stealing rooms" : "each lane's own rooms");
+    fflush(stdout);
+    for (u64 lane_count = 1; lane_count <= BENCH_MAX_LANES; lane_count *= 2) {
+      BenchConfig config = modes[m];
+      config.lane_count = lane_count;
+      pid_t pid = fork();
+      if (pid == 0) {
+        benchLanes(config);
+        fflush(stdout);
+        exit(0);
+      }
+      i32 status = 0;
+      waitpid(pid, &status, 0);
+      if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        printf("  %lld lanes failed (status %d)\n", lane_count, status);
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,192 @@
+// MB/s through BitWriter/BitReader for each kind of field the wire protocol uses, and through the snapshot writer
+// for a full snapshot and a delta of 10k entities. build + run with ./make.sh bench serialize run
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include "../shared.h"
+#include "../base/impl.c"
+#include "../spatial_grid.c"
+#include "../entity_store.c"
+#include "../snapshot.c"
+
+#define BENCH_VALUES (1 << 21) // per field kind
+#define BENCH_ENTITIES 10000
+#define BENCH_ENCODES 100
+#define BENCH_RUNS 3 // the best of these is reported
+
+typedef enum BenchFieldKind {
+  BenchFieldFixed64,
+  BenchFieldVarU64,
+  BenchFieldVarI64,
+  BenchField5Bits,
+  BenchFieldKind_Count,
+} BenchFieldKind;
+
+static const char* bench_field_kind_strings[] = {
+  "fixed 64 bit",
+  "varint",
+  "zigzag varint",
+  "5 bit field",
+};
+
+global u64 bench_rng = 7;
+
+fn u64 benchRandom() {
+  bench_rng = bench_rng * 6364136223846793005ull + 1;
+  return bench_rng;
+}
+
+fn void benchWrite(BitWriter* w, BenchFieldKind kind, u64 value) {
+  switch (kind) {
+    case BenchFieldFixed64: bitWrite(w, value, 64); break;
+    case BenchFieldVarU64: bitWriteVarU64(w, value); break;
+    case BenchFieldVarI64: bitWriteVarI64(w, (i64)value); break;
+    case BenchField5Bits: bitWrite(w, value, 5); break;
+    default: break;
+  }
+}
+
+fn u64 benchRead(BitReader* r, BenchFieldKind kind) {
+  switch (kind) {
+    case BenchFieldFixed64: return bitRead(r, 64);
+    case BenchFieldVarU64: return bitReadVarU64(r);
+    case BenchFieldVarI64: return (u64)bitReadVarI64(r);
+    case BenchField5Bits: return bitRead(r, 5);
+    default: return 0;
+  }
+}
+
+// what each kind carries in practice: ids and lengths of all sizes, small signed deltas, small enums
+fn u64 benchValue(BenchFieldKind kind) {
+  u64 r = benchRandom();
+  switch (kind) {
+    case BenchFieldVarU64: return (r >> 33) >> ((r >> 20) % 31);
+    case BenchFieldVarI64: return (u64)((i64)((r >> 33) % 1024) - 512);
+    case BenchField5Bits: return (r >> 33) & 31;
+    default: return r;
+  }
+}
+
+fn String benchNameOf(u64 eid) {
+  return (String){ .length = 8, .capacity = 8, .bytes = "wanderer" };
+}
+
+// every entity in the world that changed after `baseline` (all of them if it's 0), in slot order
+fn u64 benchEncode(SnapshotLog* log, u64 baseline, Arena* a, u32* part_count) {
+  SnapshotWorld* world = &log->world;
+  SnapshotStore* mirror = &world->stores[0];
+  SnapshotWriter w;
+  snapshotWriterBegin(&w, log, baseline, a);
+  for (u32 slot = 0; slot < mirror->capacity; slot++) {
+    u64 id = mirror->id[slot];
+    if (id == 0) {
+      continue;
+    }
+    u8 fields = baseline == 0 ? ENTITY_FIELDS_ALL : snapshotWorldChangedSince(world, id, baseline);
+    if (fields != 0) {
+      snapshotWriteEntity(&w, world, id, fields);
+    }
+  }
+  SnapshotParts parts = snapshotWriterFinish(&w);
+  u64 result = 0;
+  for (u32 i = 0; i < parts.count; i++) {
+    result += parts.items[i].len;
+  }
+  *part_count = parts.count;
+  return result;
+}
+
+fn void benchSnapshot(Arena* a, SnapshotLog* log, u64 baseline, const char* label) {
+  f64 best_us = 0;
+  u64 bytes = 0;
+  u32 part_count = 0;
+  for (u32 run = 0; run < BENCH_RUNS; run++) {
+    u64 start = osTimeMicrosecondsNow();
+    for (u32 i = 0; i < BENCH_ENCODES; i++) {
+      arenaClear(a);
+      bytes = benchEncode(log, baseline, a, &part_count);
+    }
+    f64 us = (f64)Max(osTimeMicrosecondsNow() - start, 1) / BENCH_ENCODES;
+    best_us = run == 0 ? us : Min(best_us, us);
+  }
+  printf("  %-6s %7lld bytes in %4d parts (%5.2f B/entity), %7.1fus each, %7.1f MB/s\n", label, bytes, part_count,
+         (f64)bytes / BENCH_ENTITIES, best_us, (f64)bytes / best_us);
+}
+
+i32 main(i32 argc, ptr argv[]) {
+  osInit();
+  Arena a = {0};
+  arenaInit(&a);
+  u64* values = arenaAllocArray(&a, u64, BENCH_VALUES);
+  u64 capacity = BENCH_VALUES * 10;
+  u8* bytes = arenaAlloc(&a, capacity);
+
+  printf("%d values per field kind, best of %d\n", BENCH_VALUES, BENCH_RUNS);
+  for (u32 kind = 0; kind < BenchFieldKind_Count; kind++) {
+    for (u64 i = 0; i < BENCH_VALUES; i++) {
+      values[i] = benchValue((BenchFieldKind)kind);
+    }
+    f64 best_write_us = 0;
+    f64 best_read_us = 0;
+    u64 len = 0;
+    for (u32 run = 0; run < BENCH_RUNS; run++) {
+      u64 start = osTimeMicrosecondsNow();
+      BitWriter w = bitWriter(bytes, capacity);
+      for (u64 i = 0; i < BENCH_VALUES; i++) {
+        benchWrite(&w, (BenchFieldKind)kind, values[i]);
+      }
+      u64 write_us = Max(osTimeMicrosecondsNow() - start, 1);
+      len = bitWriterBytes(&w);
+
+      start = osTimeMicrosecondsNow();
+      BitReader r = bitReader(bytes, len);
+      u64 mismatches = 0;
+      for (u64 i = 0; i < BENCH_VALUES; i++) {
+        mismatches += benchRead(&r, (BenchFieldKind)kind) != values[i];
+      }
+      u64 read_us = Max(osTimeMicrosecondsNow() - start, 1);
+      if (w.overflow || r.overflow || mismatches > 0) {
+        printf("%s didn't read back what was written\n", bench_field_kind_strings[kind]);
+        return 1;
+      }
+      best_write_us = run == 0 ? write_us : Min(best_write_us, write_us);
+      best_read_us = run == 0 ? read_us : Min(best_read_us, read_us);
+    }
+    printf("  %-14s %5.2f B/value, write %7.1f MB/s, read %7.1f MB/s\n", bench_field_kind_strings[kind],
+           (f64)len / BENCH_VALUES, (f64)len / best_write_us, (f64)len / best_read_us);
+  }
+
+  // a snapshot of everything, then a delta after every entity took a step
+  arenaClear(&a);
+  EntityChunkPool pool;
+  chunkPoolInit(&pool, &a, 1);
+  EntityStore store;
+  entityStoreInit(&store, &pool, 0, BENCH_ENTITIES);
+  entityStoreSetLane(&store, &pool.lanes[0]);
+  for (u32 i = 0; i < BENCH_ENTITIES; i++) {
+    u64 r = benchRandom();
+    EntityType type = i % 10 == 0 ? EntityCharacter : EntityWall;
+    entityStoreAdd(&store, type, type == EntityCharacter ? FeatureMask(FeatureWalksAround) : 0, (u8)(r >> 40), (u8)(r >> 48), (u8)(r >> 56));
+  }
+  SnapshotLog log;
+  snapshotLogInit(&log, 1, 1);
+  snapshotLogBegin(&log);
+  snapshotLogCapture(&log, 0, &store, &benchNameOf);
+  snapshotLogEnd(&log);
+  u64 baseline = log.seq;
+  for (u32 i = 0; i < BENCH_ENTITIES; i++) {
+    EntityChunk* chunk = entityStoreChunk(&store, i);
+    u64 c = EntityChunkOffset(i);
+    entityStoreMove(&store, i, (u8)(chunk->x[c] + 1), chunk->y[c]);
+  }
+  snapshotLogBegin(&log);
+  snapshotLogCapture(&log, 0, &store, &benchNameOf);
+  snapshotLogEnd(&log);
+
+  Arena encode_arena = {0};
+  arenaInit(&encode_arena);
+  printf("%d entity snapshots, 1 in 10 a character, best of %d\n", BENCH_ENTITIES, BENCH_RUNS);
+  benchSnapshot(&encode_arena, &log, 0, "full");
+  benchSnapshot(&encode_arena, &log, baseline, "delta");
+  return 0;
+}
@@ -0,0 +1,136 @@
+// the entity store's grid-backed neighborhood queries vs brute force, with 250k entities at random spots in one
+// store. build + run with ./make.sh bench spatial_grid run
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include "../shared.h"
+#include "../base/impl.c"
+#include "../spatial_grid.c"
+#include "../entity_store.c"
+
+#define BENCH_ENTITIES 250000
+#define BENCH_QUERIES 10000
+#define BENCH_BRUTE_QUERIES 100 // brute force is slow, and these double as the correctness check
+#define BENCH_RADIUS 4
+#define BENCH_RECT 16
+
+global u64 bench_rng = 3;
+
+fn u32 benchRandom() {
+  bench_rng = bench_rng * 6364136223846793005ull + 1;
+  return (u32)(bench_rng >> 33);
+}
+
+fn bool benchInRadius(u8 x, u8 y, u8 center_x, u8 center_y, u8 radius) {
+  i32 dx = (i32)x - center_x;
+  i32 dy = (i32)y - center_y;
+  return dx*dx + dy*dy <= (i32)radius*radius;
+}
+
+fn u64 benchBruteRadius(EntityStore* store, u8 x, u8 y, u8 radius) {
+  u64 result = 0;
+  for (u64 i = 0; i < store->length; i++) {
+    EntityChunk* chunk = entityStoreChunk(store, i);
+    u64 c = EntityChunkOffset(i);
+    result += benchInRadius(chunk->x[c], chunk->y[c], x, y, radius);
+  }
+  return result;
+}
+
+fn u64 benchBruteRect(EntityStore* store, u8 min_x, u8 min_y, u8 max_x, u8 max_y) {
+  u64 result = 0;
+  for (u64 i = 0; i < store->length; i++) {
+    EntityChunk* chunk = entityStoreChunk(store, i);
+    u64 c = EntityChunkOffset(i);
+    result += chunk->x[c] >= min_x && chunk->x[c] <= max_x && chunk->y[c] >= min_y && chunk->y[c] <= max_y;
+  }
+  return result;
+}
+
+i32 main(i32 argc, ptr argv[]) {
+  osInit();
+  Arena a = {0};
+  arenaInit(&a);
+  EntityChunkPool pool;
+  chunkPoolInit(&pool, &a, 1);
+  EntityStore store;
+  entityStoreInit(&store, &pool, 0, BENCH_ENTITIES);
+  entityStoreSetLane(&store, &pool.lanes[0]);
+  u64* out = arenaAllocArray(&a, u64, BENCH_ENTITIES);
+
+  u64 start = osTimeMicrosecondsNow();
+  for (u32 i = 0; i < BENCH_ENTITIES; i++) {
+    entityStoreAdd(&store, EntityWall, 0, (u8)benchRandom(), (u8)benchRandom(), 0);
+  }
+  u64 insert_us = osTimeMicrosecondsNow() - start;
+
+  start = osTimeMicrosecondsNow();
+  u64 radius_hits = 0;
+  for (u32 q = 0; q < BENCH_QUERIES; q++) {
+    u8 x = (u8)benchRandom();
+    u8 y = (u8)benchRandom();
+    radius_hits += entityStoreQueryRadius(&store, x, y, BENCH_RADIUS, out, BENCH_ENTITIES);
+  }
+  u64 radius_us = osTimeMicrosecondsNow() - start;
+
+  start = osTimeMicrosecondsNow();
+  u64 rect_hits = 0;
+  for (u32 q = 0; q < BENCH_QUERIES; q++) {
+    u8 x = (u8)(benchRandom() % (256 - BENCH_RECT));
+    u8 y = (u8)(benchRandom() % (256 - BENCH_RECT));
+    rect_hits += entityStoreQueryRect(&store, x, y, x + BENCH_RECT - 1, y + BENCH_RECT - 1, out, BENCH_ENTITIES);
+  }
+  u64 rect_us = osTimeMicrosecondsNow() - start;
+
+  // the same kind of queries without the grid, checked against it
+  u64 mismatches = 0;
+  u64 brute_radius_us = 0;
+  u64 brute_rect_us = 0;
+  for (u32 q = 0; q < BENCH_BRUTE_QUERIES; q++) {
+    u8 x = (u8)benchRandom();
+    u8 y = (u8)benchRandom();
+    start = osTimeMicrosecondsNow();
+    u64 brute = benchBruteRadius(&store, x, y, BENCH_RADIUS);
+    brute_radius_us += osTimeMicrosecondsNow() - start;
+    mismatches += brute != entityStoreQueryRadius(&store, x, y, BENCH_RADIUS, out, BENCH_ENTITIES);
+    x = (u8)(x % (256 - BENCH_RECT));
+    y = (u8)(y % (256 - BENCH_RECT));
+    start = osTimeMicrosecondsNow();
+    brute = benchBruteRect(&store, x, y, x + BENCH_RECT - 1, y + BENCH_RECT - 1);
+    brute_rect_us += osTimeMicrosecondsNow() - start;
+    mismatches += brute != entityStoreQueryRect(&store, x, y, x + BENCH_RECT - 1, y + BENCH_RECT - 1, out, BENCH_ENTITIES);
+  }
+
+  // a step each, like the walkers take every tick
+  start = osTimeMicrosecondsNow();
+  for (u32 i = 0; i < BENCH_ENTITIES; i++) {
+    EntityChunk* chunk = entityStoreChunk(&store, i);
+    u64 c = EntityChunkOffset(i);
+    i32 x = (i32)chunk->x[c] + (benchRandom() & 1 ? 1 : -1);
+    entityStoreMove(&store, i, (u8)Max(Min(x, 255), 0), chunk->y[c]);
+  }
+  u64 move_us = osTimeMicrosecondsNow() - start;
+
+  // everything has to still be findable after the moves, and after removing half
+  mismatches += entityStoreQueryRect(&store, 0, 0, 255, 255, NULL, 0) != store.length;
+  for (u32 i = 0; i < BENCH_ENTITIES / 2; i++) {
+    u64 index = benchRandom() % store.length;
+    entityStoreRemove(&store, entityStoreChunk(&store, index)->id[EntityChunkOffset(index)]);
+  }
+  mismatches += entityStoreQueryRect(&store, 0, 0, 255, 255, NULL, 0) != store.length;
+  for (u32 q = 0; q < BENCH_BRUTE_QUERIES; q++) {
+    u8 x = (u8)benchRandom();
+    u8 y = (u8)benchRandom();
+    mismatches += benchBruteRadius(&store, x, y, BENCH_RADIUS) != entityStoreQueryRadius(&store, x, y, BENCH_RADIUS, out, BENCH_ENTITIES);
+  }
+
+  printf("%d entities in one store\n", BENCH_ENTITIES);
+  printf("  insert all:           %7.2fms\n", insert_us / 1000.0);
+  printf("  radius-%d query:       %7.2fus avg (%.1f hits), brute force %.2fus\n", BENCH_RADIUS,
+         (f64)radius_us / BENCH_QUERIES, (f64)radius_hits / BENCH_QUERIES, (f64)brute_radius_us / BENCH_BRUTE_QUERIES);
+  printf("  %dx%d rect query:     %7.2fus avg (%.1f hits), brute force %.2fus\n", BENCH_RECT, BENCH_RECT,
+         (f64)rect_us / BENCH_QUERIES, (f64)rect_hits / BENCH_QUERIES, (f64)brute_rect_us / BENCH_BRUTE_QUERIES);
+  printf("  one step each:        %7.2fms\n", move_us / 1000.0);
+  printf("  %lld mismatches against brute force\n", mismatches);
+  return mismatches == 0 ? 0 : 1;
+}
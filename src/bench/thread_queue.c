@@ -0,0 +1,207 @@
+// items/s through a DefineThreadQueue() queue vs the mutex + cond queue it replaced, with 1/2/4/8 producers
+// pushing into one consumer (the shape of the server's send queue). build + run with ./make.sh bench thread_queue run
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include "../base/impl.c"
+#include "../lib/thread.c"
+#include "../lib/network.c"
+
+#define BENCH_QUEUE_LEN 64 // same as the server's NET_OUTGOING_MESSAGE_QUEUE_LEN
+#define BENCH_ITEMS (1 << 20) // per run, split between the producers
+#define BENCH_MAX_PRODUCERS 8
+#define BENCH_RUNS 3 // the best of these is reported
+
+// the queue every ThreadQueue used to be: a ring behind one mutex, with a cond for each side
+#define DefineMutexQueue(QueueType, queuePrefix, ItemType) \
+typedef struct QueueType { \
+  ItemType items[BENCH_QUEUE_LEN]; \
+  u32 head; \
+  u32 tail; \
+  u32 count; \
+  Mutex mutex; \
+  Cond not_empty; \
+  Cond not_full; \
+} QueueType; \
+\
+fn QueueType* queuePrefix##Alloc(Arena* a) { \
+  QueueType* result = arenaAllocAligned(a, sizeof(QueueType), CACHE_LINE_SIZE); \
+  MemoryZero(result, (sizeof *result)); \
+  result->mutex = newMutex(); \
+  result->not_full = newCond(); \
+  result->not_empty = newCond(); \
+  return result; \
+} \
+\
+fn void queuePrefix##Push(QueueType* q, ItemType* item) { \
+  lockMutex(&q->mutex); { \
+    while (q->count == BENCH_QUEUE_LEN) { \
+      waitForCondSignal(&q->not_full, &q->mutex); \
+    } \
+    q->items[q->tail] = *item; \
+    q->tail = (q->tail + 1) % BENCH_QUEUE_LEN; \
+    q->count++; \
+    signalCond(&q->not_empty); \
+  } unlockMutex(&q->mutex); \
+} \
+\
+fn void queuePrefix##Pop(QueueType* q, ItemType* copy_target) { \
+  lockMutex(&q->mutex); { \
+    while (q->count == 0) { \
+      waitForCondSignal(&q->not_empty, &q->mutex); \
+    } \
+    *copy_target = q->items[q->head]; \
+    q->head = (q->head + 1) % BENCH_QUEUE_LEN; \
+    q->count--; \
+    signalCond(&q->not_full); \
+  } unlockMutex(&q->mutex); \
+}
+
+typedef struct BenchItem {
+  u64 value;
+} BenchItem;
+
+DefineMutexQueue(MutexItemQueue, mutexItemQueue, BenchItem)
+DefineMutexQueue(MutexMessageQueue, mutexMessageQueue, UDPMessage)
+DefineThreadQueue(BenchItemQueue, benchItemQueue, BenchItem)
+
+typedef enum BenchQueueKind {
+  BenchQueueMutex,
+  BenchQueueThread,
+  BenchQueueThreadBatch, // the consumer pops with PopBatchWait, like the send thread does
+  BenchQueueKind_Count,
+} BenchQueueKind;
+
+static const char* bench_queue_kind_strings[] = {
+  "mutex + cond",
+  "ThreadQueue",
+  "ThreadQueue, batch pop",
+};
+
+typedef struct BenchRun {
+  BenchQueueKind kind;
+  bool messages; // UDPMessage items (what the send queue carries) instead of 8 byte ones
+  void* queue;
+  u64 items; // to push (a producer) or to pop (the consumer)
+  u64 producer_idx;
+  u64 sum; // what the consumer popped, checked against what was pushed
+} BenchRun;
+
+fn void* benchProducer(void* params) {
+  BenchRun* run = (BenchRun*)params;
+  BenchItem item = {0};
+  UDPMessage message = {0};
+  for (u64 i = 0; i < run->items; i++) {
+    u64 value = run->producer_idx * run->items + i + 1;
+    if (run->messages) {
+      MemoryCopy(message.bytes, &value, sizeof(value));
+      if (run->kind == BenchQueueMutex) {
+        mutexMessageQueuePush(run->queue, &message);
+      } else {
+        outgoingMessageQueuePush(run->queue, &message);
+      }
+    } else {
+      item.value = value;
+      if (run->kind == BenchQueueMutex) {
+        mutexItemQueuePush(run->queue, &item);
+      } else {
+        benchItemQueuePush(run->queue, &item);
+      }
+    }
+  }
+  return NULL;
+}
+
+fn void* benchConsumer(void* params) {
+  BenchRun* run = (BenchRun*)params;
+  BenchItem items[BENCH_QUEUE_LEN];
+  UDPMessage messages[BENCH_QUEUE_LEN];
+  for (u64 popped = 0; popped < run->items;) {
+    u32 count = 1;
+    if (run->messages) {
+      if (run->kind == BenchQueueMutex) {
+        mutexMessageQueuePop(run->queue, &messages[0]);
+      } else if (run->kind == BenchQueueThread) {
+        outgoingMessageQueuePop(run->queue, &messages[0]);
+      } else {
+        count = outgoingMessageQueuePopBatchWait(run->queue, messages, BENCH_QUEUE_LEN, MAX_u64);
+      }
+      for (u32 i = 0; i < count; i++) {
+        u64 value = 0;
+        MemoryCopy(&value, messages[i].bytes, sizeof(value));
+        run->sum += value;
+      }
+    } else {
+      if (run->kind == BenchQueueMutex) {
+        mutexItemQueuePop(run->queue, &items[0]);
+      } else if (run->kind == BenchQueueThread) {
+        benchItemQueuePop(run->queue, &items[0]);
+      } else {
+        count = benchItemQueuePopBatchWait(run->queue, items, BENCH_QUEUE_LEN, MAX_u64);
+      }
+      for (u32 i = 0; i < count; i++) {
+        run->sum += items[i].value;
+      }
+    }
+    popped += count;
+  }
+  return NULL;
+}
+
+// returns items/s, 0 if an item went missing or got popped twice
+fn f64 benchQueue(Arena* a, BenchQueueKind kind, bool messages, u64 producer_count) {
+  void* queue = NULL;
+  if (messages) {
+    queue = kind == BenchQueueMutex ? (void*)mutexMessageQueueAlloc(a) : (void*)outgoingMessageQueueAlloc(a, BENCH_QUEUE_LEN);
+  } else {
+    queue = kind == BenchQueueMutex ? (void*)mutexItemQueueAlloc(a) : (void*)benchItemQueueAlloc(a, BENCH_QUEUE_LEN);
+  }
+  u64 per_producer = BENCH_ITEMS / producer_count;
+  u64 total = per_producer * producer_count;
+  BenchRun consumer = { .kind = kind, .messages = messages, .queue = queue, .items = total };
+  BenchRun producers[BENCH_MAX_PRODUCERS];
+  Thread threads[BENCH_MAX_PRODUCERS];
+  u64 start = osTimeMicrosecondsNow();
+  Thread consumer_thread = spawnThread(&benchConsumer, &consumer);
+  for (u64 i = 0; i < producer_count; i++) {
+    producers[i] = (BenchRun){ .kind = kind, .messages = messages, .queue = queue, .items = per_producer, .producer_idx = i };
+    threads[i] = spawnThread(&benchProducer, &producers[i]);
+  }
+  for (u64 i = 0; i < producer_count; i++) {
+    osThreadJoin(threads[i], MAX_u64);
+  }
+  osThreadJoin(consumer_thread, MAX_u64);
+  u64 elapsed_us = Max(osTimeMicrosecondsNow() - start, 1);
+  if (consumer.sum != total * (total + 1) / 2) {
+    return 0;
+  }
+  return (f64)total / ((f64)elapsed_us / 1000000.0);
+}
+
+i32 main(i32 argc, ptr argv[]) {
+  osInit();
+  Arena a = {0};
+  arenaInit(&a);
+  printf("%d items per run through a %d slot queue into 1 consumer, best of %d\n", BENCH_ITEMS, BENCH_QUEUE_LEN, BENCH_RUNS);
+  for (u32 messages = 0; messages <= 1; messages++) {
+    printf("%s items:\n", messages ? "UDPMessage" : "8 byte");
+    for (u64 producers = 1; producers <= BENCH_MAX_PRODUCERS; producers *= 2) {
+      printf("  %lld producer%s:", producers, producers == 1 ? " " : "s");
+      for (u32 kind = 0; kind < BenchQueueKind_Count; kind++) {
+        f64 best = 0;
+        for (u32 run = 0; run < BENCH_RUNS; run++) {
+          arenaClear(&a);
+          f64 items_per_s = benchQueue(&a, (BenchQueueKind)kind, messages, producers);
+          if (items_per_s == 0) {
+            printf("\n%s lost or duplicated items\n", bench_queue_kind_strings[kind]);
+            return 1;
+          }
+          best = Max(best, items_per_s);
+        }
+        printf("  %s %6.2fM/s", bench_queue_kind_strings[kind], best / 1000000.0);
+      }
+      printf("\n");
+    }
+  }
+  return 0;
+}
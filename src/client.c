@@ -6,6 +6,7 @@
  *  my_variable
  *  MY_CONSTANT
  * */
+#define _GNU_SOURCE // recvmmsg()/sendmmsg()
 #include <string.h>
 #include "base/impl.c"
 #include "lib/network.c"
@@ -21,7 +22,8 @@
 #define GOAL_LOOPS_PER_S 50
 #define GOAL_LOOP_US 1000000/GOAL_LOOPS_PER_S
 #define LOGIN_NAME_BUFFER_LEN 16
-#define PARSED_SERVER_MESSAGE_THREAD_QUEUE_LEN 16
+#define PARSED_SERVER_MESSAGE_THREAD_QUEUE_LEN 1024 // must be a power of 2, a full snapshot can be a few hundred parts
+#define ENTITY_INDEX_INITIAL_CAPACITY 64 // must be a power of 2, grows as needed
 #define MAIN_GAME_TAB_COUNT (2)
 
 ///// TYPES
@@ -57,14 +59,24 @@ typedef struct Entity {
   u64 features;
   u64 id;
   StringChunkList name;
+  u64 snapshot_seq; // the last snapshot that had it
 } Entity;
 
 typedef struct EntityList {
   u64 length; // the currently used length
   u64 capacity;
   Entity* items;
+  U64Map index; // id -> index into items
 } EntityList;
 
+// the snapshot we're putting together out of its parts
+typedef struct SnapshotState {
+  u64 seq;
+  bool full; // anything it didn't mention is dropped once every part is in
+  u16 parts_left;
+  u64 parts_received[SNAPSHOT_MAX_PARTS/64]; // bitmap, parts can arrive twice
+} SnapshotState;
+
 typedef struct ParsedServerMessage {
   Message type;
   u16 port;
@@ -74,19 +86,13 @@ typedef struct ParsedServerMessage {
   u64 id;
   u64 server_frame;
   XYZ xyz;
+  u16 snapshot_len;
+  u8 snapshot[UDP_MAX_MESSAGE_LEN]; // a whole MessageSnapshot, header included
   //Entity entities[PARSED_CLIENT_ENTITY_LEN];
   //u64 ids[PARSED_IDS_LEN];
 } ParsedServerMessage;
 
-typedef struct ParsedServerMessageThreadQueue {
-  ParsedServerMessage items[PARSED_SERVER_MESSAGE_THREAD_QUEUE_LEN];
-  u32 head;
-  u32 tail;
-  u32 count;
-  Mutex mutex;
-  Cond not_empty;
-  Cond not_full;
-} ParsedServerMessageThreadQueue;
+DefineThreadQueue(ParsedServerMessageThreadQueue, psmThreadQueue, ParsedServerMessage)
 
 typedef struct LoginState {
   LoginScreenState state;
@@ -106,6 +112,7 @@ typedef struct GameState {
   Screen screen;
   Screen old_screen;
   EntityList entities;
+  SnapshotState snapshot;
   Entity me;
   u64 server_frame;
   u64 loop_count;
@@ -132,74 +139,41 @@ global ParsedServerMessageThreadQueue* network_recv_queue = {0};
 global str TABS[] = {"Debug", "Speak"};
 
 ///// FUNCTIONS
-fn ParsedServerMessageThreadQueue* newPSMThreadQueue(Arena* a) {
-  ParsedServerMessageThreadQueue* result = arenaAlloc(a, sizeof(ParsedServerMessageThreadQueue));
-  MemoryZero(result, (sizeof *result));
-  result->mutex = newMutex();
-  result->not_full = newCond();
-  result->not_empty = newCond();
-  return result;
-}
-
-fn void psmThreadSafeQueuePush(ParsedServerMessageThreadQueue* queue, ParsedServerMessage* msg) {
-  lockMutex(&queue->mutex); {
-    while (queue->count == PARSED_SERVER_MESSAGE_THREAD_QUEUE_LEN) {
-      waitForCondSignal(&queue->not_full, &queue->mutex);
-    }
-
-    MemoryCopy(&queue->items[queue->tail], msg, (sizeof *msg));
-    queue->tail = (queue->tail + 1) % PARSED_SERVER_MESSAGE_THREAD_QUEUE_LEN;
-    queue->count++;
-
-    signalCond(&queue->not_empty);
-  } unlockMutex(&queue->mutex);
-}
-
-fn ParsedServerMessage* psmThreadSafeNonblockingQueuePop(ParsedServerMessageThreadQueue* q, ParsedServerMessage* copy_target) {
-  // immediately returns NULL if there's nothing in the ThreadQueue
-  // copies the ParsedServerMessage into `copy_target` if there is something in the queue
-  // and marks it as popped from the queue
-  ParsedServerMessage* result = NULL;
-
-  lockMutex(&q->mutex); {
-    if (q->count > 0) {
-      result = &q->items[q->head];
-      MemoryCopy(copy_target, result, (sizeof *copy_target));
-      q->head = (q->head + 1) % PARSED_SERVER_MESSAGE_THREAD_QUEUE_LEN;
-      q->count--;
-
-      signalCond(&q->not_full);
-    }
-  } unlockMutex(&q->mutex);
-
-  return result;
-}
-
-fn void entityPush(EntityList* list, Entity e) {
+fn Entity* entityPush(EntityList* list, Entity e) {
   if (list->length >= list->capacity) {
-    arenaAllocArray(&state.entity_arena, Entity, list->capacity);
+    Entity* items = arenaAllocArray(&state.entity_arena, Entity, list->capacity * 2);
+    MemoryCopy(items, list->items, sizeof(Entity) * list->length);
+    list->items = items;
     list->capacity = list->capacity * 2;
   }
+  u64MapPut(&list->index, e.id, list->length);
   list->items[list->length] = e;
   list->length += 1;
+  return &list->items[list->length - 1];
+}
+
+fn Entity* entityFind(EntityList* list, u64 id) {
+  u64 index = 0;
+  if (!u64MapGet(&list->index, id, &index)) {
+    return NULL;
+  }
+  return &list->items[index];
 }
 
 fn bool entityDelete(EntityList* list, u64 id) {
-  assert(list->length > 0);
-  if (list->items[list->length - 1].id == id) {
-    list->length -= 1;
-    return true;
-  } else {
-    for (u32 i = 0; i < list->length; i++) {
-      if (list->items[i].id == id) {
-        // copy the last one over the one we are deleting
-        list->items[i] = list->items[list->length - 1];
-        list->length -= 1;
-        return true;
-      }
-    }
+  u64 index = 0;
+  if (!u64MapGet(&list->index, id, &index)) {
+    return false;
   }
-  return false;
+  u64MapRemove(&list->index, id);
+  releaseStringChunkList(&state.string_arena, &list->items[index].name);
+  // copy the last one over the one we are deleting
+  list->length -= 1;
+  if (index != list->length) {
+    list->items[index] = list->items[list->length];
+    u64MapPut(&list->index, list->items[index].id, index);
+  }
+  return true;
 }
 
 fn void addSystemMessage(u8* msg) {
@@ -342,33 +316,158 @@ fn void renderStaticAssetToPixelBuffer(TuiState* tui, u8* asset, u32 len, u16 x,
 fn void clearServerSentState() {
   //memset(&state.current_room, 0, sizeof(RenderableRoom));
 
+  for (u64 i = 0; i < state.entities.length; i++) {
+    releaseStringChunkList(&state.string_arena, &state.entities.items[i].name);
+  }
   arenaClear(&state.entity_arena);
   state.entities.capacity = 64;
   state.entities.length = 0;
   state.entities.items = arenaAllocArray(&state.entity_arena, Entity, state.entities.capacity);
+  u64MapInit(&state.entities.index, &state.entity_arena, ENTITY_INDEX_INITIAL_CAPACITY);
+  MemoryZeroStruct(&state.snapshot, SnapshotState);
+}
+
+// applies one part of a MessageSnapshot (see shared.h), parts of a snapshot can come in any order.
+// false if it's malformed or from an older snapshot than one we already have parts of
+fn bool applySnapshotPart(GameState* state, u8* message, u16 len) {
+  BitReader header = bitReader(message, len);
+  bitRead(&header, 8); // MessageSnapshot
+  SnapshotMessage m;
+  SnapshotState* snapshot = &state->snapshot;
+  if (!decodeSnapshotMessage(&header, &m) || m.seq < snapshot->seq || m.part >= m.part_count || m.part_count > SNAPSHOT_MAX_PARTS) {
+    return false;
+  }
+  u64 seq = m.seq;
+  u64 part = m.part;
+  BitReader r = bitReader(m.body.bytes, m.body.len);
+  if (seq > snapshot->seq) {
+    // a newer snapshot supersedes whatever's left of the one we were on. a delta's baseline is something
+    // we've had all of, and fields are absolute, so it's fine to apply on top of a half-applied one
+    snapshot->seq = seq;
+    snapshot->full = m.since_baseline == 0;
+    snapshot->parts_left = m.part_count;
+    MemoryZero(snapshot->parts_received, sizeof(snapshot->parts_received));
+  }
+  if (CheckFlag(snapshot->parts_received[part / 64], part % 64)) {
+    return true; // already have it
+  }
+  snapshot->parts_received[part / 64] |= 1ULL << (part % 64);
+  snapshot->parts_left -= 1;
+
+  u32 slot = 0;
+  for (u64 e = 0; e < m.entity_count && !r.overflow; e++) {
+    slot += (u32)bitReadVarU64(&r);
+    u64 id = EntityHandleMake(slot, bitReadVarU64(&r));
+    u8 fields = (u8)bitRead(&r, ENTITY_FIELD_MASK_BITS);
+    Entity* entity = entityFind(&state->entities, id);
+    if (entity == NULL) {
+      Entity fresh = { .id = id };
+      entity = entityPush(&state->entities, fresh);
+    }
+    entity->snapshot_seq = seq;
+    if (CheckFlag(fields, EntityFieldPosition)) {
+      entity->x = (u8)bitRead(&r, 8);
+      entity->y = (u8)bitRead(&r, 8);
+    }
+    if (CheckFlag(fields, EntityFieldType)) {
+      entity->type = (EntityType)bitRead(&r, ENTITY_TYPE_BITS);
+    }
+    if (CheckFlag(fields, EntityFieldColor)) {
+      entity->color = (u8)bitRead(&r, 8);
+    }
+    if (CheckFlag(fields, EntityFieldFeatures)) {
+      entity->features = bitReadVarU64(&r);
+    }
+    if (CheckFlag(fields, EntityFieldName)) {
+      u8 name_bytes[256];
+      u64 name_len = bitReadVarU64(&r);
+      if (name_len > sizeof(name_bytes)) {
+        r.overflow = true;
+        break;
+      }
+      bitReadBytes(&r, name_bytes, name_len);
+      String name = { .length = (u32)name_len, .capacity = (u32)name_len, .bytes = (ptr)name_bytes };
+      releaseStringChunkList(&state->string_arena, &entity->name);
+      entity->name = allocStringChunkList(&state->string_arena, name);
+    }
+  }
+  slot = 0;
+  for (u64 i = 0; i < m.removed_count && !r.overflow; i++) {
+    slot += (u32)bitReadVarI64(&r);
+    entityDelete(&state->entities, EntityHandleMake(slot, bitReadVarU64(&r)));
+  }
+  if (r.overflow) {
+    dbg("malformed snapshot %lld part %lld\n", seq, part);
+  }
+
+  if (snapshot->parts_left == 0) {
+    if (snapshot->full) {
+      for (u64 e = 0; e < state->entities.length;) {
+        if (state->entities.items[e].snapshot_seq != seq) {
+          entityDelete(&state->entities, state->entities.items[e].id); // swaps the last one into e
+        } else {
+          e += 1;
+        }
+      }
+    }
+    // so the next one can be a delta against this
+    UDPMessage ack = {0};
+    ack.address = state->client.server_address;
+    BitWriter w = bitWriter(ack.bytes, UDP_MAX_MESSAGE_LEN);
+    AckSnapshotCommand ack_snapshot = { .seq = seq };
+    encodeAckSnapshotCommand(&w, &ack_snapshot);
+    ack.bytes_len = (u16)bitWriterBytes(&w);
+    outgoingMessageQueuePush(network_send_queue, &ack);
+  }
+  return true;
 }
 
 fn void handleIncomingMessage(u8* message, u32 len, SocketAddress sender, i32 socket) {
-  Message msg_type = message[0];
-  dbg("handleIncomingMessage() of len=%d, message=%s\n", len, MESSAGE_STRINGS[msg_type]);
-  u8List bytes = {len, len, message};
-  u64 msg_pos = 1;
-  ParsedServerMessage parsed = {0};
-  parsed.type = msg_type;
-  switch (msg_type) {
-    case MessageNewAccountCreated:
-    case MessageBadPw: {/*nothing to parse but the type*/} break;
-    case MessageCharacterId: {
-      parsed.id = readU64FromBufferLE(message + 1);
-    } break;
-    case Message_Count:
-      assert(false && "invalid msg_type detected");
-      break;
-    case MessageInvalid:
-      addSystemMessage((u8*)"NOT IMPLEMENTED");
+  // the server packs several messages into one datagram, so keep parsing until we run out of bytes.
+  // a malformed message means we can't know where the next one starts, so it drops the rest of the datagram
+  BitReader r = bitReader(message, len);
+  while (bitReaderBytes(&r) < len) {
+    u64 start = bitReaderBytes(&r);
+    Message msg_type = (Message)bitRead(&r, 8);
+    dbg("handleIncomingMessage() of len=%d, message=%s\n", len, MESSAGE_STRINGS[msg_type < Message_Count ? msg_type : 0]);
+    ParsedServerMessage parsed = {0};
+    parsed.type = msg_type;
+    bool ok = false;
+    switch (msg_type) {
+      case MessageNewAccountCreated: {
+        NewAccountCreatedMessage new_account;
+        ok = decodeNewAccountCreatedMessage(&r, &new_account);
+      } break;
+      case MessageBadPw: {
+        BadPwMessage bad_pw;
+        ok = decodeBadPwMessage(&r, &bad_pw);
+      } break;
+      case MessageCharacterId: {
+        CharacterIdMessage character_id;
+        ok = decodeCharacterIdMessage(&r, &character_id);
+        parsed.id = character_id.id;
+      } break;
+      case MessageSnapshot: {
+        // only the header is needed here (to find where the next message starts), the body is applied on
+        // the main thread, out of a copy since `message` gets reused
+        SnapshotMessage snapshot;
+        ok = decodeSnapshotMessage(&r, &snapshot);
+        if (ok) {
+          parsed.snapshot_len = (u16)(bitReaderBytes(&r) - start);
+          MemoryCopy(parsed.snapshot, message + start, parsed.snapshot_len);
+        }
+      } break;
+      case MessageInvalid:
+      case Message_Count:
+      default:
+        addSystemMessage((u8*)"NOT IMPLEMENTED");
+        break;
+    }
+    if (!ok) {
       break;
+    }
+    psmThreadQueuePush(network_recv_queue, &parsed);
   }
-  psmThreadSafeQueuePush(network_recv_queue, &parsed);
 }
 
 fn void* receiveNetworkUpdates(void* udp) {
@@ -415,8 +514,7 @@ fn bool updateAndRender(TuiState* tui, void* s, u8* input_buffer, u64 loop_count
   // process server messages
   u32 msg_iters = 0;
   ParsedServerMessage msg = {0};
-  ParsedServerMessage* next_net_msg = psmThreadSafeNonblockingQueuePop(network_recv_queue, &msg);
-  while (next_net_msg != NULL) {
+  while (psmThreadQueueTryPop(network_recv_queue, &msg)) {
     msg_iters += 0;
     switch (msg.type) {
       case MessageNewAccountCreated: {
@@ -434,12 +532,14 @@ fn bool updateAndRender(TuiState* tui, void* s, u8* input_buffer, u64 loop_count
         state->menu.selected_index = 0;
         state->section.selected_index = 0;
       } break;
+      case MessageSnapshot: {
+        applySnapshotPart(state, msg.snapshot, msg.snapshot_len);
+      } break;
       case Message_Count:
       case MessageInvalid:
         assert(false && "invalid message from queue");
         break;
     }
-    next_net_msg = psmThreadSafeNonblockingQueuePop(network_recv_queue, &msg);
     msg_iters++;
   }
   
@@ -479,11 +579,12 @@ fn bool updateAndRender(TuiState* tui, void* s, u8* input_buffer, u64 loop_count
           // send character color to server
           UDPMessage msg = {0};
           msg.address = udp->server_address;
-          msg.bytes_len = 2;
-          // 1. msg type/CommandType
-          msg.bytes[0] = CommandCreateCharacter;
-          // 2. what color
-          msg.bytes[1] = ANSI_HP_RED;//WIZARD_COLORS[state->choices[0]];
+          BitWriter w = bitWriter(msg.bytes, UDP_MAX_MESSAGE_LEN);
+          CreateCharacterCommand create = {
+            .color = ANSI_HP_RED,//WIZARD_COLORS[state->choices[0]];
+          };
+          encodeCreateCharacterCommand(&w, &create);
+          msg.bytes_len = (u16)bitWriterBytes(&w);
 
           outgoingMessageQueuePush(network_send_queue, &msg);
 
@@ -572,23 +673,20 @@ fn bool updateAndRender(TuiState* tui, void* s, u8* input_buffer, u64 loop_count
           state->login_state.selected_field = 1;
           state->login_state.field_index = 0;
         } else {
-          u32 msg_idx = 0;
           // drop the login message into the network_send_queue
           UDPMessage msg = {0};
           msg.address = udp->server_address;
-          // 1. msg type/CommandType
-          msg.bytes[msg_idx++] = CommandLogin;
-          // 2. our LAN-IP to handle the case where we are on the same LAN as the guy we are trying to fight
-          // and our "listened" UDP port
-          msg_idx += writeU16ToBufferLE(msg.bytes + msg_idx, ~(udp->client_port));
-          msg_idx += writeI32ToBufferLE(msg.bytes + msg_idx, ~osLanIPAddress());
-          // 2. how long is the name
-          msg.bytes[msg_idx++] = state->login_state.name.length;
-          // 3. the name
-          memcpy(msg.bytes + msg_idx, state->login_state.name.bytes, state->login_state.name.length);
-          // 4. the password
-          memcpy(msg.bytes + msg_idx + state->login_state.name.length, state->login_state.password.bytes, state->login_state.password.length);
-          msg.bytes_len = msg_idx + state->login_state.name.length + state->login_state.password.length;
+          LoginCommand login = {
+            // our LAN-IP to handle the case where we are on the same LAN as the guy we are trying to fight
+            // and our "listened" UDP port
+            .lan_port = (u16)~(udp->client_port),
+            .lan_ip = (u32)~osLanIPAddress(),
+            .name = wireBytes((u8*)state->login_state.name.bytes, state->login_state.name.length),
+            .pass = wireBytes((u8*)state->login_state.password.bytes, state->login_state.password.length),
+          };
+          BitWriter w = bitWriter(msg.bytes, UDP_MAX_MESSAGE_LEN);
+          encodeLoginCommand(&w, &login);
+          msg.bytes_len = (u16)bitWriterBytes(&w);
           addSystemMessage((u8*)state->login_state.name.bytes);
           addSystemMessage((u8*)state->login_state.password.bytes);
           outgoingMessageQueuePush(network_send_queue, &msg);
@@ -693,11 +791,9 @@ i32 main(i32 argc, ptr argv[]) {
   // clear and init the state
   arenaInit(&permanent_arena);
   arenaInit(&state.entity_arena);
-  state.entities.capacity = 64;
-  state.entities.length = 0;
-  state.entities.items = arenaAllocArray(&state.entity_arena, Entity, state.entities.capacity);
   arenaInit(&state.string_arena.a);
   state.string_arena.mutex = newMutex();
+  clearServerSentState();
   state.message_input = stringChunkListInit(&state.string_arena);
   for (i32 i = 0; i < SYSTEM_MESSAGES_LEN; i++) {
     system_messages[i].capacity = MAX_SYSTEM_MESSAGE_LEN;
@@ -706,8 +802,8 @@ i32 main(i32 argc, ptr argv[]) {
   }
 
   // network queues
-  network_send_queue = newOutgoingMessageQueue(&permanent_arena);
-  network_recv_queue = newPSMThreadQueue(&permanent_arena);
+  network_send_queue = outgoingMessageQueueAlloc(&permanent_arena, NET_OUTGOING_MESSAGE_QUEUE_LEN);
+  network_recv_queue = psmThreadQueueAlloc(&permanent_arena, PARSED_SERVER_MESSAGE_THREAD_QUEUE_LEN);
  
   // draw login screen, get input username + password
   state.screen = ScreenLogin;
@@ -725,8 +821,10 @@ i32 main(i32 argc, ptr argv[]) {
 
   // "hardcoded" keep alive message to periodically send to server
   state.keep_alive_msg.address = state.client.server_address;
-  state.keep_alive_msg.bytes[0] = CommandKeepAlive;
-  state.keep_alive_msg.bytes_len = 1;
+  BitWriter keep_alive_writer = bitWriter(state.keep_alive_msg.bytes, UDP_MAX_MESSAGE_LEN);
+  KeepAliveCommand keep_alive = {0};
+  encodeKeepAliveCommand(&keep_alive_writer, &keep_alive);
+  state.keep_alive_msg.bytes_len = (u16)bitWriterBytes(&keep_alive_writer);
 
   Thread recv_thread = spawnThread(&receiveNetworkUpdates, &state.client);
   Thread send_thread = spawnThread(&sendNetworkUpdates, &state.client);
@@ -0,0 +1,361 @@
+#include "entity_store.h"
+
+#define CHUNK_POOL_PTR_MASK 0x0000ffffffffffffull
+#define CHUNK_POOL_TAG_ONE  0x0001000000000000ull
+
+fn void chunkPoolInit(EntityChunkPool* pool, Arena* a, u64 lane_count) {
+  MemoryZeroStruct(pool, EntityChunkPool);
+  pool->lane_count = lane_count;
+  pool->lanes = arenaAllocAligned(a, sizeof(EntityChunkLaneCache) * lane_count, CACHE_LINE_SIZE);
+  MemoryZero(pool->lanes, sizeof(EntityChunkLaneCache) * lane_count);
+  for (u64 i = 0; i < lane_count; i++) {
+    arenaInit(&pool->lanes[i].arena);
+  }
+}
+
+fn void chunkPoolPushBatch(EntityChunkPool* pool, EntityChunk* batch) {
+  assert(((u64)batch & ~CHUNK_POOL_PTR_MASK) == 0);
+  u64 head = AtomicLoadAcquire(&pool->global_head);
+  while (true) {
+    batch->next_batch = (EntityChunk*)(head & CHUNK_POOL_PTR_MASK);
+    u64 new_head = ((head & ~CHUNK_POOL_PTR_MASK) + CHUNK_POOL_TAG_ONE) | (u64)batch;
+    if (AtomicCompareExchange(&pool->global_head, &head, new_head)) {
+      return;
+    }
+  }
+}
+
+fn EntityChunk* chunkPoolPopBatch(EntityChunkPool* pool) {
+  u64 head = AtomicLoadAcquire(&pool->global_head);
+  while (true) {
+    EntityChunk* batch = (EntityChunk*)(head & CHUNK_POOL_PTR_MASK);
+    if (batch == NULL) {
+      return NULL;
+    }
+    // chunks are never freed, so reading next_batch is safe even if someone popped `batch` first, the tag makes our CAS fail then
+    u64 new_head = ((head & ~CHUNK_POOL_PTR_MASK) + CHUNK_POOL_TAG_ONE) | (u64)batch->next_batch;
+    if (AtomicCompareExchange(&pool->global_head, &head, new_head)) {
+      return batch;
+    }
+  }
+}
+
+// the lane's own cache first, then a batch off the global stack, then fresh memory
+fn EntityChunk* chunkPoolAlloc(EntityChunkPool* pool, EntityChunkLaneCache* cache) {
+  if (cache->count == 0) {
+    EntityChunk* batch = chunkPoolPopBatch(pool);
+    for (EntityChunk* chunk = batch; chunk != NULL; chunk = chunk->next) {
+      cache->items[cache->count++] = chunk;
+    }
+  }
+  if (cache->count > 0) {
+    return cache->items[--cache->count];
+  }
+  cache->allocated += 1;
+  return arenaAlloc(&cache->arena, sizeof(EntityChunk));
+}
+
+// hands the oldest ENTITY_CHUNK_POOL_BATCH cached chunks to the global stack when the cache is full
+fn void chunkPoolRelease(EntityChunkPool* pool, EntityChunkLaneCache* cache, EntityChunk* chunk) {
+  if (cache->count == ENTITY_CHUNK_POOL_LANE_CAPACITY) {
+    for (u32 i = 0; i < ENTITY_CHUNK_POOL_BATCH; i++) {
+      cache->items[i]->next = i + 1 < ENTITY_CHUNK_POOL_BATCH ? cache->items[i + 1] : NULL;
+    }
+    chunkPoolPushBatch(pool, cache->items[0]);
+    MemoryCopy(cache->items, cache->items + ENTITY_CHUNK_POOL_BATCH, sizeof(EntityChunk*) * (cache->count - ENTITY_CHUNK_POOL_BATCH));
+    cache->count -= ENTITY_CHUNK_POOL_BATCH;
+  }
+  cache->items[cache->count++] = chunk;
+}
+
+// nothing is allocated until the first entityStoreAdd(), which needs a lane set
+fn void entityStoreInit(EntityStore* store, EntityChunkPool* pool, u32 store_idx, u64 max_capacity) {
+  assert(max_capacity <= (1 << ENTITY_STORE_SLOT_BITS) && store_idx < (1 << (32 - ENTITY_STORE_SLOT_BITS)));
+  MemoryZeroStruct(store, EntityStore);
+  store->pool = pool;
+  store->max_capacity = max_capacity;
+  store->slot_base = store_idx << ENTITY_STORE_SLOT_BITS;
+  spatialGridInit(&store->grid, NULL, 0);
+}
+
+fn void entityStoreSetLane(EntityStore* store, EntityChunkLaneCache* lane) {
+  store->lane = lane;
+  store->arena = &lane->arena;
+  store->grid.arena = &lane->arena;
+}
+
+fn EntityChunk* entityStoreChunk(EntityStore* store, u64 index) {
+  return store->columns.directory[index >> ENTITY_CHUNK_SHIFT];
+}
+
+fn void entityStorePushChunk(EntityStore* store) {
+  ChunkedEntityList* list = &store->columns;
+  if (list->chunks == list->directory_capacity) {
+    u64 capacity = Max(list->directory_capacity * 2, ENTITY_CHUNK_DIRECTORY_INITIAL_CAPACITY);
+    EntityChunk** directory = arenaAllocArray(store->arena, EntityChunk*, capacity);
+    if (list->chunks > 0) {
+      MemoryCopy(directory, list->directory, sizeof(EntityChunk*) * list->chunks);
+    }
+    list->directory = directory;
+    list->directory_capacity = capacity;
+  }
+  list->directory[list->chunks++] = chunkPoolAlloc(store->pool, store->lane);
+}
+
+fn void entityStoreGrowSlots(EntityStore* store) {
+  u64 capacity = Min(Max(store->slot_capacity * 2, ENTITY_STORE_INITIAL_SLOTS), store->max_capacity);
+  EntitySlot* slots = arenaAllocArray(store->arena, EntitySlot, capacity);
+  if (store->slot_count > 0) {
+    MemoryCopy(slots, store->slots, sizeof(EntitySlot) * store->slot_count);
+  }
+  store->slots = slots;
+  store->slot_capacity = capacity;
+  spatialGridReserve(&store->grid, capacity);
+}
+
+fn u64 entityStoreAdd(EntityStore* store, EntityType type, u64 features, u8 x, u8 y, u8 color) {
+  assert(store->lane != NULL);
+  if (store->length == store->max_capacity) {
+    return 0;
+  }
+  if (store->length == store->columns.chunks * ENTITY_CHUNK_LEN) {
+    entityStorePushChunk(store);
+  }
+  // reuse a free slot before handing out a new one, so slot_count never passes max_capacity
+  u32 slot_idx;
+  if (store->free_slot != 0) {
+    slot_idx = store->free_slot - 1;
+    store->free_slot = store->slots[slot_idx].dense;
+  } else {
+    if (store->slot_count == store->slot_capacity) {
+      entityStoreGrowSlots(store);
+    }
+    slot_idx = (u32)store->slot_count++;
+    store->slots[slot_idx].generation = 1;
+  }
+  EntitySlot* slot = &store->slots[slot_idx];
+  u64 handle = EntityHandleMake(store->slot_base + slot_idx, slot->generation);
+  u64 index = store->length;
+  slot->dense = (u32)index;
+  EntityChunk* chunk = entityStoreChunk(store, index);
+  u64 c = EntityChunkOffset(index);
+  chunk->slot[c] = slot_idx;
+  chunk->id[c] = handle;
+  chunk->features[c] = features;
+  chunk->x[c] = x;
+  chunk->y[c] = y;
+  chunk->type[c] = (u8)type;
+  chunk->color[c] = color;
+  chunk->misc[c] = 0;
+  chunk->changed[c] = 0;
+  store->length += 1;
+  spatialGridInsert(&store->grid, slot_idx, x, y);
+  entityStoreMarkChanged(store, index, ENTITY_FIELDS_ALL);
+  return handle;
+}
+
+// swaps the last entity into the hole so the columns stay dense. this moves that entity's index (not its handle).
+// once the store has a whole chunk to spare besides its last, the last goes back to the pool
+fn bool entityStoreRemove(EntityStore* store, u64 handle) {
+  u64 index = entityStoreIndex(store, handle);
+  if (index == ENTITY_STORE_NOT_FOUND) {
+    return false;
+  }
+  assert(store->lane != NULL);
+  u64 last = store->length - 1;
+  if (index != last) {
+    EntityChunk* hole = entityStoreChunk(store, index);
+    EntityChunk* from = entityStoreChunk(store, last);
+    u64 h = EntityChunkOffset(index);
+    u64 f = EntityChunkOffset(last);
+    hole->slot[h] = from->slot[f];
+    hole->id[h] = from->id[f];
+    hole->features[h] = from->features[f];
+    hole->x[h] = from->x[f];
+    hole->y[h] = from->y[f];
+    hole->type[h] = from->type[f];
+    hole->color[h] = from->color[f];
+    hole->misc[h] = from->misc[f];
+    hole->changed[h] = from->changed[f];
+    store->slots[hole->slot[h]].dense = (u32)index;
+  }
+  store->length -= 1;
+  ChunkedEntityList* list = &store->columns;
+  if (list->chunks >= 2 && store->length <= (list->chunks - 2) * ENTITY_CHUNK_LEN) {
+    list->chunks -= 1;
+    chunkPoolRelease(store->pool, store->lane, list->directory[list->chunks]);
+  }
+
+  entityIdListPush(&store->removed, store->arena, handle);
+
+  // retire the handle and put the slot on the free list
+  u32 slot_idx = EntityHandleSlot(handle) - store->slot_base;
+  spatialGridRemove(&store->grid, slot_idx);
+  EntitySlot* slot = &store->slots[slot_idx];
+  slot->generation += 1;
+  if (slot->generation == 0) {
+    slot->generation = 1; // 0 would make EntityHandleMake(0, 0) == 0 a live handle
+  }
+  slot->dense = store->free_slot;
+  store->free_slot = slot_idx + 1;
+  return true;
+}
+
+// a handle is live iff its slot's generation still matches, since removal bumps the generation.
+// one from another store wraps around to a slot_idx past slot_count
+fn u64 entityStoreIndex(EntityStore* store, u64 handle) {
+  u32 slot_idx = EntityHandleSlot(handle) - store->slot_base;
+  if (slot_idx >= store->slot_count || store->slots[slot_idx].generation != EntityHandleGeneration(handle)) {
+    return ENTITY_STORE_NOT_FOUND;
+  }
+  return store->slots[slot_idx].dense;
+}
+
+fn void entityStoreMove(EntityStore* store, u64 index, u8 x, u8 y) {
+  EntityChunk* chunk = entityStoreChunk(store, index);
+  u64 c = EntityChunkOffset(index);
+  chunk->x[c] = x;
+  chunk->y[c] = y;
+  entityStoreMarkChanged(store, index, 1 << EntityFieldPosition);
+  spatialGridMove(&store->grid, chunk->slot[c], x, y);
+}
+
+fn void entityIdListPush(EntityIdList* list, Arena* a, u64 id) {
+  if (list->count == list->capacity) {
+    u64 capacity = Max(list->capacity * 2, 64);
+    u64* items = arenaAllocArray(a, u64, capacity);
+    if (list->count > 0) {
+      MemoryCopy(items, list->items, sizeof(u64) * list->count);
+    }
+    list->items = items;
+    list->capacity = capacity;
+  }
+  list->items[list->count++] = id;
+}
+
+fn void entityStoreMarkChanged(EntityStore* store, u64 index, u8 fields) {
+  EntityChunk* chunk = entityStoreChunk(store, index);
+  u64 c = EntityChunkOffset(index);
+  if (chunk->changed[c] == 0) {
+    entityIdListPush(&store->dirty, store->arena, chunk->id[c]);
+  }
+  chunk->changed[c] |= fields;
+}
+
+fn void entityChangesPush(EntityChanges* changes, Arena* a, u64 id, u8 fields) {
+  if (changes->count == changes->capacity) {
+    u64 capacity = Max(changes->capacity * 2, 64);
+    u64* ids = arenaAllocArray(a, u64, capacity);
+    u8* masks = arenaAllocArray(a, u8, capacity);
+    if (changes->count > 0) {
+      MemoryCopy(ids, changes->ids, sizeof(u64) * changes->count);
+      MemoryCopy(masks, changes->fields, changes->count);
+    }
+    changes->ids = ids;
+    changes->fields = masks;
+    changes->capacity = capacity;
+  }
+  changes->ids[changes->count] = id;
+  changes->fields[changes->count] = fields;
+  changes->count += 1;
+}
+
+fn void entityStoreTakeChanges(EntityStore* store, Arena* a, EntityChanges* out) {
+  out->count = 0;
+  out->removed.count = 0;
+  for (u64 i = 0; i < store->dirty.count; i++) {
+    u64 index = entityStoreIndex(store, store->dirty.items[i]);
+    if (index == ENTITY_STORE_NOT_FOUND) {
+      continue; // removed since, which `removed` covers
+    }
+    EntityChunk* chunk = entityStoreChunk(store, index);
+    u64 c = EntityChunkOffset(index);
+    entityChangesPush(out, a, store->dirty.items[i], chunk->changed[c]);
+    chunk->changed[c] = 0;
+  }
+  for (u64 i = 0; i < store->removed.count; i++) {
+    entityIdListPush(&out->removed, a, store->removed.items[i]);
+  }
+  store->dirty.count = 0;
+  store->removed.count = 0;
+}
+
+fn u64 entityStoreQueryRect(EntityStore* store, u8 min_x, u8 min_y, u8 max_x, u8 max_y, u64* out, u64 max) {
+  u64 result = 0;
+  SpatialCellRange cells = spatialGridCellsInRect(min_x, min_y, max_x, max_y);
+  for (u32 cy = cells.min_y; cy <= cells.max_y; cy++) {
+    for (u32 cx = cells.min_x; cx <= cells.max_x; cx++) {
+      SpatialCell* cell = &store->grid.cells[cy * SPATIAL_GRID_DIM + cx];
+      for (u32 i = 0; i < cell->count; i++) {
+        u64 index = store->slots[cell->ids[i]].dense;
+        EntityChunk* chunk = entityStoreChunk(store, index);
+        u8 x = chunk->x[EntityChunkOffset(index)];
+        u8 y = chunk->y[EntityChunkOffset(index)];
+        if (x >= min_x && x <= max_x && y >= min_y && y <= max_y) {
+          if (result < max) {
+            out[result] = index;
+          }
+          result += 1;
+        }
+      }
+    }
+  }
+  return result;
+}
+
+fn u64 entityStoreQueryRadius(EntityStore* store, u8 x, u8 y, u8 radius, u64* out, u64 max) {
+  u64 result = 0;
+  u8 min_x = x > radius ? x - radius : 0;
+  u8 min_y = y > radius ? y - radius : 0;
+  u8 max_x = x < 255 - radius ? x + radius : 255;
+  u8 max_y = y < 255 - radius ? y + radius : 255;
+  i32 radius_sq = (i32)radius * (i32)radius;
+  SpatialCellRange cells = spatialGridCellsInRect(min_x, min_y, max_x, max_y);
+  for (u32 cy = cells.min_y; cy <= cells.max_y; cy++) {
+    for (u32 cx = cells.min_x; cx <= cells.max_x; cx++) {
+      SpatialCell* cell = &store->grid.cells[cy * SPATIAL_GRID_DIM + cx];
+      for (u32 i = 0; i < cell->count; i++) {
+        u64 index = store->slots[cell->ids[i]].dense;
+        EntityChunk* chunk = entityStoreChunk(store, index);
+        i32 dx = (i32)chunk->x[EntityChunkOffset(index)] - (i32)x;
+        i32 dy = (i32)chunk->y[EntityChunkOffset(index)] - (i32)y;
+        if (dx*dx + dy*dy <= radius_sq) {
+          if (result < max) {
+            out[result] = index;
+          }
+          result += 1;
+        }
+      }
+    }
+  }
+  return result;
+}
+
+fn bool entityQueryMatches(EntityQuery query, u64 features) {
+  return (features & query.required) == query.required && (features & query.excluded) == 0;
+}
+
+fn bool entityQueryNextRange(EntityStore* store, EntityQuery query, Range1u64 within, u64* cursor, Range1u64* run) {
+  u64 end = Min(within.max, store->length);
+  u64 i = Max(*cursor, within.min);
+  // only the features column is touched to find the run
+  while (i < end) {
+    u64* features = entityStoreChunk(store, i)->features;
+    u64 chunk_end = Min(end, (i | (ENTITY_CHUNK_LEN-1)) + 1);
+    while (i < chunk_end && !entityQueryMatches(query, features[EntityChunkOffset(i)])) {
+      i += 1;
+    }
+    if (i == chunk_end) {
+      continue;
+    }
+    run->min = i;
+    while (i < chunk_end && entityQueryMatches(query, features[EntityChunkOffset(i)])) {
+      i += 1;
+    }
+    run->max = i;
+    *cursor = i;
+    return true;
+  }
+  *cursor = end;
+  return false;
+}
@@ -0,0 +1,148 @@
+#ifndef ENTITY_STORE_H
+#define ENTITY_STORE_H
+
+#include "base/all.h"
+#include "shared.h"
+#include "spatial_grid.h"
+
+// the server has more than one store (one per room), a handle's slot (see shared.h) has the store in its top bits
+// and the slot in that store in the rest, so handles from different stores never collide
+#define ENTITY_STORE_SLOT_BITS 20 // [12 store][20 slot in the store]
+#define EntityHandleStore(handle) (EntityHandleSlot(handle) >> ENTITY_STORE_SLOT_BITS)
+
+#define ENTITY_CHUNK_SHIFT 8
+#define ENTITY_CHUNK_LEN (1 << ENTITY_CHUNK_SHIFT) // entities per EntityChunk
+#define EntityChunkOffset(index) ((index) & (ENTITY_CHUNK_LEN-1))
+#define ENTITY_CHUNK_DIRECTORY_INITIAL_CAPACITY 8
+#define ENTITY_CHUNK_POOL_BATCH 32 // # of chunks moved between a lane's cache and the global stack at once
+#define ENTITY_CHUNK_POOL_LANE_CAPACITY (ENTITY_CHUNK_POOL_BATCH*2)
+#define ENTITY_STORE_INITIAL_SLOTS 16 // grows up to the store's max_capacity
+
+// a growable list of handles
+typedef struct EntityIdList {
+  u64* items;
+  u64 count;
+  u64 capacity;
+} EntityIdList;
+
+// what happened to a store's entities between two entityStoreTakeChanges()
+typedef struct EntityChanges {
+  u64* ids; // handles of the entities that changed (and are still around)
+  u8* fields; // the EntityField bits that changed, parallel to ids
+  u64 count;
+  u64 capacity;
+  EntityIdList removed;
+} EntityChanges;
+
+typedef struct EntitySlot {
+  u32 generation;
+  u32 dense; // index into the columns while the slot is alive, (next free slot + 1) while it's free
+} EntitySlot;
+
+// ENTITY_CHUNK_LEN entities' worth of every column. a store's entity i is at EntityChunkOffset(i) in the
+// store's chunk i >> ENTITY_CHUNK_SHIFT
+typedef struct EntityChunk {
+  u64 id[ENTITY_CHUNK_LEN]; // the handle
+  u64 features[ENTITY_CHUNK_LEN]; // bitmask of 1 << EntityFeature
+  u32 slot[ENTITY_CHUNK_LEN]; // dense -> sparse (without slot_base), so swap-remove can fix up the moved entity's slot
+  u32 misc[ENTITY_CHUNK_LEN];
+  u8 x[ENTITY_CHUNK_LEN];
+  u8 y[ENTITY_CHUNK_LEN];
+  u8 type[ENTITY_CHUNK_LEN]; // EntityType
+  u8 color[ENTITY_CHUNK_LEN];
+  u8 changed[ENTITY_CHUNK_LEN]; // EntityField bits changed since the last entityStoreTakeChanges()
+  struct EntityChunk* next; // the next chunk of a batch on EntityChunkPool's global stack
+  struct EntityChunk* next_batch; // only used while the chunk heads a batch there
+} EntityChunk;
+
+// a store's chunks in order. directory[i] holds its entities i*ENTITY_CHUNK_LEN and up, so any index
+// resolves in O(1), and growing is one more chunk rather than copying every column
+typedef struct ChunkedEntityList {
+  u64 chunks; // the # of chunks in this list so far
+  EntityChunk** directory; // directory[i] is the i-th chunk
+  u64 directory_capacity; // doubles when it fills up
+} ChunkedEntityList;
+
+// free EntityChunks. every lane has its own LIFO cache that it pops/pushes without any synchronization,
+// when a cache overflows (or runs dry) it hands a batch of ENTITY_CHUNK_POOL_BATCH chunks to (or takes one from)
+// a lock-free global stack, which is how chunks move between lanes that free more than they allocate and vice versa
+typedef struct EntityChunkLaneCache {
+  EntityChunk* items[ENTITY_CHUNK_POOL_LANE_CAPACITY];
+  u64 count;
+  Arena arena; // brand new chunks come out of here (and whatever else a store grows while the lane changes it), so lanes never share an arena
+  u64 allocated; // # of chunks this lane has ever allocated from its arena
+} EntityChunkLaneCache;
+
+typedef struct EntityChunkPool {
+  // treiber stack of batches (linked through next_batch), each batch is ENTITY_CHUNK_POOL_BATCH chunks linked through next.
+  // the low 48 bits are the top batch's pointer, the high 16 bits are a tag bumped on every change so a
+  // pop can't be fooled by the same batch having been popped and pushed again in between (ABA)
+  u64 global_head;
+  u8 global_pad[CACHE_LINE_SIZE - sizeof(u64)];
+  EntityChunkLaneCache* lanes; // one per lane, each on its own cache lines
+  u64 lane_count;
+} EntityChunkPool;
+
+// structure-of-arrays entity storage: entity i is column[i] across every column, and the columns are
+// kept dense (removal swaps the last entity into the hole) so a pass that only needs, say, positions
+// streams through x[] and y[] without dragging ids/colors/etc through the cache. the columns live in
+// chunks from an EntityChunkPool, which the store takes from and gives back to as it grows and shrinks.
+// dense indices move around, handles don't: slots[] is the sparse side of a sparse set mapping handle -> index.
+// a store is only ever changed by one lane at a time, whichever last called entityStoreSetLane()
+typedef struct EntityStore {
+  u64 length;
+  u64 max_capacity;
+  u32 slot_base; // the store's index << ENTITY_STORE_SLOT_BITS, a handle's slot is slot_base + its slot in slots[]
+  EntityChunkPool* pool;
+  EntityChunkLaneCache* lane; // of the lane changing the store, chunks come from and go back to its cache
+  Arena* arena; // &lane->arena, for the directory, slots and grid
+  ChunkedEntityList columns;
+  EntitySlot* slots; // slot_capacity of them, the first slot_count have been handed out at some point
+  u64 slot_capacity; // doubles when full, up to max_capacity
+  u64 slot_count;
+  u32 free_slot; // first free slot + 1, 0 if none (free slots link through EntitySlot.dense)
+  SpatialGrid grid; // keyed by slot (stable for an entity's lifetime, unlike its index)
+  // what changed since the last entityStoreTakeChanges(), so taking them doesn't have to look at every entity
+  EntityIdList dirty; // entities whose `changed` went from 0 to something, may have been removed since
+  EntityIdList removed;
+} EntityStore;
+
+#define FeatureMask(feature) (1ULL << (feature))
+
+// matches every entity that has all of `required` and none of `excluded` (both FeatureMask()s)
+typedef struct EntityQuery {
+  u64 required;
+  u64 excluded;
+} EntityQuery;
+
+#define ENTITY_STORE_NOT_FOUND MAX_u64
+
+fn void chunkPoolInit(EntityChunkPool* pool, Arena* a, u64 lane_count);
+// O(1) and lock-free, `cache` must be the calling lane's own
+fn EntityChunk* chunkPoolAlloc(EntityChunkPool* pool, EntityChunkLaneCache* cache);
+fn void chunkPoolRelease(EntityChunkPool* pool, EntityChunkLaneCache* cache, EntityChunk* chunk);
+
+fn void entityStoreInit(EntityStore* store, EntityChunkPool* pool, u32 store_idx, u64 max_capacity);
+fn void entityStoreSetLane(EntityStore* store, EntityChunkLaneCache* lane); // the calling lane's cache, before changing the store
+fn EntityChunk* entityStoreChunk(EntityStore* store, u64 index); // the chunk holding entity `index`
+fn u64  entityStoreAdd(EntityStore* store, EntityType type, u64 features, u8 x, u8 y, u8 color); // returns the new handle, 0 if full
+fn bool entityStoreRemove(EntityStore* store, u64 handle);
+fn u64  entityStoreIndex(EntityStore* store, u64 handle); // ENTITY_STORE_NOT_FOUND if the handle is stale or bogus
+fn void entityStoreMove(EntityStore* store, u64 index, u8 x, u8 y);
+fn void entityStoreMarkChanged(EntityStore* store, u64 index, u8 fields); // fields are EntityField bits
+// moves everything changed/removed since the last call into `out` (reusing its memory, growing it from `a`)
+// and resets the store's change tracking. O(entities changed), not O(entities)
+fn void entityStoreTakeChanges(EntityStore* store, Arena* a, EntityChanges* out);
+fn void entityIdListPush(EntityIdList* list, Arena* a, u64 id);
+fn void entityChangesPush(EntityChanges* changes, Arena* a, u64 id, u8 fields);
+// neighborhood queries, O(entities in the overlapping cells). they write the (dense) indices of matching
+// entities into `out` and return how many there were, which may be more than `max` (only `max` are written)
+fn u64  entityStoreQueryRect(EntityStore* store, u8 min_x, u8 min_y, u8 max_x, u8 max_y, u64* out, u64 max);
+fn u64  entityStoreQueryRadius(EntityStore* store, u8 x, u8 y, u8 radius, u64* out, u64 max);
+fn bool entityQueryMatches(EntityQuery query, u64 features);
+// finds the next run of consecutive matching indices inside `within`, starting at *cursor. a run never
+// spans two chunks, so one entityStoreChunk(store, run.min) covers all of it.
+// usage: for (u64 cursor = within.min; entityQueryNextRange(store, query, within, &cursor, &run);) { ...run.min..run.max... }
+fn bool entityQueryNextRange(EntityStore* store, EntityQuery query, Range1u64 within, u64* cursor, Range1u64* run);
+
+#endif //ENTITY_STORE_H
@@ -0,0 +1,221 @@
+#include "interest.h"
+
+fn void interestTrackerInit(InterestTracker* t) {
+  MemoryZeroStruct(t, InterestTracker);
+  arenaInit(&t->sets[0]);
+  arenaInit(&t->sets[1]);
+}
+
+fn void interestBeginSweep(InterestTracker* t, SnapshotLog* log, u64 max_viewers) {
+  Arena* a = &t->sets[log->seq & 1];
+  arenaClear(a);
+  t->current = a;
+  t->viewers = arenaAllocArray(a, InterestViewer, max_viewers);
+  t->viewer_count = 0;
+  t->cells_by_store = arenaAllocArray(a, InterestCells*, log->world.store_count);
+  MemoryZero(t->cells_by_store, sizeof(InterestCells*) * log->world.store_count);
+  u64 max_store = 0;
+  for (u32 i = 0; i < log->world.store_count; i++) {
+    max_store = Max(max_store, log->world.stores[i].capacity);
+  }
+  t->near = arenaAllocArray(a, u32, max_store);
+}
+
+fn void interestAddViewer(InterestTracker* t, SnapshotWorld* world, InterestSet* set, u64 character) {
+  u32 slot = 0;
+  SnapshotStore* mirror = snapshotWorldFind(world, character, &slot);
+  if (mirror == NULL) {
+    MemoryZeroStruct(set, InterestSet);
+    return;
+  }
+  u32 store = EntityHandleStore(character);
+  snapshotWorldAddGrid(world, store);
+  u8 x = mirror->x[slot];
+  u8 y = mirror->y[slot];
+  // the viewer moving changes what's in range of it, not just whether it's in range of others
+  if (set->character != character || set->x != x || set->y != y) {
+    set->stale = true;
+  }
+  set->character = character;
+  set->x = x;
+  set->y = y;
+  if (t->cells_by_store[store] == NULL) {
+    t->cells_by_store[store] = arenaAlloc(t->current, sizeof(InterestCells));
+    MemoryZeroStruct(t->cells_by_store[store], InterestCells);
+  }
+  t->viewers[t->viewer_count++] = (InterestViewer){ .set = set, .store = store, .x = x, .y = y };
+}
+
+fn void interestMarkCell(u64* cells, u8 x, u8 y) {
+  u16 cell = spatialGridCellOf(x, y);
+  cells[cell / 64] |= 1ULL << (cell % 64);
+}
+
+// how near to and how far from `v` the cell starting at `low` gets, along one axis
+fn void interestCellSpan(i32 v, i32 low, i32* near, i32* far) {
+  i32 high = low + (1 << SPATIAL_GRID_CELL_SHIFT) - 1;
+  *near = v < low ? low - v : (v > high ? v - high : 0);
+  *far = v - low > high - v ? v - low : high - v;
+}
+
+// whether what happened in the cell could have moved something into or out of the viewer's range: something
+// that came or went could have if any of the cell is in range, something that moved inside the cell only if
+// the edge of the range runs through it
+fn bool interestCellMatters(InterestViewer* viewer, u32 cx, u32 cy, bool entered, bool moved) {
+  i32 near_x, far_x, near_y, far_y;
+  interestCellSpan(viewer->x, (i32)(cx << SPATIAL_GRID_CELL_SHIFT), &near_x, &far_x);
+  interestCellSpan(viewer->y, (i32)(cy << SPATIAL_GRID_CELL_SHIFT), &near_y, &far_y);
+  i32 radius_sq = INTEREST_RADIUS*INTEREST_RADIUS;
+  if (near_x*near_x + near_y*near_y > radius_sq) {
+    return false; // all of it is out of range
+  }
+  return entered || (moved && far_x*far_x + far_y*far_y > radius_sq);
+}
+
+fn void interestTrackChanges(InterestTracker* t, SnapshotWorld* world) {
+  // mark where things happened, in their own room. a room can be as busy as it likes, it's still one bit a cell
+  for (u64 i = 0; i < world->move_count; i++) {
+    SnapshotMove* move = &world->moves[i];
+    InterestCells* cells = t->cells_by_store[EntityHandleStore(move->id)];
+    if (cells == NULL) {
+      continue; // nobody's looking
+    }
+    if (move->was_there && move->is_there && spatialGridCellOf(move->old_x, move->old_y) == spatialGridCellOf(move->new_x, move->new_y)) {
+      interestMarkCell(cells->moved, move->new_x, move->new_y);
+      continue;
+    }
+    if (move->was_there) {
+      interestMarkCell(cells->entered, move->old_x, move->old_y);
+    }
+    if (move->is_there) {
+      interestMarkCell(cells->entered, move->new_x, move->new_y);
+    }
+  }
+  // then every viewer looks at the marked cells its range reaches into
+  for (u32 i = 0; i < t->viewer_count; i++) {
+    InterestViewer* viewer = &t->viewers[i];
+    InterestCells* cells = t->cells_by_store[viewer->store];
+    u8 x = viewer->x;
+    u8 y = viewer->y;
+    u8 r = INTEREST_RADIUS;
+    SpatialCellRange range = spatialGridCellsInRect(x > r ? x - r : 0, y > r ? y - r : 0, x < 255 - r ? x + r : 255, y < 255 - r ? y + r : 255);
+    for (u32 cy = range.min_y; cy <= range.max_y && !viewer->set->stale; cy++) {
+      for (u32 cx = range.min_x; cx <= range.max_x && !viewer->set->stale; cx++) {
+        u32 cell = cy * SPATIAL_GRID_DIM + cx;
+        bool entered = CheckFlag(cells->entered[cell / 64], cell % 64);
+        bool moved = CheckFlag(cells->moved[cell / 64], cell % 64);
+        if ((entered || moved) && interestCellMatters(viewer, cx, cy, entered, moved)) {
+          viewer->set->stale = true;
+        }
+      }
+    }
+  }
+}
+
+// the entry for `slot` in a visible list, or NULL
+fn InterestEntry* interestFindSlot(InterestEntry* visible, u64 count, u32 slot) {
+  u64 low = 0;
+  u64 high = count;
+  while (low < high) {
+    u64 mid = (low + high) / 2;
+    u32 mid_slot = EntityHandleSlot(visible[mid].id);
+    if (mid_slot == slot) {
+      return &visible[mid];
+    }
+    if (mid_slot < slot) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return NULL;
+}
+
+fn void interestUpdate(InterestTracker* t, InterestSet* set, SnapshotLog* log, u64 acked) {
+  Arena* a = &t->sets[log->seq & 1];
+  InterestEntry* old_visible = set->visible;
+  u64 old_visible_count = set->visible_count;
+  InterestEntry* old_left = set->left;
+  u64 old_left_count = set->left_count;
+  u64 new_left_count = 0;
+  InterestEntry* new_left = NULL;
+
+  if (set->stale) {
+    u32 store = EntityHandleStore(set->character);
+    SnapshotStore* mirror = &log->world.stores[store];
+    u32 slot_base = store << ENTITY_STORE_SLOT_BITS;
+    u64 count = snapshotWorldQueryRadius(&log->world, store, set->x, set->y, INTEREST_RADIUS, t->near, mirror->capacity);
+    u32* slots = arenaAllocArray(a, u32, count);
+    MemoryCopy(slots, t->near, sizeof(u32) * count);
+    if (count > 1) {
+      u32Quicksort(slots, 0, (u32)count - 1);
+    }
+    // walk the old and new sets side by side (both in slot order) to find what came and went
+    set->visible = arenaAllocArray(a, InterestEntry, count);
+    set->visible_count = count;
+    new_left = arenaAllocArray(a, InterestEntry, old_visible_count);
+    u64 old_i = 0;
+    for (u64 i = 0; i < count; i++) {
+      u64 id = mirror->id[slots[i] - slot_base];
+      while (old_i < old_visible_count && EntityHandleSlot(old_visible[old_i].id) < slots[i]) {
+        new_left[new_left_count++] = (InterestEntry){ .id = old_visible[old_i++].id, .seq = log->seq };
+      }
+      InterestEntry entry = { .id = id, .seq = log->seq };
+      if (old_i < old_visible_count && EntityHandleSlot(old_visible[old_i].id) == slots[i]) {
+        if (old_visible[old_i].id == id) {
+          entry.seq = old_visible[old_i].seq; // still there
+        } else {
+          new_left[new_left_count++] = (InterestEntry){ .id = old_visible[old_i].id, .seq = log->seq };
+        }
+        old_i += 1;
+      }
+      set->visible[i] = entry;
+    }
+    while (old_i < old_visible_count) {
+      new_left[new_left_count++] = (InterestEntry){ .id = old_visible[old_i++].id, .seq = log->seq };
+    }
+    set->stale = false;
+  } else {
+    set->visible = arenaAllocArray(a, InterestEntry, old_visible_count);
+    MemoryCopy(set->visible, old_visible, sizeof(InterestEntry) * old_visible_count);
+  }
+
+  // the leaves the client may not know about yet. one that came back into view is dropped: it's going to be
+  // sent whole, and a client applies removals after entities
+  set->left = arenaAllocArray(a, InterestEntry, old_left_count + new_left_count);
+  set->left_count = 0;
+  for (u64 i = 0; i < old_left_count; i++) {
+    InterestEntry* back = interestFindSlot(set->visible, set->visible_count, EntityHandleSlot(old_left[i].id));
+    if (old_left[i].seq > acked && (back == NULL || back->id != old_left[i].id)) {
+      set->left[set->left_count++] = old_left[i];
+    }
+  }
+  for (u64 i = 0; i < new_left_count; i++) {
+    set->left[set->left_count++] = new_left[i];
+  }
+}
+
+fn SnapshotParts interestEncode(InterestSet* set, SnapshotLog* log, u64 baseline, Arena* a) {
+  SnapshotWriter w;
+  snapshotWriterBegin(&w, log, baseline, a);
+  bool fits = true;
+  for (u64 i = 0; i < set->visible_count && fits; i++) {
+    InterestEntry* entry = &set->visible[i];
+    // the client's had it since before its baseline, so only what changed
+    u8 fields = ENTITY_FIELDS_ALL;
+    if (baseline != 0 && entry->seq <= baseline) {
+      fields = snapshotWorldChangedSince(&log->world, entry->id, baseline);
+    }
+    if (fields != 0) {
+      fits = snapshotWriteEntity(&w, &log->world, entry->id, fields);
+    }
+  }
+  if (baseline != 0) {
+    for (u64 i = 0; i < set->left_count && fits; i++) {
+      if (set->left[i].seq > baseline) {
+        fits = snapshotWriteRemoved(&w, set->left[i].id);
+      }
+    }
+  }
+  return snapshotWriterFinish(&w);
+}
@@ -0,0 +1,73 @@
+#ifndef INTEREST_H
+#define INTEREST_H
+
+#include "base/all.h"
+#include "snapshot.h"
+#include "spatial_grid.h"
+
+// area of interest: a client only hears about the entities in its character's room within INTEREST_RADIUS of it
+// (itself included). each client has an InterestSet, what it could see as of the last snapshot. when something
+// comes into view it's sent whole, when something goes out of view (or out of the world) the client is told to
+// drop it, and in between it's only sent when it changes. so what a client costs depends on what's around it,
+// not on how big the world is.
+// the sets are kept up to date incrementally. every sweep, the moves the snapshot log just captured mark the grid
+// cells of their room that something happened in, and only the viewers whose range a marked cell could have
+// changed get their set recomputed (one radius query in their room). everyone else's carries over as it is
+#define INTEREST_RADIUS 32
+
+typedef struct InterestEntry {
+  u64 id; // entity handle
+  u64 seq; // the snapshot it came into view in (visible) or went out of view in (left)
+} InterestEntry;
+
+// lives in its InterestTracker's arenas, and has to go through interestUpdate() every sweep to stay valid
+typedef struct InterestSet {
+  u64 character; // who's looking, the set is recomputed whenever it changes
+  u8 x; // where it was looking from
+  u8 y;
+  bool stale; // something may have come into or gone out of view since the last sweep
+  InterestEntry* visible; // in increasing slot order
+  u64 visible_count;
+  InterestEntry* left; // not visible anymore, kept until the client acks a snapshot that told it so
+  u64 left_count;
+} InterestSet;
+
+typedef struct InterestViewer {
+  InterestSet* set;
+  u32 store; // its room
+  u8 x;
+  u8 y;
+} InterestViewer;
+
+// the cells of one room that something happened in this sweep, a bit per cell
+typedef struct InterestCells {
+  u64 entered[SPATIAL_GRID_CELL_COUNT / 64]; // something showed up, went away, or came in from another cell
+  u64 moved[SPATIAL_GRID_CELL_COUNT / 64]; // something moved without leaving the cell
+} InterestCells;
+
+// everything the sets of one snapshot log are updated from
+typedef struct InterestTracker {
+  Arena sets[2]; // sets are rebuilt into sets[seq & 1] every sweep, from last sweep's in the other one
+  Arena* current; // sets[seq & 1], this sweep's
+  InterestViewer* viewers; // this sweep's, in the order they were added
+  u32 viewer_count;
+  InterestCells** cells_by_store; // this sweep's, NULL for a room nobody's looking at
+  u32* near; // radius query results
+} InterestTracker;
+
+// a sweep goes:
+//  interestBeginSweep(), after snapshotLogEnd()
+//  interestAddViewer() for every client with a character (a client without one gets its set zeroed)
+//  interestTrackChanges()
+//  interestUpdate() and interestEncode() for every client that was added
+fn void interestTrackerInit(InterestTracker* t);
+fn void interestBeginSweep(InterestTracker* t, SnapshotLog* log, u64 max_viewers);
+fn void interestAddViewer(InterestTracker* t, SnapshotWorld* world, InterestSet* set, u64 character);
+// marks the sets of the viewers the moves in snapshot log->seq could matter to as stale
+fn void interestTrackChanges(InterestTracker* t, SnapshotWorld* world);
+// brings the set up to date for snapshot log->seq. `acked` is the last snapshot the client acked
+fn void interestUpdate(InterestTracker* t, InterestSet* set, SnapshotLog* log, u64 acked);
+// snapshot log->seq as this client should see it: a delta against `baseline` if it's not 0
+fn SnapshotParts interestEncode(InterestSet* set, SnapshotLog* log, u64 baseline, Arena* a);
+
+#endif //INTEREST_H
@@ -0,0 +1,338 @@
+#include "../base/all.h"
+#include "thread.c"
+
+// An append-only write-ahead journal with periodic compaction into a snapshot.
+//
+// on disk (all inside `dir`):
+//  journal-<generation>.log  framed records: [u32 length][u32 checksum][length bytes]
+//  snapshot.bin              [JournalSnapshotHeader][payload], payload is whatever the compact callback builds
+//
+// a snapshot with generation G contains everything from the journals before G, so restoring is
+// "map the snapshot, then replay journal-G, journal-G+1, ... until one is missing".
+//
+// journalAppend() just drops the record into a queue. a writer thread group-commits whatever is queued
+// (one write() + one fsync() per batch), and every `compact_every` records it rotates to a new generation
+// and wakes a compactor thread that folds the finished journals into a fresh snapshot off to the side.
+#ifndef JOURNAL_RECORD_MAX_LEN
+#define JOURNAL_RECORD_MAX_LEN 1024
+#endif
+#ifndef JOURNAL_QUEUE_LEN
+#define JOURNAL_QUEUE_LEN 4096 // must be a power of 2
+#endif
+#define JOURNAL_WRITE_BATCH_LEN 256
+#define JOURNAL_RECORD_HEADER_SIZE 8
+#define JOURNAL_SNAPSHOT_MAGIC 0x31504e534c4e524aull // "JRNLSNP1"
+#define JOURNAL_PATH_LEN 256
+#define JOURNAL_FLUSH_INTERVAL_US 1000000
+
+typedef struct JournalRecord {
+  u16 length;
+  u8 bytes[JOURNAL_RECORD_MAX_LEN];
+} JournalRecord;
+
+DefineThreadQueue(JournalRecordQueue, journalRecordQueue, JournalRecord)
+
+typedef struct JournalSnapshotHeader {
+  u64 magic;
+  u64 generation; // first journal generation NOT included in this snapshot
+  u64 payload_length;
+} JournalSnapshotHeader;
+
+// builds the next snapshot payload out of the previous one (empty on the very first compaction)
+// plus the raw contents of one journal file. it's called once per journal generation being folded in.
+// returning {0} (no bytes) means it couldn't, then the snapshot stays as it was and the journals are kept
+typedef String (*JournalCompactFn)(Arena* a, String previous_payload, String journal);
+
+typedef struct JournalStats {
+  u64 records_written;
+  u64 batches_written; // == # of fsyncs
+  u64 compactions;
+  u64 last_compaction_us;
+} JournalStats;
+
+typedef struct Journal {
+  char dir[JOURNAL_PATH_LEN];
+  JournalRecordQueue* queue;
+  JournalCompactFn compact;
+  u64 compact_every; // # of records per generation before we rotate + compact
+
+  // writer thread only
+  i32 handle;
+  u64 generation; // the generation currently being appended to
+  u64 records_in_generation;
+  JournalRecord* write_batch;
+  u8* write_buffer;
+
+  // handoff to the compactor: the newest finished generation that needs folding in, 0 when idle
+  u64 compact_through_generation;
+  ThreadSignal compact_signal;
+
+  JournalStats stats;
+} Journal;
+
+fn void journalPath(Journal* j, char* out, u64 generation) {
+  snprintf(out, JOURNAL_PATH_LEN, "%s/journal-%08lld.log", j->dir, generation);
+}
+
+fn void journalSnapshotPath(Journal* j, char* out) {
+  snprintf(out, JOURNAL_PATH_LEN, "%s/snapshot.bin", j->dir);
+}
+
+fn u32 journalChecksum(u8* bytes, u64 len) {
+  String s = { (u32)len, (u32)len, (ptr)bytes };
+  return (u32)stringHash(s);
+}
+
+// walks the framed records of a journal file. returns false at the end, or at the first torn/corrupt
+// record, in which case `*offset` is left where the valid prefix of the file ends
+fn bool journalNextRecord(String file, u64* offset, String* record) {
+  u8* bytes = (u8*)file.bytes;
+  if (*offset + JOURNAL_RECORD_HEADER_SIZE > file.length) {
+    return false;
+  }
+  u32 length = readU32FromBufferLE(bytes + *offset);
+  u32 checksum = readU32FromBufferLE(bytes + *offset + 4);
+  if (length == 0 || length > JOURNAL_RECORD_MAX_LEN || *offset + JOURNAL_RECORD_HEADER_SIZE + length > file.length) {
+    return false;
+  }
+  u8* payload = bytes + *offset + JOURNAL_RECORD_HEADER_SIZE;
+  if (journalChecksum(payload, length) != checksum) {
+    return false;
+  }
+  record->bytes = (ptr)payload;
+  record->length = length;
+  record->capacity = length;
+  *offset += JOURNAL_RECORD_HEADER_SIZE + length;
+  return true;
+}
+
+fn void journalInit(Journal* j, Arena* a, str dir, u64 compact_every, JournalCompactFn compact) {
+  MemoryZeroStruct(j, Journal);
+  snprintf(j->dir, JOURNAL_PATH_LEN, "%s", dir);
+  osDirectoryCreate(j->dir);
+  j->queue = journalRecordQueueAlloc(a, JOURNAL_QUEUE_LEN);
+  j->compact = compact;
+  j->compact_every = compact_every;
+  j->handle = -1;
+  j->generation = 1;
+  j->write_batch = arenaAllocArray(a, JournalRecord, JOURNAL_WRITE_BATCH_LEN);
+  j->write_buffer = arenaAlloc(a, JOURNAL_WRITE_BATCH_LEN * (JOURNAL_RECORD_HEADER_SIZE + JOURNAL_RECORD_MAX_LEN));
+  threadSignalInit(&j->compact_signal);
+}
+
+// maps the latest snapshot and returns its payload (empty if there isn't one yet). the mapping is never
+// released, so callers can keep pointers into the payload forever instead of copying out of it
+fn String journalLoadSnapshot(Journal* j) {
+  String result = {0};
+  char path[JOURNAL_PATH_LEN];
+  journalSnapshotPath(j, path);
+  u64 size = 0;
+  u8* memory = osFileMap(path, &size);
+  if (memory == NULL) {
+    return result;
+  }
+  JournalSnapshotHeader* header = (JournalSnapshotHeader*)memory;
+  // a String can't hold more than MAX_u32, and a snapshot that big was never written (see journalCompact())
+  if (size < sizeof(JournalSnapshotHeader) || header->magic != JOURNAL_SNAPSHOT_MAGIC || header->payload_length > MAX_u32 || sizeof(JournalSnapshotHeader) + header->payload_length > size) {
+    printf("journal: ignoring corrupt snapshot %s\n", path);
+    osFileUnmap(memory, size);
+    return result;
+  }
+  j->generation = header->generation;
+  result.bytes = (ptr)(memory + sizeof(JournalSnapshotHeader));
+  result.length = header->payload_length;
+  result.capacity = header->payload_length;
+  return result;
+}
+
+// replays every journal newer than the snapshot, oldest first. like the snapshot, the journal files stay
+// mapped so `apply` can point into the records. a torn record at the tail (crash mid-write) is cut off
+fn u64 journalReplay(Journal* j, void (*apply)(String record)) {
+  u64 replayed = 0;
+  char path[JOURNAL_PATH_LEN];
+  for (u64 generation = j->generation; ; generation++) {
+    journalPath(j, path, generation);
+    u64 size = 0;
+    u8* memory = osFileMap(path, &size);
+    if (memory == NULL) {
+      break;
+    }
+    j->generation = generation;
+    String file = { (u32)size, (u32)size, (ptr)memory };
+    u64 offset = 0;
+    String record = {0};
+    while (journalNextRecord(file, &offset, &record)) {
+      apply(record);
+      replayed += 1;
+      j->records_in_generation += 1;
+    }
+    if (offset < size) {
+      printf("journal: truncating %s from %lld to %lld bytes\n", path, size, offset);
+      osFileTruncate(path, offset);
+    }
+  }
+  return replayed;
+}
+
+// queue a record for the writer thread. only blocks if the writer is a whole queue behind
+fn void journalAppend(Journal* j, u8* bytes, u16 length) {
+  assert(length > 0 && length <= JOURNAL_RECORD_MAX_LEN);
+  JournalRecord record;
+  record.length = length;
+  MemoryCopy(record.bytes, bytes, length);
+  journalRecordQueuePush(j->queue, &record);
+}
+
+fn void journalCompact(Journal* j, Arena* a, u64 through_generation) {
+  u64 start = osTimeMicrosecondsNow();
+  char path[JOURNAL_PATH_LEN];
+  char tmp_path[JOURNAL_PATH_LEN];
+  char journal_path[JOURNAL_PATH_LEN];
+  journalSnapshotPath(j, path);
+  snprintf(tmp_path, JOURNAL_PATH_LEN, "%s.tmp", path);
+
+  // start from whatever the current snapshot holds
+  u64 first_generation = 1;
+  String payload = {0};
+  u64 snapshot_size = 0;
+  u8* snapshot = osFileMap(path, &snapshot_size);
+  if (snapshot != NULL) {
+    JournalSnapshotHeader* header = (JournalSnapshotHeader*)snapshot;
+    if (snapshot_size >= sizeof(JournalSnapshotHeader) && header->magic == JOURNAL_SNAPSHOT_MAGIC) {
+      if (header->payload_length > MAX_u32) {
+        // can't be one of ours, but starting over from nothing would throw away whatever it has
+        printf("journal: snapshot %s claims %lld bytes, keeping the journals\n", path, header->payload_length);
+        osFileUnmap(snapshot, snapshot_size);
+        return;
+      }
+      first_generation = header->generation;
+      payload.bytes = (ptr)(snapshot + sizeof(JournalSnapshotHeader));
+      payload.length = header->payload_length;
+      payload.capacity = header->payload_length;
+    }
+  }
+
+  // fold in every finished journal the snapshot doesn't have yet (usually just one)
+  for (u64 generation = first_generation; generation <= through_generation; generation++) {
+    journalPath(j, journal_path, generation);
+    u64 size = 0;
+    u8* memory = osFileMap(journal_path, &size);
+    String file = { (u32)size, (u32)size, (ptr)memory };
+    payload = j->compact(a, payload, file);
+    if (memory != NULL) {
+      osFileUnmap(memory, size);
+    }
+    if (payload.bytes == NULL) {
+      break;
+    }
+  }
+  if (payload.bytes == NULL) {
+    if (snapshot != NULL) {
+      osFileUnmap(snapshot, snapshot_size);
+    }
+    printf("journal: couldn't fold generations %lld..%lld into the snapshot, keeping the journals\n", first_generation, through_generation);
+    return;
+  }
+
+  // write it next to the old one, then swap it in atomically
+  JournalSnapshotHeader header = {
+    .magic = JOURNAL_SNAPSHOT_MAGIC,
+    .generation = through_generation + 1,
+    .payload_length = payload.length,
+  };
+  osFileDelete(tmp_path);
+  i32 handle = osFileOpenAppend(tmp_path);
+  bool ok = handle != -1
+    && osFileAppend(handle, (u8*)&header, sizeof(header))
+    && osFileAppend(handle, (u8*)payload.bytes, payload.length);
+  if (handle != -1) {
+    osFileSync(handle);
+    osFileClose(handle);
+  }
+  if (snapshot != NULL) {
+    osFileUnmap(snapshot, snapshot_size);
+  }
+  if (!ok || !osFileRename(tmp_path, path)) {
+    printf("journal: failed to write snapshot %s, keeping the journals\n", tmp_path);
+    return;
+  }
+
+  // the snapshot has them now
+  for (u64 generation = first_generation; generation <= through_generation; generation++) {
+    journalPath(j, journal_path, generation);
+    osFileDelete(journal_path);
+  }
+  j->stats.compactions += 1;
+  j->stats.last_compaction_us = osTimeMicrosecondsNow() - start;
+}
+
+fn void* journalCompactorThread(void* journal) {
+  Journal* j = (Journal*)journal;
+  Arena arena = {0};
+  arenaInit(&arena);
+  while (true) {
+    u32 epoch = threadSignalPrepareWait(&j->compact_signal);
+    u64 through_generation = AtomicLoadAcquire(&j->compact_through_generation);
+    if (through_generation == 0) {
+      threadSignalWait(&j->compact_signal, epoch, MAX_u64);
+      continue;
+    }
+    threadSignalCancelWait(&j->compact_signal);
+    journalCompact(j, &arena, through_generation);
+    arenaClear(&arena);
+    AtomicStoreRelease(&j->compact_through_generation, 0);
+  }
+  return NULL;
+}
+
+fn void journalOpenGeneration(Journal* j) {
+  char path[JOURNAL_PATH_LEN];
+  journalPath(j, path, j->generation);
+  j->handle = osFileOpenAppend(path);
+  if (j->handle == -1) {
+    printf("journal: couldn't open %s, changes will NOT be persisted\n", path);
+  }
+}
+
+fn void* journalWriterThread(void* journal) {
+  Journal* j = (Journal*)journal;
+  JournalRecord* batch = j->write_batch;
+  journalOpenGeneration(j);
+  while (true) {
+    u32 count = journalRecordQueuePopBatchWait(j->queue, batch, JOURNAL_WRITE_BATCH_LEN, JOURNAL_FLUSH_INTERVAL_US);
+    if (count > 0 && j->handle != -1) {
+      // group commit: frame the whole batch into one buffer, one write, one fsync
+      u64 len = 0;
+      for (u32 i = 0; i < count; i++) {
+        len += writeU32ToBufferLE(j->write_buffer + len, batch[i].length);
+        len += writeU32ToBufferLE(j->write_buffer + len, journalChecksum(batch[i].bytes, batch[i].length));
+        MemoryCopy(j->write_buffer + len, batch[i].bytes, batch[i].length);
+        len += batch[i].length;
+      }
+      osFileAppend(j->handle, j->write_buffer, len);
+      osFileSync(j->handle);
+      j->records_in_generation += count;
+      j->stats.records_written += count;
+      j->stats.batches_written += 1;
+    }
+
+    // rotate + hand the finished generation(s) to the compactor, unless it's still busy with the last ones
+    if (j->records_in_generation >= j->compact_every && AtomicLoadAcquire(&j->compact_through_generation) == 0) {
+      if (j->handle != -1) {
+        osFileClose(j->handle);
+      }
+      AtomicStoreRelease(&j->compact_through_generation, j->generation);
+      threadSignalNotify(&j->compact_signal);
+      j->generation += 1;
+      j->records_in_generation = 0;
+      journalOpenGeneration(j);
+    }
+  }
+  return NULL;
+}
+
+// call after journalLoadSnapshot() + journalReplay()
+fn void journalStart(Journal* j) {
+  spawnThread(&journalWriterThread, j);
+  spawnThread(&journalCompactorThread, j);
+}
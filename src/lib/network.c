@@ -1,10 +1,19 @@
 #include "../base/all.h"
+#include "thread.c"
 
 // https://stackoverflow.com/questions/1098897/what-is-the-largest-safe-udp-packet-size-on-the-internet
 #define UDP_MAX_MESSAGE_LEN 508
 #ifndef NET_OUTGOING_MESSAGE_QUEUE_LEN
 #define NET_OUTGOING_MESSAGE_QUEUE_LEN 16
 #endif
+// max # of datagrams pulled out of the kernel by a single recvmmsg() call
+#ifndef NET_RECV_BATCH_LEN
+#define NET_RECV_BATCH_LEN 32
+#endif
+// max # of (possibly coalesced) datagrams handed to a single sendmmsg() call
+#ifndef NET_SEND_BATCH_LEN
+#define NET_SEND_BATCH_LEN NET_OUTGOING_MESSAGE_QUEUE_LEN
+#endif
 
 typedef struct sockaddr_in SocketAddress;
 
@@ -27,78 +36,42 @@ typedef struct UDPMessage {
   u8 bytes[UDP_MAX_MESSAGE_LEN];
 } UDPMessage;
 
-typedef struct OutgoingMessageQueue {
-  UDPMessage items[NET_OUTGOING_MESSAGE_QUEUE_LEN];
-  u32 head;
-  u32 tail;
-  u32 count;
-  Mutex mutex;
-  Cond not_empty;
-  Cond not_full;
-} OutgoingMessageQueue;
-
-fn OutgoingMessageQueue* newOutgoingMessageQueue(Arena* a) {
-  OutgoingMessageQueue* result = arenaAlloc(a, sizeof(OutgoingMessageQueue));
-  MemoryZero(result, (sizeof *result));
-  result->mutex = newMutex();
-  result->not_full = newCond();
-  result->not_empty = newCond();
-  return result;
-}
-
-fn void outgoingMessageQueuePush(OutgoingMessageQueue* queue, UDPMessage* msg) {
-  lockMutex(&queue->mutex); {
-    while (queue->count == NET_OUTGOING_MESSAGE_QUEUE_LEN) {
-      waitForCondSignal(&queue->not_full, &queue->mutex);
-    }
-
-    MemoryCopy(&queue->items[queue->tail], msg, (sizeof *msg));
-    queue->tail = (queue->tail + 1) % NET_OUTGOING_MESSAGE_QUEUE_LEN;
-    queue->count++;
-
-    signalCond(&queue->not_empty);
-  } unlockMutex(&queue->mutex);
-}
-
-fn UDPMessage* outgoingMessageNonblockingQueuePop(OutgoingMessageQueue* q, UDPMessage* copy_target) {
-  // immediately returns NULL if there's nothing in the ThreadQueue
-  // copies the ParsedClientCommand into `copy_target` if there is something in the queue
-  // and marks it as popped from the queue
-  UDPMessage* result = NULL;
-
-  lockMutex(&q->mutex); {
-    if (q->count > 0) {
-      result = &q->items[q->head];
-      MemoryCopy(copy_target, result, (sizeof *copy_target));
-      q->head = (q->head + 1) % NET_OUTGOING_MESSAGE_QUEUE_LEN;
-      q->count--;
-
-      signalCond(&q->not_full);
-    }
-  } unlockMutex(&q->mutex);
-
-  return result;
-}
-
-fn UDPMessage* outgoingMessageQueuePop(OutgoingMessageQueue* q, UDPMessage* copy_target) {
-  UDPMessage* result = NULL;
-
-  lockMutex(&q->mutex); {
-    while (q->count == 0) {
-        waitForCondSignal(&q->not_empty, &q->mutex);
-    }
-
-    result = &q->items[q->head];
-    MemoryCopy(copy_target, result, (sizeof *copy_target));
-    q->head = (q->head + 1) % NET_OUTGOING_MESSAGE_QUEUE_LEN;
-    q->count--;
+// written by the receiving thread only, read with AtomicLoadRelaxed() from anywhere else
+typedef struct UDPRecvStats {
+  u64 syscalls; // # of times we entered the kernel to read
+  u64 datagrams; // total # of datagrams those syscalls returned
+  u64 batch_sizes[NET_RECV_BATCH_LEN+1]; // histogram: batch_sizes[n] = # of syscalls that returned n datagrams
+} UDPRecvStats;
+
+// preallocated slots that a single batched read fills in-place
+typedef struct UDPRecvBatch {
+  u32 count; // how many of `items` were filled by the last read
+  UDPMessage items[NET_RECV_BATCH_LEN];
+#if OS_LINUX
+  struct iovec iovecs[NET_RECV_BATCH_LEN];
+  struct mmsghdr headers[NET_RECV_BATCH_LEN];
+#endif
+  UDPRecvStats stats;
+} UDPRecvBatch;
 
-    signalCond(&q->not_full);
-  } unlockMutex(&q->mutex);
+typedef struct UDPSendStats {
+  u64 syscalls; // # of times we entered the kernel to send
+  u64 datagrams; // # of datagrams actually put on the wire
+  u64 messages; // # of messages packed into those datagrams
+} UDPSendStats;
 
-  return result;
-}
+// datagrams waiting to go out, small messages to the same address get packed together
+typedef struct UDPSendBatch {
+  u32 count;
+  UDPMessage items[NET_SEND_BATCH_LEN];
+#if OS_LINUX
+  struct iovec iovecs[NET_SEND_BATCH_LEN];
+  struct mmsghdr headers[NET_SEND_BATCH_LEN];
+#endif
+  UDPSendStats stats;
+} UDPSendBatch;
 
+DefineThreadQueue(OutgoingMessageQueue, outgoingMessageQueue, UDPMessage)
 
 fn bool socketAddressEqual(SocketAddress a, SocketAddress b) {
   return a.sin_addr.s_addr == b.sin_addr.s_addr
@@ -181,6 +154,134 @@ void infiniteReadUDPServer(UDPServer* server, void (*handleMessage)(u8* udp_mess
   }
 }
 
+fn UDPRecvBatch* newUDPRecvBatch(Arena* a) {
+  UDPRecvBatch* result = arenaAlloc(a, sizeof(UDPRecvBatch));
+  MemoryZero(result, (sizeof *result));
+#if OS_LINUX
+  // the iovecs + headers point straight at the slots, so they only need to be wired up once
+  for (u32 i = 0; i < NET_RECV_BATCH_LEN; i++) {
+    result->iovecs[i].iov_base = result->items[i].bytes;
+    result->iovecs[i].iov_len = UDP_MAX_MESSAGE_LEN;
+    result->headers[i].msg_hdr.msg_iov = &result->iovecs[i];
+    result->headers[i].msg_hdr.msg_iovlen = 1;
+    result->headers[i].msg_hdr.msg_name = &result->items[i].address;
+  }
+#endif
+  return result;
+}
+
+// blocks until at least one datagram is available, then grabs as many more as are already queued (up to NET_RECV_BATCH_LEN)
+fn u32 readUDPBatch(i32 socket, UDPRecvBatch* batch) {
+  u32 received = 0;
+#if OS_LINUX
+  for (u32 i = 0; i < NET_RECV_BATCH_LEN; i++) {
+    // the kernel overwrites these on every call
+    batch->headers[i].msg_hdr.msg_namelen = sizeof(SocketAddress);
+    batch->headers[i].msg_hdr.msg_flags = 0;
+  }
+  i32 result = recvmmsg(socket, batch->headers, NET_RECV_BATCH_LEN, MSG_WAITFORONE, NULL);
+  if (result > 0) {
+    received = result;
+    for (u32 i = 0; i < received; i++) {
+      batch->items[i].bytes_len = batch->headers[i].msg_len;
+    }
+  }
+#else
+  // no recvmmsg() outside of linux, so fall back to a batch of one
+  socklen_t addrlen = sizeof(SocketAddress);
+  i32 result = recvfrom(socket, (char*)batch->items[0].bytes, UDP_MAX_MESSAGE_LEN, 0, (struct sockaddr *)&batch->items[0].address, &addrlen);
+  if (result >= 0) {
+    batch->items[0].bytes_len = result;
+    received = 1;
+  }
+#endif
+  batch->count = received;
+  // the receiving thread is the only writer, but lane 0 reads the stats while it's going
+  AtomicStoreRelaxed(&batch->stats.syscalls, batch->stats.syscalls + 1);
+  AtomicStoreRelaxed(&batch->stats.datagrams, batch->stats.datagrams + received);
+  AtomicStoreRelaxed(&batch->stats.batch_sizes[received], batch->stats.batch_sizes[received] + 1);
+  return received;
+}
+
+// like infiniteReadUDPServer() but hands the handler every datagram a single read returned at once
+void infiniteBatchReadUDPServer(UDPServer* server, UDPRecvBatch* batch, void (*handleBatch)(UDPMessage* messages, u32 count, i32 socket)) {
+  while (true) {
+    u32 received = readUDPBatch(server->server_socket, batch);
+    if (received > 0) {
+      handleBatch(batch->items, received, server->server_socket);
+    }
+  }
+}
+
+fn UDPSendBatch* newUDPSendBatch(Arena* a) {
+  UDPSendBatch* result = arenaAlloc(a, sizeof(UDPSendBatch));
+  MemoryZero(result, (sizeof *result));
+#if OS_LINUX
+  for (u32 i = 0; i < NET_SEND_BATCH_LEN; i++) {
+    result->iovecs[i].iov_base = result->items[i].bytes;
+    result->headers[i].msg_hdr.msg_iov = &result->iovecs[i];
+    result->headers[i].msg_hdr.msg_iovlen = 1;
+    result->headers[i].msg_hdr.msg_name = &result->items[i].address;
+    result->headers[i].msg_hdr.msg_namelen = sizeof(SocketAddress);
+  }
+#endif
+  return result;
+}
+
+// appends `msg` to the batch, packing it onto the end of an earlier datagram to the same address if it fits.
+// returns false if the batch is full
+fn bool udpSendBatchPush(UDPSendBatch* batch, UDPMessage* msg) {
+  for (u32 i = 0; i < batch->count; i++) {
+    UDPMessage* datagram = &batch->items[i];
+    if (socketAddressEqual(datagram->address, msg->address) && datagram->bytes_len + msg->bytes_len <= UDP_MAX_MESSAGE_LEN) {
+      MemoryCopy(datagram->bytes + datagram->bytes_len, msg->bytes, msg->bytes_len);
+      datagram->bytes_len += msg->bytes_len;
+      batch->stats.messages += 1;
+      return true;
+    }
+  }
+  if (batch->count == NET_SEND_BATCH_LEN) {
+    return false;
+  }
+  UDPMessage* datagram = &batch->items[batch->count++];
+  datagram->address = msg->address;
+  datagram->bytes_len = msg->bytes_len;
+  MemoryCopy(datagram->bytes, msg->bytes, msg->bytes_len);
+  batch->stats.messages += 1;
+  return true;
+}
+
+// puts every datagram in the batch on the wire and empties it
+fn void sendUDPBatch(i32 socket, UDPSendBatch* batch) {
+  u32 sent = 0;
+#if OS_LINUX
+  for (u32 i = 0; i < batch->count; i++) {
+    batch->iovecs[i].iov_len = batch->items[i].bytes_len;
+  }
+  while (sent < batch->count) {
+    i32 result = sendmmsg(socket, batch->headers + sent, batch->count - sent, 0);
+    batch->stats.syscalls += 1;
+    if (result <= 0) {
+      // the first datagram failed to send, skip it rather than spinning on it
+      sent += 1;
+      continue;
+    }
+    sent += result;
+    batch->stats.datagrams += result;
+  }
+#else
+  for (; sent < batch->count; sent++) {
+    UDPMessage* datagram = &batch->items[sent];
+    i32 result = sendto(socket, (const char*)datagram->bytes, datagram->bytes_len, 0, (const struct sockaddr *)&datagram->address, sizeof(struct sockaddr));
+    batch->stats.syscalls += 1;
+    if (result >= 0) {
+      batch->stats.datagrams += 1;
+    }
+  }
+#endif
+  batch->count = 0;
+}
+
 // TODO: sendall() to handle cases when the sendto() bytes return value is less than the intended bytes to send... stupid kernel fuckin wit us.
 i32 sendUDPu8List(i32 using_socket, SocketAddress* to, u8List* message) {
   return sendto(
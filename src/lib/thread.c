@@ -1,109 +1,70 @@
-#include "thread.h"
-
-typedef struct ThreadQueue {
-  void* items;
-  u32 type_size;
-  u32 max;
-  u32 head;
-  u32 tail;
-  u32 count;
-  Mutex mutex;
-  Cond not_empty;
-  Cond not_full;
-} ThreadQueue;
-
-Thread spawnThread(void * (*threadFn)(void *), void* thread_arg) {
-  pthread_t thread;
-  pthread_create(&thread, NULL, threadFn, thread_arg);
-  Thread result = { thread };
-  return result;
-}
+#ifndef LIB_THREAD_C
+#define LIB_THREAD_C
 
-Mutex newMutex() {
-  Mutex result = { PTHREAD_MUTEX_INITIALIZER };
-  return result;
-}
-
-Cond newCond() {
-  Cond result = { 0 };
-  pthread_cond_init(&result.cond, NULL);
-  return result;
-}
-
-void lockMutex(Mutex* m) {
-  pthread_mutex_lock(&m->mutex);
-}
-
-void unlockMutex(Mutex* m) {
-  pthread_mutex_unlock(&m->mutex);
-}
-
-void signalCond(Cond* cond) {
-  pthread_cond_signal(&cond->cond);
-}
+#include "thread.h"
 
-void waitForCondSignal(Cond* cond, Mutex* mutex) {
-  pthread_cond_wait(&cond->cond, &mutex->mutex);
+fn void threadSignalInit(ThreadSignal* signal) {
+  signal->epoch = 0;
+#if !OS_LINUX
+  signal->mutex = newMutex();
+  signal->cond = newCond();
+#endif
 }
 
-fn ThreadQueue newThreadQueue(Arena* a, u32 type_size, u32 items_max) {
-  ThreadQueue result = {0};
-  result.type_size = type_size;
-  result.max = items_max;
-  result.items = arenaAllocArraySized(a, type_size, items_max);
-  result.mutex = newMutex();
-  result.not_full = newCond();
-  result.not_empty = newCond();
-  return result;
+// registers us as a waiter (sets THREAD_SIGNAL_WAITING), returns the epoch to hand to threadSignalWait()
+fn u32 threadSignalPrepareWait(ThreadSignal* signal) {
+  u32 epoch = AtomicLoadRelaxed(&signal->epoch);
+  // the compare-exchange is a full barrier, so it pairs with the fence in threadSignalNotify(): either they see
+  // the flag, or we see their update when we re-check
+  while (!(epoch & THREAD_SIGNAL_WAITING) && !AtomicCompareExchange(&signal->epoch, &epoch, epoch | THREAD_SIGNAL_WAITING)) {}
+  return epoch | THREAD_SIGNAL_WAITING;
 }
 
-fn void threadSafeQueuePush(ThreadQueue* queue, void* item) {
-  lockMutex(&queue->mutex); {
-    while (queue->count == queue->max) {
-      waitForCondSignal(&queue->not_full, &queue->mutex);
-    }
-
-    memcpy(queue->items + (queue->tail * (sizeof item)), item, queue->type_size);
-    queue->tail = (queue->tail + 1) % queue->max;
-    queue->count++;
-
-    signalCond(&queue->not_empty);
-  } unlockMutex(&queue->mutex);
+// the condition turned out to be true after all, so we aren't going to wait. the flag stays up, at worst the
+// next notify makes a wake call nobody needed
+fn void threadSignalCancelWait(ThreadSignal* signal) {
 }
 
-fn void* threadSafeQueuePop(ThreadQueue* q) {
-  void* result = NULL;
-
-  lockMutex(&q->mutex); {
-    while (q->count == 0) {
-        waitForCondSignal(&q->not_empty, &q->mutex);
+// sleeps unless someone notified since `epoch` was read. can wake spuriously, so callers re-check in a loop
+fn void threadSignalWait(ThreadSignal* signal, u32 epoch, u64 timeout_us) {
+#if OS_LINUX
+  osFutexWait(&signal->epoch, epoch, timeout_us);
+#else
+  lockMutex(&signal->mutex); {
+    if (AtomicLoadAcquire(&signal->epoch) == epoch) {
+      if (timeout_us == MAX_u64) {
+        waitForCondSignal(&signal->cond, &signal->mutex);
+      } else {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        u64 nsec = ts.tv_nsec + (timeout_us % 1000000) * 1000;
+        ts.tv_sec += (timeout_us / 1000000) + (nsec / 1000000000);
+        ts.tv_nsec = nsec % 1000000000;
+        pthread_cond_timedwait(&signal->cond.cond, &signal->mutex.mutex, &ts);
+      }
     }
-
-    result = &q->items[q->head];
-    q->head = (q->head + 1) % q->max;
-    q->count--;
-
-    signalCond(&q->not_full);
-  } unlockMutex(&q->mutex);
-
-  return result;
+  } unlockMutex(&signal->mutex);
+#endif
 }
 
-// immediately returns NULL if there's nothing in the ThreadQueue
-fn void* threadSafeNonblockingQueuePop(ThreadQueue* q, void* copy_target, u64 len) {
-  void* result = NULL;
-
-  lockMutex(&q->mutex); {
-    if (q->count > 0) {
-      result = &q->items[q->head];
-      MemoryCopy(copy_target, result, len);
-      q->head = (q->head + 1) % q->max;
-      q->count--;
-
-      signalCond(&q->not_full);
-    }
-  } unlockMutex(&q->mutex);
-
-  return result;
+// wakes everyone waiting. nearly free unless someone started waiting since the last wake: everyone who
+// did before it was either woken by it or saw the epoch move and didn't sleep
+fn void threadSignalNotify(ThreadSignal* signal) {
+  AtomicFence();
+  u32 epoch = AtomicLoadRelaxed(&signal->epoch);
+  if (!(epoch & THREAD_SIGNAL_WAITING)) {
+    return;
+  }
+#if OS_LINUX
+  // clears the flag and moves the epoch along in one go, a waiter flagging it after this re-checks after this too
+  while (!AtomicCompareExchange(&signal->epoch, &epoch, (epoch & ~THREAD_SIGNAL_WAITING) + 2)) {}
+  osFutexWakeAll(&signal->epoch);
+#else
+  lockMutex(&signal->mutex); {
+    while (!AtomicCompareExchange(&signal->epoch, &epoch, (epoch & ~THREAD_SIGNAL_WAITING) + 2)) {}
+    broadcastCond(&signal->cond);
+  } unlockMutex(&signal->mutex);
+#endif
 }
 
+#endif //LIB_THREAD_C
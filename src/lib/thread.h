@@ -1,29 +1,178 @@
 #ifndef LIB_THREAD_H
 #define LIB_THREAD_H
 
-#include <stdio.h>
-#include <stdlib.h>
-#include <pthread.h>
-#include "../base/include.h"
+#include "../base/all.h"
 
-typedef struct Thread {
-  pthread_t thread;
-} Thread;
+// lets a thread sleep until another thread says "something changed".
+// waiters must re-check whatever they are waiting on between threadSignalPrepareWait() and threadSignalWait()
+#define THREAD_SIGNAL_WAITING 1 // the low bit of ThreadSignal.epoch
+typedef struct ThreadSignal {
+  // bumped by 2 by every notify that had someone to wake, this is the futex word on linux. the low bit says
+  // whether anyone has started waiting since the last bump, so a notify only makes a syscall when there's
+  // someone it hasn't woken yet
+  u32 epoch;
+#if !OS_LINUX
+  Mutex mutex;
+  Cond cond;
+#endif
+} ThreadSignal;
 
-typedef struct Mutex {
-  pthread_mutex_t mutex;
-} Mutex;
+fn void threadSignalInit(ThreadSignal* signal);
+fn u32  threadSignalPrepareWait(ThreadSignal* signal);
+fn void threadSignalCancelWait(ThreadSignal* signal);
+fn void threadSignalWait(ThreadSignal* signal, u32 epoch, u64 timeout_us);
+fn void threadSignalNotify(ThreadSignal* signal);
 
-typedef struct Cond {
-  pthread_cond_t cond;
-} Cond;
-
-Thread spawnThread(void * (*threadFn)(void *), void* thread_arg);
-Mutex newMutex();
-Cond newCond();
-void lockMutex(Mutex* m);
-void unlockMutex(Mutex* m);
-void signalCond(Cond* cond);
-void waitForCondSignal(Cond* cond, Mutex* mutex);
+// DefineThreadQueue(QueueType, queuePrefix, ItemType) generates a bounded multi-producer/multi-consumer queue
+// of ItemType. it's Dmitry Vyukov's bounded mpmc queue: every slot carries a sequence number that says whose
+// turn it is to use the slot, so producers and consumers only contend on their own end's index.
+//
+// generated api (capacity must be a power of 2):
+//  QueueType* queuePrefixAlloc(Arena* a, u64 capacity)
+//  bool queuePrefixTryPush(QueueType* q, ItemType* item)                 false if full
+//  void queuePrefixPush(QueueType* q, ItemType* item)                    blocks while full
+//  u32  queuePrefixPushBatch(QueueType* q, ItemType* items, u32 count)  pushes as many as fit, returns how many
+//  bool queuePrefixTryPop(QueueType* q, ItemType* copy_target)           false if empty
+//  void queuePrefixPop(QueueType* q, ItemType* copy_target)              blocks while empty
+//  u32  queuePrefixPopBatch(QueueType* q, ItemType* copy_targets, u32 max)  nonblocking, returns how many
+//  u32  queuePrefixPopBatchWait(QueueType* q, ItemType* copy_targets, u32 max, u64 timeout_us)
+//       like PopBatch but sleeps until there's at least one item or timeout_us passes (MAX_u64 = forever)
+#define DefineThreadQueue(QueueType, queuePrefix, ItemType) \
+typedef struct QueueType##Slot { \
+  u64 sequence; \
+  ItemType item; \
+} QueueType##Slot; \
+\
+typedef struct QueueType { \
+  u64 enqueue_pos; \
+  u8 enqueue_pad[CACHE_LINE_SIZE - sizeof(u64)]; \
+  u64 dequeue_pos; \
+  u8 dequeue_pad[CACHE_LINE_SIZE - sizeof(u64)]; \
+  u64 mask; \
+  QueueType##Slot* slots; \
+  ThreadSignal not_empty; \
+  ThreadSignal not_full; \
+} QueueType; \
+\
+fn QueueType* queuePrefix##Alloc(Arena* a, u64 capacity) { \
+  assert(capacity >= 2 && isPowerOfTwo(capacity)); \
+  QueueType* result = arenaAllocAligned(a, sizeof(QueueType), CACHE_LINE_SIZE); \
+  MemoryZero(result, (sizeof *result)); \
+  result->mask = capacity - 1; \
+  result->slots = arenaAllocAligned(a, sizeof(QueueType##Slot) * capacity, CACHE_LINE_SIZE); \
+  for (u64 i = 0; i < capacity; i++) { \
+    result->slots[i].sequence = i; \
+  } \
+  threadSignalInit(&result->not_empty); \
+  threadSignalInit(&result->not_full); \
+  return result; \
+} \
+\
+fn u32 queuePrefix##PushBatch(QueueType* q, ItemType* items, u32 count) { \
+  u64 pos = AtomicLoadRelaxed(&q->enqueue_pos); \
+  u32 claimed = 0; \
+  while (count > 0) { \
+    /* how many slots in a row, starting at pos, are free on this lap? */ \
+    claimed = 0; \
+    bool stale = false; \
+    for (; claimed < count; claimed++) { \
+      u64 seq = AtomicLoadAcquire(&q->slots[(pos + claimed) & q->mask].sequence); \
+      i64 diff = (i64)seq - (i64)(pos + claimed); \
+      if (diff < 0) break; /* still holds an item from the last lap (full) */ \
+      if (diff > 0) { stale = true; break; } /* another producer already took it */ \
+    } \
+    if (stale && claimed == 0) { \
+      pos = AtomicLoadRelaxed(&q->enqueue_pos); \
+      continue; \
+    } \
+    if (claimed == 0) { \
+      return 0; \
+    } \
+    if (AtomicCompareExchange(&q->enqueue_pos, &pos, pos + claimed)) { \
+      break; \
+    } \
+  } \
+  for (u32 i = 0; i < claimed; i++) { \
+    QueueType##Slot* slot = &q->slots[(pos + i) & q->mask]; \
+    slot->item = items[i]; \
+    AtomicStoreRelease(&slot->sequence, pos + i + 1); \
+  } \
+  if (claimed > 0) { \
+    threadSignalNotify(&q->not_empty); \
+  } \
+  return claimed; \
+} \
+\
+fn u32 queuePrefix##PopBatch(QueueType* q, ItemType* copy_targets, u32 max) { \
+  u64 pos = AtomicLoadRelaxed(&q->dequeue_pos); \
+  u32 claimed = 0; \
+  while (max > 0) { \
+    claimed = 0; \
+    bool stale = false; \
+    for (; claimed < max; claimed++) { \
+      u64 seq = AtomicLoadAcquire(&q->slots[(pos + claimed) & q->mask].sequence); \
+      i64 diff = (i64)seq - (i64)(pos + claimed + 1); \
+      if (diff < 0) break; /* not written yet (empty) */ \
+      if (diff > 0) { stale = true; break; } /* another consumer already took it */ \
+    } \
+    if (stale && claimed == 0) { \
+      pos = AtomicLoadRelaxed(&q->dequeue_pos); \
+      continue; \
+    } \
+    if (claimed == 0) { \
+      return 0; \
+    } \
+    if (AtomicCompareExchange(&q->dequeue_pos, &pos, pos + claimed)) { \
+      break; \
+    } \
+  } \
+  for (u32 i = 0; i < claimed; i++) { \
+    QueueType##Slot* slot = &q->slots[(pos + i) & q->mask]; \
+    copy_targets[i] = slot->item; \
+    AtomicStoreRelease(&slot->sequence, pos + i + q->mask + 1); \
+  } \
+  if (claimed > 0) { \
+    threadSignalNotify(&q->not_full); \
+  } \
+  return claimed; \
+} \
+\
+fn bool queuePrefix##TryPush(QueueType* q, ItemType* item) { \
+  return queuePrefix##PushBatch(q, item, 1) == 1; \
+} \
+\
+fn bool queuePrefix##TryPop(QueueType* q, ItemType* copy_target) { \
+  return queuePrefix##PopBatch(q, copy_target, 1) == 1; \
+} \
+\
+fn void queuePrefix##Push(QueueType* q, ItemType* item) { \
+  while (!queuePrefix##TryPush(q, item)) { \
+    u32 epoch = threadSignalPrepareWait(&q->not_full); \
+    if (queuePrefix##TryPush(q, item)) { \
+      threadSignalCancelWait(&q->not_full); \
+      return; \
+    } \
+    threadSignalWait(&q->not_full, epoch, MAX_u64); \
+  } \
+} \
+\
+fn u32 queuePrefix##PopBatchWait(QueueType* q, ItemType* copy_targets, u32 max, u64 timeout_us) { \
+  u32 result = queuePrefix##PopBatch(q, copy_targets, max); \
+  if (result == 0) { \
+    u32 epoch = threadSignalPrepareWait(&q->not_empty); \
+    result = queuePrefix##PopBatch(q, copy_targets, max); \
+    if (result > 0) { \
+      threadSignalCancelWait(&q->not_empty); \
+    } else { \
+      threadSignalWait(&q->not_empty, epoch, timeout_us); \
+      result = queuePrefix##PopBatch(q, copy_targets, max); \
+    } \
+  } \
+  return result; \
+} \
+\
+fn void queuePrefix##Pop(QueueType* q, ItemType* copy_target) { \
+  while (queuePrefix##PopBatchWait(q, copy_target, 1, MAX_u64) == 0) {} \
+}
 
 #endif //LIB_THREAD_H
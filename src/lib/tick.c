@@ -0,0 +1,82 @@
+#include "../base/all.h"
+
+// A fixed-timestep tick clock. tick N is due at `anchor_us + N * period_us` exactly, so sleeping until
+// the next deadline (rather than for "period minus however long the work took") never drifts.
+//
+// if a tick overruns, the next one starts immediately and we keep going on the same grid until we've
+// caught back up. if we fall more than TICK_MAX_CATCH_UP ticks behind (e.g. the process got suspended)
+// the missed ticks are skipped and the grid is re-anchored on now.
+#ifndef TICK_MAX_CATCH_UP
+#define TICK_MAX_CATCH_UP 4
+#endif
+
+typedef struct TickStats {
+  u64 ticks;
+  u64 overruns; // ticks whose work ran past the next tick's deadline
+  u64 skipped; // ticks dropped because we fell too far behind to catch up
+  u64 last_work_us; // how long the last tick's work took
+  u64 max_work_us;
+  u64 total_work_us;
+  u64 total_work_sq_us; // sum of work^2, for the variance
+  u64 last_late_us; // how long after its deadline the last tick actually started (wakeup jitter + catching up)
+  u64 max_late_us;
+} TickStats;
+
+typedef struct TickClock {
+  u64 period_us;
+  u64 anchor_us; // the grid's origin
+  u64 tick; // the tick currently running (or about to)
+  u64 started_us; // when the current tick's work started
+  TickStats stats;
+} TickClock;
+
+fn void tickClockInit(TickClock* clock, u64 ticks_per_s) {
+  MemoryZeroStruct(clock, TickClock);
+  clock->period_us = 1000000 / ticks_per_s;
+  clock->anchor_us = osTimeMicrosecondsNow();
+}
+
+fn u64 tickDeadline(TickClock* clock, u64 tick) {
+  return clock->anchor_us + tick * clock->period_us;
+}
+
+// call at the top of every tick. returns the deadline this tick's work should finish by (== when the next tick is due)
+fn u64 tickBegin(TickClock* clock) {
+  u64 now = osTimeMicrosecondsNow();
+  u64 due = tickDeadline(clock, clock->tick);
+  u64 late = now > due ? now - due : 0;
+  if (late >= TICK_MAX_CATCH_UP * clock->period_us) {
+    u64 missed = late / clock->period_us;
+    clock->stats.skipped += missed;
+    clock->anchor_us = now - clock->tick * clock->period_us;
+    late = 0;
+  }
+  clock->started_us = now;
+  clock->stats.last_late_us = late;
+  clock->stats.max_late_us = Max(clock->stats.max_late_us, late);
+  return tickDeadline(clock, clock->tick + 1);
+}
+
+fn u64 tickWorkStddevUs(TickStats* stats) {
+  if (stats->ticks == 0) {
+    return 0;
+  }
+  f64 mean = (f64)stats->total_work_us / stats->ticks;
+  f64 variance = (f64)stats->total_work_sq_us / stats->ticks - mean * mean;
+  return variance > 0 ? u64Sqrt((u64)variance) : 0;
+}
+
+// call once the tick's work is done, before sleeping until the deadline tickBegin() returned
+fn void tickEnd(TickClock* clock) {
+  u64 now = osTimeMicrosecondsNow();
+  u64 work = now - clock->started_us;
+  clock->stats.ticks += 1;
+  clock->stats.last_work_us = work;
+  clock->stats.total_work_us += work;
+  clock->stats.total_work_sq_us += work * work;
+  clock->stats.max_work_us = Max(clock->stats.max_work_us, work);
+  clock->tick += 1;
+  if (now > tickDeadline(clock, clock->tick)) {
+    clock->stats.overruns += 1;
+  }
+}
@@ -0,0 +1,116 @@
+#ifndef LIB_WIRE_H
+#define LIB_WIRE_H
+
+#include "../base/all.h"
+
+// Wire messages: a message is described once, as a list of fields, and DefineWireMessage() turns the list into
+// its struct, encoder, decoder and max size, so both ends are generated from the same description and can't drift.
+//
+// usage:
+//  #define PingMessageFields(F) F(Var, seq) F(U16, port) F(Bytes, note)
+//  DefineWireMessage(PingMessage, MessagePing)
+// gives
+//  typedef struct PingMessage { u8 type; u64 seq; u16 port; WireBytes note; } PingMessage;
+//  PingMessageMaxFixedSize // bytes it can take on the wire, not counting what's in its Bytes fields
+//  fn bool encodePingMessage(BitWriter* w, PingMessage* m); // [8 MessagePing][fields...], byte aligned
+//  fn bool decodePingMessage(BitReader* r, PingMessage* m); // the fields, after the caller read the type
+//
+// a message is its 8-bit type followed by its fields in order (as bits, see BitWriter), padded out to a byte
+// boundary so messages can be packed back to back in a datagram. the field kinds:
+//  U8 U16 U32 U64  fixed width
+//  Var             varint, up to a u64
+//  Var16           varint, up to a u16 (bigger is malformed)
+//  Bytes           [var16 len] padded to a byte boundary, then len bytes. decoded as a view into the reader's
+//                  buffer rather than a copy, so it's only good for as long as that buffer is
+// decoders don't check anything field by field, a short/garbled message just comes out as overflow at the end
+
+typedef struct WireBytes {
+  u8* bytes;
+  u64 len;
+} WireBytes;
+
+#define WireType_U8 u8
+#define WireType_U16 u16
+#define WireType_U32 u32
+#define WireType_U64 u64
+#define WireType_Var u64
+#define WireType_Var16 u16
+#define WireType_Bytes WireBytes
+
+#define WIRE_MAX_SIZE_U8 1
+#define WIRE_MAX_SIZE_U16 2
+#define WIRE_MAX_SIZE_U32 4
+#define WIRE_MAX_SIZE_U64 8
+#define WIRE_MAX_SIZE_Var 10
+#define WIRE_MAX_SIZE_Var16 3
+#define WIRE_MAX_SIZE_Bytes 4 // just the length and the padding
+
+#define wireWriteU8(w, value) bitWrite(w, value, 8)
+#define wireWriteU16(w, value) bitWrite(w, value, 16)
+#define wireWriteU32(w, value) bitWrite(w, value, 32)
+#define wireWriteU64(w, value) bitWrite(w, value, 64)
+#define wireWriteVar(w, value) bitWriteVarU64(w, value)
+#define wireWriteVar16(w, value) bitWriteVarU64(w, value)
+#define wireReadU8(r) ((u8)bitRead(r, 8))
+#define wireReadU16(r) ((u16)bitRead(r, 16))
+#define wireReadU32(r) ((u32)bitRead(r, 32))
+#define wireReadU64(r) bitRead(r, 64)
+#define wireReadVar(r) bitReadVarU64(r)
+
+fn u16 wireReadVar16(BitReader* r) {
+  u64 value = bitReadVarU64(r);
+  r->overflow |= value > MAX_u16;
+  return (u16)value;
+}
+
+fn void wireWriteBytes(BitWriter* w, WireBytes value) {
+  w->overflow |= value.len > MAX_u16;
+  bitWriteVarU64(w, value.len);
+  bitWriteAlign(w);
+  bitWriteBytes(w, value.bytes, value.len);
+}
+
+fn WireBytes wireReadBytes(BitReader* r) {
+  WireBytes result = {0};
+  result.len = wireReadVar16(r);
+  bitReadAlign(r);
+  result.bytes = bitReadView(r, result.len);
+  return result;
+}
+
+fn WireBytes wireBytes(u8* bytes, u64 len) {
+  WireBytes result = { .bytes = bytes, .len = len };
+  return result;
+}
+
+// a view, so no terminating 0
+fn String wireString(WireBytes bytes) {
+  String result = { .length = (u32)bytes.len, .capacity = (u32)bytes.len, .bytes = (ptr)bytes.bytes };
+  return result;
+}
+
+#define WireStructField(kind, name) WireType_##kind name;
+#define WireMaxSizeField(kind, name) + WIRE_MAX_SIZE_##kind
+#define WireEncodeField(kind, name) wireWrite##kind(w, m->name);
+#define WireDecodeField(kind, name) m->name = wireRead##kind(r);
+
+#define DefineWireMessage(Type, type_value) \
+  typedef struct Type { \
+    u8 type; \
+    Type##Fields(WireStructField) \
+  } Type; \
+  enum { Type##MaxFixedSize = 1 Type##Fields(WireMaxSizeField) }; \
+  fn bool encode##Type(BitWriter* w, Type* m) { \
+    bitWrite(w, type_value, 8); \
+    Type##Fields(WireEncodeField) \
+    bitWriteAlign(w); \
+    return !w->overflow; \
+  } \
+  fn bool decode##Type(BitReader* r, Type* m) { \
+    m->type = type_value; \
+    Type##Fields(WireDecodeField) \
+    bitReadAlign(r); \
+    return !r->overflow; \
+  }
+
+#endif //LIB_WIRE_H
@@ -0,0 +1,131 @@
+#include "../base/all.h"
+
+// Work stealing for lanes. a round of work is `count` tasks (just indices, e.g. rooms), every lane starts
+// out with its LaneRange(count) in its own deque and works through it, and a lane that runs out steals
+// from the others instead of idling at the next LaneSync(). so a lane stuck with a few expensive tasks
+// gets helped, while an even load costs (almost) nothing over a plain LaneRange() loop.
+//
+// usage, on every lane:
+//  workBegin(&work, count);
+//  LaneSync(); // nobody may steal before every lane has pushed its tasks
+//  for (u64 task; workNext(&work, &task);) { ... }
+//  LaneSync(); // workNext() returning false only means there's nothing left to *take*, others may still be running theirs
+//
+// tasks can't push more tasks, which is what makes "every deque looked empty" mean the round is over.
+
+// Chase-Lev deque: the owning lane pushes and pops at the bottom (LIFO), thieves take from the top.
+// top/bottom only ever grow, across rounds too, so a thief that read a stale top always loses its CAS.
+// fixed capacity, a lane can't have more than `capacity` tasks queued at once
+typedef struct WorkDeque {
+  i64 top;
+  u8 top_pad[CACHE_LINE_SIZE - sizeof(i64)];
+  i64 bottom;
+  u64 mask;
+  u64* tasks;
+  u64 steals; // # of tasks this lane took from other lanes, only written by its own lane
+  u8 bottom_pad[CACHE_LINE_SIZE - 3*sizeof(u64) - sizeof(i64)];
+} WorkDeque;
+
+typedef enum WorkStealResult {
+  WorkStealEmpty,
+  WorkStealLostRace, // there was something, but another lane got it first
+  WorkStealSuccess,
+} WorkStealResult;
+
+typedef struct Work {
+  WorkDeque* deques; // one per lane
+  u64 lane_count;
+} Work;
+
+fn void workInit(Work* work, Arena* a, u64 lane_count, u64 capacity) {
+  assert(capacity >= 2 && isPowerOfTwo(capacity));
+  work->lane_count = lane_count;
+  work->deques = arenaAllocAligned(a, sizeof(WorkDeque) * lane_count, CACHE_LINE_SIZE);
+  MemoryZero(work->deques, sizeof(WorkDeque) * lane_count);
+  for (u64 i = 0; i < lane_count; i++) {
+    work->deques[i].mask = capacity - 1;
+    work->deques[i].tasks = arenaAllocAligned(a, sizeof(u64) * capacity, CACHE_LINE_SIZE);
+  }
+}
+
+// OWNER ONLY
+fn void workDequePush(WorkDeque* deque, u64 task) {
+  i64 b = AtomicLoadRelaxed(&deque->bottom);
+  assert(b - AtomicLoadAcquire(&deque->top) <= (i64)deque->mask);
+  AtomicStoreRelaxed(&deque->tasks[b & deque->mask], task);
+  AtomicStoreRelease(&deque->bottom, b + 1);
+}
+
+// OWNER ONLY
+fn bool workDequePop(WorkDeque* deque, u64* task) {
+  i64 b = AtomicLoadRelaxed(&deque->bottom) - 1;
+  AtomicStoreRelaxed(&deque->bottom, b);
+  // pairs with the fence in workDequeSteal(): either the thief sees our claim on the bottom, or we see its claim on the top
+  AtomicFence();
+  i64 t = AtomicLoadRelaxed(&deque->top);
+  if (t > b) {
+    AtomicStoreRelaxed(&deque->bottom, b + 1);
+    return false;
+  }
+  *task = AtomicLoadRelaxed(&deque->tasks[b & deque->mask]);
+  if (t == b) {
+    // the last task, race the thieves for it through the top
+    bool won = AtomicCompareExchange(&deque->top, &t, t + 1);
+    AtomicStoreRelaxed(&deque->bottom, b + 1);
+    return won;
+  }
+  return true;
+}
+
+fn WorkStealResult workDequeSteal(WorkDeque* deque, u64* task) {
+  i64 t = AtomicLoadAcquire(&deque->top);
+  AtomicFence();
+  i64 b = AtomicLoadAcquire(&deque->bottom);
+  if (t >= b) {
+    return WorkStealEmpty;
+  }
+  u64 result = AtomicLoadRelaxed(&deque->tasks[t & deque->mask]);
+  if (!AtomicCompareExchange(&deque->top, &t, t + 1)) {
+    return WorkStealLostRace;
+  }
+  *task = result;
+  return WorkStealSuccess;
+}
+
+// LANES ONLY. queues up this lane's share of `count` tasks, see the usage above
+fn void workBegin(Work* work, u64 count) {
+  assert(LaneIdx() < work->lane_count);
+  WorkDeque* deque = &work->deques[LaneIdx()];
+  Range1u64 range = LaneRange(count);
+  // pushed back to front, so the owner (popping from the bottom) runs its tasks in order
+  // while thieves take them off the far end
+  for (u64 i = range.max; i > range.min; i--) {
+    workDequePush(deque, i - 1);
+  }
+}
+
+// LANES ONLY. the next task to run: our own if we have any left, otherwise one stolen from another lane.
+// false once every deque is empty
+fn bool workNext(Work* work, u64* task) {
+  u64 lane = LaneIdx();
+  WorkDeque* own = &work->deques[lane];
+  if (workDequePop(own, task)) {
+    return true;
+  }
+  bool lost_race = true;
+  while (lost_race) {
+    lost_race = false;
+    // start with our neighbor rather than lane 0, so thieves spread out over the victims
+    for (u64 i = 1; i < work->lane_count; i++) {
+      WorkStealResult result = workDequeSteal(&work->deques[(lane + i) % work->lane_count], task);
+      if (result == WorkStealSuccess) {
+        own->steals += 1;
+        return true;
+      }
+      if (result == WorkStealLostRace) {
+        lost_race = true;
+      }
+    }
+  }
+  return false;
+}
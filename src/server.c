@@ -6,6 +6,7 @@
  *  my_variable
  *  MY_CONSTANT
  * */
+#define _GNU_SOURCE // recvmmsg()/sendmmsg()
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/random.h>
@@ -13,26 +14,43 @@
 #include "base/impl.c"
 #define NET_OUTGOING_MESSAGE_QUEUE_LEN 64
 #include "lib/network.c"
+#include "lib/journal.c"
+#include "lib/tick.c"
+#include "lib/work.c"
 #include "render.c"
-#include "string_chunk.c"
+#include "spatial_grid.c"
+#include "entity_store.c"
+#include "snapshot.c"
+#include "interest.c"
 
 ///// CONSTANTS
 #define MAX_ENTITIES (2<<18)
-#define LEFT_ROOM_ENTITES_LEN (KB(1))
+#define ROOMS_X 32 // the world is a ROOMS_X x ROOMS_Y grid of rooms, each with its own u8 x/y space
+#define ROOMS_Y 32
+#define MAX_ROOMS (ROOMS_X*ROOMS_Y)
+#define LEFT_ROOM_ENTITES_LEN (KB(1)) // initial capacity of a lane's RoomOutbox, doubles when full
 #define ROOM_MAP_COLLISIONS_LEN MAX_ROOMS/8
 #define CLIENT_COMMAND_LIST_LEN 8
 #define SERVER_PORT 7777
 #define SERVER_MAX_HEAP_MEMORY MB(256)
-#define SERVER_MAX_CLIENTS 16
-#define GAME_THREAD_CONCURRENCY 4
+#define SERVER_DEFAULT_MAX_CLIENTS 4096 // override with --max-clients N
+#define CLIENT_CHUNK_SIZE 64
+#define CLIENT_INDEX_INITIAL_CAPACITY 64 // must be a power of 2, grows as needed
+#define MAX_GAME_LANES 64 // the lane count defaults to the # of cpus we may run on (minus the network's), override with --lanes N
+#define NETWORK_THREAD_CPUS 1 // cpus kept free of lanes for the send/recv threads, as long as that leaves 2+ for lanes
+#define MAX_PLACEMENT_CPUS 1024
 #define GOAL_NETWORK_SEND_LOOPS_PER_S 4
-#define GOAL_NETWORK_SEND_LOOP_US 1000000/GOAL_NETWORK_SEND_LOOPS_PER_S
-#define GOAL_GAME_LOOPS_PER_S 4
-#define GOAL_GAME_LOOP_US 1000000/GOAL_GAME_LOOPS_PER_S
-#define CLIENT_TIMEOUT_FRAMES GOAL_GAME_LOOPS_PER_S*3
-#define CHUNK_SIZE 64
+#define GOAL_NETWORK_SEND_LOOP_US 1000000/GOAL_NETWORK_SEND_LOOPS_PER_S // period of the per-client sweep, replies don't wait for it
+#define GOAL_GAME_LOOPS_PER_S 30
+#define CLIENT_TIMEOUT_FRAMES (GOAL_GAME_LOOPS_PER_S*3)
 #define ACCOUNT_CHUNK_SIZE 64
-#define PARSED_CLIENT_COMMAND_THREAD_QUEUE_LEN 64
+#define ACCOUNT_INDEX_INITIAL_CAPACITY 1024 // must be a power of 2, grows as needed
+#define PARSED_CLIENT_COMMAND_RING_LEN 1024 // must be a power of 2
+#define RECV_ARENA_COUNT 16 // must be a power of 2, # of receive batches whose strings can be waiting on lane 0 at once
+#define NET_RECV_STATS_LOG_FRAMES (GOAL_GAME_LOOPS_PER_S*10)
+#define SERVER_DATA_DIR "server_data" // override with --data-dir DIR
+#define JOURNAL_COMPACT_EVERY 50000 // # of journal records between snapshots
+#define PASSWORD_HASH_ROUNDS 64 // see passwordHash(), it runs on lane 0 for every login
 
 ///// TypeDefs
 typedef struct ParsedClientCommand {
@@ -42,37 +60,61 @@ typedef struct ParsedClientCommand {
   u16 alt_port;
   u32 sender_ip;
   u32 alt_ip;
-  StringChunkList name;
-  StringChunkList pass;
+  String name; // in the receive arena of the batch it came in with, only good until lane 0's done with the batch
+  String pass;
+  u64 recv_arena; // which receive arena name/pass are in + 1, 0 if none
   u64 id;
+  u64 seq; // CommandAckSnapshot
+  u64 received_us; // when the receive thread parsed it, for latency stats
 } ParsedClientCommand;
 
-typedef struct ParsedClientCommandThreadQueue {
-  ParsedClientCommand items[PARSED_CLIENT_COMMAND_THREAD_QUEUE_LEN];
-  u32 head;
-  u32 tail;
-  u32 count;
-  Mutex mutex;
-  Cond not_empty;
-  Cond not_full;
-} ParsedClientCommandThreadQueue;
-
-typedef struct Entity {
-  bool changed;
-  u8 x;
-  u8 y;
-  u8 color;
-  EntityType type;
-  u32 misc;
-  u64 id;
-  u64 features;
-} Entity;
+// single-producer (receive thread) / single-consumer (lane 0) ring.
+// head and tail only ever increase, the slot is `index % PARSED_CLIENT_COMMAND_RING_LEN`.
+// a command's variable-length fields are copied out of the datagram into the receive arena of the batch it
+// came in, which is handed to lane 0 along with the command. a batch can't need more than its datagrams' worth
+// of bytes, so an arena settles at that size and is reused from then on, and nothing here takes a lock.
+// arenas are handed out and recycled in order (their index % RECV_ARENA_COUNT), like the slots
+typedef struct ParsedClientCommandRing {
+  // producer's cache line
+  u64 tail; // next slot to write, published with release
+  u64 cached_head; // producer's last view of `head`, so it only touches the consumer's line when it looks full
+  u64 dropped; // # of commands dropped because the ring (or every receive arena) was full
+  u64 arena_tail; // next receive arena to hand out
+  u64 batch_arena; // the current batch's receive arena + 1, 0 until something in the batch needs one
+  u8 producer_pad[CACHE_LINE_SIZE - 5*sizeof(u64)];
+  // consumer's cache line
+  u64 head; // next slot to read, published with release
+  u64 cached_tail;
+  u64 arena_head; // receive arenas before this one are free again, published with release
+  u8 consumer_pad[CACHE_LINE_SIZE - 3*sizeof(u64)];
+  ThreadSignal not_empty; // notified by the producer after each batch, lane 0 waits on it between ticks
+  ParsedClientCommand items[PARSED_CLIENT_COMMAND_RING_LEN];
+  Arena arenas[RECV_ARENA_COUNT];
+} ParsedClientCommandRing;
+
+// time from a command being received to lane 0 handling it (and queueing any reply)
+typedef struct CommandLatencyStats {
+  u64 count;
+  u64 total_us;
+  u64 max_us;
+  u64 replies_dropped; // replies that didn't fit in the send queue, see queueReply()
+} CommandLatencyStats;
+
+// written by the send thread only, read with AtomicLoadRelaxed() from anywhere else
+typedef struct SnapshotSendStats {
+  u64 snapshots; // # of snapshots sent, one per client per sweep
+  u64 parts; // # of datagrams they took
+  u64 truncated; // # of them that didn't fit in SNAPSHOT_MAX_PARTS, see SnapshotParts
+} SnapshotSendStats;
 
 typedef struct Account {
   u64 id;
   String name;
-  String pw;
+  u64 pw_salt; // random, per account
+  u64 pw_hash; // passwordHash(pw_salt, pw). the pw itself is never kept, in memory or on disk
   u64 eid;
+  u64 name_hash; // accountNameHash(name), computed once at creation
+  u64 next_same_hash; // id+1 of the next account whose name_hash collides with ours, 0 if none
 } Account;
 
 typedef struct AccountChunk {
@@ -82,25 +124,91 @@ typedef struct AccountChunk {
   Account* items; // the actual accounts
 } AccountChunk;
 
-typedef struct EntityList {
-  u64 length; // the currently used length
-  u64 capacity;
-  Entity* items;
-} EntityList;
+// accounts are never deleted and ids are handed out sequentially, so an id maps straight to
+// chunks[id / ACCOUNT_CHUNK_SIZE]->items[id % ACCOUNT_CHUNK_SIZE]
+typedef struct AccountStore {
+  u64 length; // total # of accounts, also the next id
+  u64 chunk_capacity; // size of the `chunks` directory, doubles when it fills up
+  AccountChunk** chunks;
+  U64Map id_by_name_hash; // name_hash -> id of the first account with that hash
+  U64Map id_by_eid; // eid -> id
+  Arena* arena;
+} AccountStore;
+
+// what lane 0 appends to the journal. every record starts with a u8 JournalRecordType, all ints are LE
+typedef enum JournalRecordType {
+  JournalRecordInvalid,
+  JournalRecordAccountCreated, // [u64 id][u16 name_len][name][0][u64 pw_salt][u64 pw_hash]
+  JournalRecordAccountCharacter, // [u64 id][u64 eid]
+  JournalRecordType_Count,
+} JournalRecordType;
+
+// snapshot payload: [AccountSnapshotHeader][AccountSnapshotEntry * account_count][strings]
+// strings holds each account's name, NUL terminated, so restored accounts can point straight into the
+// mapped snapshot instead of copying
+typedef struct AccountSnapshotHeader {
+  u64 account_count;
+  u64 strings_length;
+} AccountSnapshotHeader;
+
+typedef struct AccountSnapshotEntry {
+  u64 eid;
+  u64 name_offset; // into strings
+  u64 name_length;
+  u64 pw_salt;
+  u64 pw_hash;
+} AccountSnapshotEntry;
+
+// rooms hold the world's entities (players' characters start out in the one at 0,0), and are what the
+// game loop splits between lanes: a room is simulated by whichever lane takes it off state.room_work,
+// but entities only ever move into it on the lane with the room in its LaneRange(MAX_ROOMS)
+typedef struct Room {
+  XYZ xyz;
+  EntityStore entities; // store roomIndex(), its chunks come from state.chunk_pool
+} Room;
+
+typedef struct RoomList {
+  u64 length;
+  Room* items; // items[roomIndex(x, y)]
+} RoomList;
 
-typedef struct EntityChunk {
-  u64 length; // the currently used # of entities in this chunk
-  u64 capacity; // the "chunk size" / space in this chunk
-  struct EntityChunk* next; // the next chunk
-  Entity* items; // the actual entities
-} EntityChunk;
+// an entity that walked off the edge of its room, on its way to the lane that owns `to_room`.
+// it gets a new handle there, the one it had is only needed to take it out of the room it left
+typedef struct RoomTransfer {
+  u32 to_room;
+  u8 x;
+  u8 y;
+  u8 type;
+  u8 color;
+  u32 misc;
+  u64 id;
+  u64 features;
+} RoomTransfer;
 
-typedef struct ChunkedEntityList {
-  u64 length; // the current number of entities
-  u64 chunk_size; // the # of entities per chunk
-  u64 chunks; // the # of chunks in this list so far
-  EntityChunk* first; // the first chunk of entities
-} ChunkedEntityList;
+// one per lane, only written by its own lane while simulating, then gathered by every lane in one sync
+typedef struct RoomOutbox {
+  RoomTransfer* items; // lives in the lane's scratch arena, so it's gone at the end of the tick
+  u64 count;
+  u64 capacity;
+} RoomOutbox;
+
+// which cpus the server's threads run on. lanes are pinned one per cpu (unless --no-pin, or there are more
+// lanes than cpus), and the network threads share whatever cpus are left over
+typedef struct ThreadPlacement {
+  bool pin;
+  u64 lane_count;
+  u32 lane_cpus[MAX_GAME_LANES];
+  u32 lane_nodes[MAX_GAME_LANES]; // the numa node of each lane's cpu
+  u32 network_cpus[NETWORK_THREAD_CPUS];
+  u32 network_cpu_count;
+} ThreadPlacement;
+
+// what lane 0 hands every other lane at the top of a tick
+typedef struct TickHeader {
+  u64 deadline; // when the next tick is due
+  u64 frame;
+  bool capture; // the send thread asked for a snapshot, the lanes capture their rooms at the end of the tick
+} TickHeader;
 
 typedef struct Client {
   u16 lan_port;
@@ -110,101 +218,143 @@ typedef struct Client {
   SocketAddress address;
   CommandType commands[CLIENT_COMMAND_LIST_LEN];
   u64 last_ping;
+  u64 acked_snapshot; // the last snapshot they got every part of, their baseline for the next one. 0 if none
+  u64 last_snapshot_sent;
+  bool connected; // false for free slots (and the null client)
 } Client;
 
+// a client's snapshot for this sweep. all but the parts is copied out of its Client while holding the client lock,
+// so working out what it can see and encoding it doesn't need it
+typedef struct SnapshotSend {
+  u32 handle;
+  SocketAddress address;
+  u64 character_eid;
+  u64 acked_snapshot;
+  SnapshotParts parts;
+} SnapshotSend;
+
+// clients live in fixed-size chunks that never move once allocated, so a Client* stays valid
+// for as long as that client is connected. a handle is just the client's index across all the chunks
 typedef struct ClientList {
-  u64 length;
-  u64 capacity;
-  Client* items;
+  u64 length; // # of slots handed out so far (including the null client at handle 0)
+  u64 capacity; // max # of slots, set at startup
+  Client** chunks; // directory of capacity/CLIENT_CHUNK_SIZE chunk pointers, allocated on demand
+  u32* free_handles; // stack of released handles, reused before growing `length`
+  u64 free_count;
+  Arena* arena;
+  U64Map handle_by_address; // socketAddressKey() -> index into items
+  U64Map handle_by_eid; // character_eid -> index into items
 } ClientList;
 
 typedef struct State {
   Mutex client_mutex;
-  Mutex mutex;
   ClientList clients;
-  u64 next_eid;
-  AccountChunk accounts;
+  SnapshotLog snapshots; // the lanes capture their rooms into it when the send thread asks them to (one capture
+                         // per lane), and in between it's the send thread's alone. see capture_requested
+  u32 capture_requested; // set by the send thread, cleared by lane 0 once the lanes captured their rooms
+  InterestTracker interest; // send thread only
+  SnapshotSendStats snapshot_stats;
+  RoomList rooms;
+  Work room_work; // rooms are the tasks, so a lane with crowded rooms gets help from the others
+  ThreadPlacement placement;
+  AccountStore accounts;
+  EntityChunkPool chunk_pool; // every room's chunks, one cache per lane
+  u64 spawn_wanderers; // --spawn N
+  Journal journal;
   u64 frame;
+  TickClock tick_clock; // lane 0 only, the other lanes get each tick's deadline broadcast to them
   Arena game_scratch;
-  StringArena string_arena;
-  ParsedClientCommandThreadQueue* network_recv_queue;
+  ParsedClientCommandRing* network_recv_queue;
+  CommandLatencyStats command_latency;
+  UDPRecvBatch* network_recv_batch;
+  UDPSendBatch* network_send_batch;
   OutgoingMessageQueue* network_send_queue;
 } State;
 
 ///// Global Variables
 global State state = { 0 };
 global Arena permanent_arena = { 0 };
-global const Entity NULL_ENTITY = { 0 };
 global bool debug_mode = false;
-global ChunkedEntityList free_chunks = { 0, CHUNK_SIZE, 0, NULL };
 
 ///// functionImplementations()
-fn ParsedClientCommandThreadQueue* newPCCThreadQueue(Arena* a) {
-  ParsedClientCommandThreadQueue* result = arenaAlloc(a, sizeof(ParsedClientCommandThreadQueue));
+fn ParsedClientCommandRing* newPCCRing(Arena* a) {
+  assert(isPowerOfTwo(PARSED_CLIENT_COMMAND_RING_LEN));
+  ParsedClientCommandRing* result = arenaAllocAligned(a, sizeof(ParsedClientCommandRing), CACHE_LINE_SIZE);
   MemoryZero(result, (sizeof *result));
-  result->mutex = newMutex();
-  result->not_full = newCond();
-  result->not_empty = newCond();
+  threadSignalInit(&result->not_empty);
+  assert(isPowerOfTwo(RECV_ARENA_COUNT));
+  for (u32 i = 0; i < RECV_ARENA_COUNT; i++) {
+    arenaInit(&result->arenas[i]);
+  }
   return result;
 }
 
-fn void pccThreadSafeQueuePush(ParsedClientCommandThreadQueue* queue, ParsedClientCommand* msg) {
-  lockMutex(&queue->mutex); {
-    while (queue->count == PARSED_CLIENT_COMMAND_THREAD_QUEUE_LEN) {
-      waitForCondSignal(&queue->not_full, &queue->mutex);
+// PRODUCER ONLY. returns the next free slot to parse a command into, or NULL (and counts a drop) if the ring is full.
+// the slot isn't visible to the consumer until pccRingCommit()
+fn ParsedClientCommand* pccRingReserve(ParsedClientCommandRing* ring) {
+  u64 tail = ring->tail;
+  if (tail - ring->cached_head == PARSED_CLIENT_COMMAND_RING_LEN) {
+    ring->cached_head = AtomicLoadAcquire(&ring->head);
+    if (tail - ring->cached_head == PARSED_CLIENT_COMMAND_RING_LEN) {
+      AtomicStoreRelaxed(&ring->dropped, ring->dropped + 1);
+      return NULL;
     }
-
-    MemoryCopy(&queue->items[queue->tail], msg, (sizeof *msg));
-    queue->tail = (queue->tail + 1) % PARSED_CLIENT_COMMAND_THREAD_QUEUE_LEN;
-    queue->count++;
-
-    signalCond(&queue->not_empty);
-  } unlockMutex(&queue->mutex);
+  }
+  return &ring->items[tail & (PARSED_CLIENT_COMMAND_RING_LEN-1)];
 }
 
-fn ParsedClientCommand* pccThreadSafeNonblockingQueuePop(ParsedClientCommandThreadQueue* q, ParsedClientCommand* copy_target) {
-  // immediately returns NULL if there's nothing in the ThreadQueue
-  // copies the ParsedClientCommand into `copy_target` if there is something in the queue
-  // and marks it as popped from the queue
-  ParsedClientCommand* result = NULL;
+// PRODUCER ONLY. publishes the slot handed out by the last pccRingReserve()
+fn void pccRingCommit(ParsedClientCommandRing* ring) {
+  AtomicStoreRelease(&ring->tail, ring->tail + 1);
+}
 
-  lockMutex(&q->mutex); {
-    if (q->count > 0) {
-      result = &q->items[q->head];
-      MemoryCopy(copy_target, result, (sizeof *copy_target));
-      q->head = (q->head + 1) % PARSED_CLIENT_COMMAND_THREAD_QUEUE_LEN;
-      q->count--;
+// PRODUCER ONLY. call before parsing each batch of datagrams, the batch gets its own receive arena
+fn void pccRingBeginBatch(ParsedClientCommandRing* ring) {
+  ring->batch_arena = 0;
+}
 
-      signalCond(&q->not_full);
+// PRODUCER ONLY. copies `string` into the current batch's receive arena for `command`, taking the next arena
+// if the batch doesn't have one yet. false if they're all still waiting on the consumer
+fn bool pccRingCopyString(ParsedClientCommandRing* ring, ParsedClientCommand* command, String string, String* copy) {
+  if (ring->batch_arena == 0) {
+    if (ring->arena_tail - AtomicLoadAcquire(&ring->arena_head) == RECV_ARENA_COUNT) {
+      return false;
     }
-  } unlockMutex(&q->mutex);
-
-  return result;
+    arenaClear(&ring->arenas[ring->arena_tail & (RECV_ARENA_COUNT-1)]);
+    ring->arena_tail += 1;
+    ring->batch_arena = ring->arena_tail;
+  }
+  command->recv_arena = ring->batch_arena;
+  *copy = stringCopy(&ring->arenas[(ring->batch_arena - 1) & (RECV_ARENA_COUNT-1)], string);
+  return true;
 }
 
-fn u64 entitySerialize(Entity current, Account* acct, u64 index, u8 bytes[]) {
-  // send entity header (common to all entity types)
-  index += writeU64ToBufferLE(bytes + index, current.id);
-  index += writeU64ToBufferLE(bytes + index, current.features);
-  bytes[index++] = current.x;
-  bytes[index++] = current.y;
-  bytes[index++] = (u8)current.type;  // EntityType
+// CONSUMER ONLY. points `items` at the oldest unread commands and returns how many are contiguous there.
+// the commands are read in-place and stay valid until pccRingConsume()
+fn u32 pccRingPeekBatch(ParsedClientCommandRing* ring, ParsedClientCommand** items) {
+  u64 head = ring->head;
+  if (head == ring->cached_tail) {
+    ring->cached_tail = AtomicLoadAcquire(&ring->tail);
+  }
+  u64 available = ring->cached_tail - head;
+  u64 head_slot = head & (PARSED_CLIENT_COMMAND_RING_LEN-1);
+  u64 until_wrap = PARSED_CLIENT_COMMAND_RING_LEN - head_slot;
+  *items = &ring->items[head_slot];
+  return (u32)Min(available, until_wrap);
+}
 
-  //if (CheckFlag(current.features, FeatureRegensHp)) {
-  //  index += writeU16ToBufferLE(bytes + index, current.hp);
-  //  index += writeU16ToBufferLE(bytes + index, current.max_hp);
-  //}
+// CONSUMER ONLY. hands `count` slots from the last pccRingPeekBatch() back to the producer
+fn void pccRingConsume(ParsedClientCommandRing* ring, u32 count) {
+  AtomicStoreRelease(&ring->head, ring->head + count);
+}
 
-  // send character-specific details (color and name)
-  if (current.type == EntityCharacter) {
-    bytes[index++] = current.color;
-    // send name string
-    index += writeU64ToBufferLE(bytes + index, acct->name.length);
-    for (u32 j = 0; j < acct->name.length; j++) {
-      bytes[index++] = acct->name.bytes[j];
-    }
+// CONSUMER ONLY. call once done with every command up to one from `recv_arena` (its ParsedClientCommand.recv_arena).
+// every arena before that one belongs to a batch that's over and whose commands all came before it, so those
+// go back to the producer. (the newest stays, its batch may still be going)
+fn void pccRingRecycleArenas(ParsedClientCommandRing* ring, u64 recv_arena) {
+  if (recv_arena > ring->arena_head + 1) {
+    AtomicStoreRelease(&ring->arena_head, recv_arena - 1);
   }
-  return index;
 }
 
 fn u64 entityFeaturesFromType(EntityType type) {
@@ -220,506 +370,1219 @@ fn u64 entityFeaturesFromType(EntityType type) {
   return result;
 }
 
-fn Account* findAccountById(u64 id) {
-  AccountChunk* current = &state.accounts;
-  while (current != NULL) {
-    for (u32 i = 0; i < current->length; i++) {
-      if (current->items[i].id == id) {
-        return &current->items[i];
-      }
+// a client's character walks where the client tells it to, not around on its own
+fn u64 playerCharacterFeatures() {
+  return entityFeaturesFromType(EntityCharacter) | FeatureMask(FeaturePlayerControlled);
+}
+
+fn void accountStoreInit(AccountStore* store, Arena* a) {
+  MemoryZeroStruct(store, AccountStore);
+  store->arena = a;
+  store->chunk_capacity = 16;
+  store->chunks = arenaAllocArray(a, AccountChunk*, store->chunk_capacity);
+  u64MapInit(&store->id_by_name_hash, a, ACCOUNT_INDEX_INITIAL_CAPACITY);
+  u64MapInit(&store->id_by_eid, a, ACCOUNT_INDEX_INITIAL_CAPACITY);
+}
+
+fn u64 accountNameHash(String name) {
+  u64 result = stringHash(name);
+  if (result == U64_MAP_EMPTY_KEY) {
+    result -= 1; // reserved by U64Map
+  }
+  return result;
+}
+
+// not a proper kdf (there's no crypto in the tree), but it's salted per account, so equal pws don't hash
+// the same, and PASSWORD_HASH_ROUNDS makes each guess at a leaked journal/snapshot cost that many rounds
+fn u64 passwordHash(u64 salt, String pw) {
+  u64 result = u64Hash(salt);
+  for (u32 round = 0; round < PASSWORD_HASH_ROUNDS; round++) {
+    for (u32 i = 0; i < pw.length; i++) {
+      result ^= (u8)pw.bytes[i];
+      result *= 0x100000001b3ull;
     }
-    current = current->next;
+    result = u64Hash(result ^ salt);
   }
-  return NULL;
+  return result;
+}
+
+fn u64 newPasswordSalt() {
+  u64 result = 0;
+  if (getentropy(&result, sizeof(result)) != 0) {
+    result = u64Hash(osTimeMicrosecondsNow() ^ state.accounts.length); // only if the os has no entropy to give
+  }
+  return result;
+}
+
+fn Account* findAccountById(u64 id) {
+  if (id >= state.accounts.length) {
+    return NULL;
+  }
+  return &state.accounts.chunks[id / ACCOUNT_CHUNK_SIZE]->items[id % ACCOUNT_CHUNK_SIZE];
 }
 
 fn Account* findAccountByEId(u64 id) {
-  AccountChunk* current = &state.accounts;
-  while (current != NULL) {
-    for (u32 i = 0; i < current->length; i++) {
-      if (current->items[i].eid == id) {
-        return &current->items[i];
-      }
-    }
-    current = current->next;
+  u64 account_id = 0;
+  if (!u64MapGet(&state.accounts.id_by_eid, id, &account_id)) {
+    return NULL;
   }
-  return NULL;
+  return findAccountById(account_id);
 }
 
 fn Account* findAccountByName(String name) {
-  AccountChunk* current = &state.accounts;
-  while (current != NULL) {
-    for (u32 i = 0; i < current->length; i++) {
-      if (stringsEq(&current->items[i].name, &name)) {
-        return &current->items[i];
-      }
+  u64 hash = accountNameHash(name);
+  u64 account_id = 0;
+  if (!u64MapGet(&state.accounts.id_by_name_hash, hash, &account_id)) {
+    return NULL;
+  }
+  // walk the (almost always length 1) chain of accounts whose names hash the same
+  for (Account* current = findAccountById(account_id); current != NULL; current = current->next_same_hash ? findAccountById(current->next_same_hash - 1) : NULL) {
+    if (current->name_hash == hash && stringsEq(&current->name, &name)) {
+      return current;
     }
-    current = current->next;
   }
   return NULL;
 }
 
-fn Account* newAccount(Arena* a, Account details) {
-  u64 id = 0;
-  AccountChunk* current = &state.accounts;
-  while (current != NULL) {
-    id += current->length;
-    if (current->length < current->capacity) {
-      Account* result = &current->items[current->length];
-      *result = details;
-      result->id = id;
-      current->length += 1;
-      printf("new account created id=%lld\n", id);
-      return result;
-    }
-    if (current->next == NULL) {
-      // alloc next chunk of accounts
-      AccountChunk* next = arenaAlloc(a, sizeof(AccountChunk));
-      next->capacity = ACCOUNT_CHUNK_SIZE;
-      next->items = arenaAllocArray(a, Account, next->capacity);
-      current->next = next;
-    }
-    current = current->next;
-  }
-  assert(false); // never should be reached
-  return NULL;
+// the only way an account's eid should change at runtime, so the eid index stays in sync
+fn void setAccountCharacter(Account* account, u64 eid) {
+  if (account->eid != 0 && findAccountByEId(account->eid) == account) {
+    u64MapRemove(&state.accounts.id_by_eid, account->eid);
+  }
+  account->eid = eid;
+  if (eid != 0) {
+    u64MapPut(&state.accounts.id_by_eid, eid, account->id);
+  }
 }
 
-fn u64 pushEntity(EntityChunk* chunk, Entity e) {
-  assert(chunk->length < chunk->capacity);
-  chunk->items[chunk->length] = e;
-  u64 result = chunk->length;
+fn Account* newAccount(Arena* a, Account details) {
+  AccountStore* store = &state.accounts;
+  u64 id = store->length;
+  u64 chunk_index = id / ACCOUNT_CHUNK_SIZE;
+  if (id % ACCOUNT_CHUNK_SIZE == 0) {
+    // alloc next chunk of accounts, growing the directory first if it's full
+    if (chunk_index == store->chunk_capacity) {
+      AccountChunk** chunks = arenaAllocArray(store->arena, AccountChunk*, store->chunk_capacity * 2);
+      MemoryCopy(chunks, store->chunks, sizeof(AccountChunk*) * store->chunk_capacity);
+      store->chunks = chunks;
+      store->chunk_capacity *= 2;
+    }
+    AccountChunk* next = arenaAlloc(a, sizeof(AccountChunk));
+    next->length = 0;
+    next->capacity = ACCOUNT_CHUNK_SIZE;
+    next->next = NULL;
+    next->items = arenaAllocArray(a, Account, next->capacity);
+    if (chunk_index > 0) {
+      store->chunks[chunk_index - 1]->next = next;
+    }
+    store->chunks[chunk_index] = next;
+  }
+  AccountChunk* chunk = store->chunks[chunk_index];
+  Account* result = &chunk->items[chunk->length];
+  *result = details;
+  result->id = id;
+  result->name_hash = accountNameHash(result->name);
+  result->next_same_hash = 0;
+  result->eid = 0;
   chunk->length += 1;
+  store->length += 1;
+
+  // index by name, chaining onto any existing account with the same hash
+  u64 colliding_id = 0;
+  if (u64MapGet(&store->id_by_name_hash, result->name_hash, &colliding_id)) {
+    Account* tail = findAccountById(colliding_id);
+    while (tail->next_same_hash != 0) {
+      tail = findAccountById(tail->next_same_hash - 1);
+    }
+    tail->next_same_hash = id + 1;
+  } else {
+    u64MapPut(&store->id_by_name_hash, result->name_hash, id);
+  }
+  setAccountCharacter(result, details.eid);
   return result;
 }
 
-fn bool isSpaceInChunk(EntityChunk* chunk) {
-  return chunk->length < chunk->capacity;
+///// persistence
+fn void journalAccountCreated(Account* account) {
+  u8 bytes[JOURNAL_RECORD_MAX_LEN];
+  u64 len = 0;
+  assert(1 + sizeof(u64) + sizeof(u16) + account->name.length + 1 + 2*sizeof(u64) <= JOURNAL_RECORD_MAX_LEN);
+  bytes[len++] = (u8)JournalRecordAccountCreated;
+  len += writeU64ToBufferLE(bytes + len, account->id);
+  len += writeU16ToBufferLE(bytes + len, (u16)account->name.length);
+  MemoryCopy(bytes + len, account->name.bytes, account->name.length);
+  len += account->name.length;
+  bytes[len++] = 0;
+  len += writeU64ToBufferLE(bytes + len, account->pw_salt);
+  len += writeU64ToBufferLE(bytes + len, account->pw_hash);
+  journalAppend(&state.journal, bytes, (u16)len);
 }
 
-fn bool allChunksFull(ChunkedEntityList list) {
-  return list.length >= (list.chunk_size * list.chunks);
+fn void journalAccountCharacter(Account* account) {
+  u8 bytes[1 + 2*sizeof(u64)];
+  u64 len = 0;
+  bytes[len++] = (u8)JournalRecordAccountCharacter;
+  len += writeU64ToBufferLE(bytes + len, account->id);
+  len += writeU64ToBufferLE(bytes + len, account->eid);
+  journalAppend(&state.journal, bytes, (u16)len);
 }
 
-fn EntityChunk* pushNewChunk(Arena* a, ChunkedEntityList* list) {
-  EntityChunk* new_chunk;
-  if (free_chunks.length > 0) {
-    new_chunk = free_chunks.first;
-    free_chunks.length -= 1;
-    free_chunks.first = new_chunk->next;
-  } else {
-    new_chunk = arenaAlloc(a, sizeof(EntityChunk));
-    // alloc the new chunk of entities
-    new_chunk->length = 0;
-    new_chunk->capacity = list->chunk_size;
-    new_chunk->next = NULL;
-    new_chunk->items = arenaAllocArray(a, Entity, list->chunk_size);
-  }
-  // bookeeping in the list
-  list->chunks += 1;
-  if (list->first == NULL) {
-    list->first = new_chunk;
-  } else {
-    EntityChunk* last = list->first;
-    while (last->next != NULL) {
-      last = last->next;
+// the decoded form of a journal record. strings point into the record itself
+typedef struct AccountJournalRecord {
+  JournalRecordType type;
+  u64 id;
+  u64 eid;
+  String name;
+  u64 pw_salt;
+  u64 pw_hash;
+} AccountJournalRecord;
+
+fn bool parseAccountJournalRecord(String record, AccountJournalRecord* result) {
+  u8* bytes = (u8*)record.bytes;
+  MemoryZeroStruct(result, AccountJournalRecord);
+  if (record.length < 1 + sizeof(u64)) {
+    return false;
+  }
+  result->type = (JournalRecordType)bytes[0];
+  result->id = readU64FromBufferLE(bytes + 1);
+  u64 offset = 1 + sizeof(u64);
+  switch (result->type) {
+    case JournalRecordAccountCreated: {
+      if (offset + sizeof(u16) > record.length) {
+        return false;
+      }
+      u16 name_len = readU16FromBufferLE(bytes + offset);
+      offset += sizeof(u16);
+      if (offset + name_len + 1 + 2*sizeof(u64) > record.length) {
+        return false;
+      }
+      result->name.bytes = (ptr)(bytes + offset);
+      result->name.length = name_len;
+      result->name.capacity = name_len + 1;
+      offset += name_len + 1;
+      result->pw_salt = readU64FromBufferLE(bytes + offset);
+      result->pw_hash = readU64FromBufferLE(bytes + offset + sizeof(u64));
+      return true;
+    }
+    case JournalRecordAccountCharacter: {
+      if (offset + sizeof(u64) > record.length) {
+        return false;
+      }
+      result->eid = readU64FromBufferLE(bytes + offset);
+      return true;
+    }
+    default: {
+      return false;
     }
-    last->next = new_chunk;
   }
-  return new_chunk;
 }
 
-fn Entity* entityPtrFromChunkList(ChunkedEntityList* list, i32 index) {
-  Entity* result = (Entity*)&NULL_ENTITY;
-  i32 chunk_index = index / list->chunk_size;
-  EntityChunk* chunk = list->first;
-  for (i32 i = 0; i < chunk_index; i++) {
-    chunk = chunk->next;
+// journal replay callback, runs before any other thread is up
+fn void applyAccountJournalRecord(String record) {
+  AccountJournalRecord parsed;
+  if (!parseAccountJournalRecord(record, &parsed)) {
+    printf("journal: skipping unreadable record (%d bytes)\n", record.length);
+    return;
+  }
+  switch (parsed.type) {
+    case JournalRecordAccountCreated: {
+      if (parsed.id != state.accounts.length) {
+        printf("journal: account id %lld out of order (expected %lld), skipping\n", parsed.id, state.accounts.length);
+        return;
+      }
+      Account details = { .name = parsed.name, .pw_salt = parsed.pw_salt, .pw_hash = parsed.pw_hash };
+      newAccount(&permanent_arena, details);
+    } break;
+    case JournalRecordAccountCharacter: {
+      Account* account = findAccountById(parsed.id);
+      if (account != NULL) {
+        account->eid = parsed.eid; // see restoreAccounts()
+      }
+    } break;
+    default: break;
   }
-  result = &chunk->items[index % list->chunk_size];
-  return result;
 }
 
-fn Entity entityFromChunkList(ChunkedEntityList* list, i32 index) {
-  Entity result = {0};
-  i32 chunk_index = index / list->chunk_size;
-  EntityChunk* chunk = list->first;
-  for (i32 i = 0; i < chunk_index; i++) {
-    chunk = chunk->next;
+// JournalCompactFn: previous snapshot payload + one journal's records -> next snapshot payload
+fn String compactAccountSnapshot(Arena* a, String previous, String journal) {
+  AccountSnapshotHeader header = {0};
+  AccountSnapshotEntry* previous_entries = NULL;
+  u8* previous_strings = NULL;
+  if (previous.length >= sizeof(AccountSnapshotHeader)) {
+    header = *(AccountSnapshotHeader*)previous.bytes;
+    previous_entries = (AccountSnapshotEntry*)(previous.bytes + sizeof(AccountSnapshotHeader));
+    previous_strings = (u8*)(previous_entries + header.account_count);
+  }
+
+  // first pass over the journal just sizes the new payload
+  u64 account_count = header.account_count;
+  u64 strings_length = header.strings_length;
+  u64 offset = 0;
+  String record = {0};
+  AccountJournalRecord parsed;
+  while (journalNextRecord(journal, &offset, &record)) {
+    if (parseAccountJournalRecord(record, &parsed) && parsed.type == JournalRecordAccountCreated && parsed.id == account_count) {
+      account_count += 1;
+      strings_length += parsed.name.length + 1;
+    }
+  }
+
+  u64 payload_length = sizeof(AccountSnapshotHeader) + account_count * sizeof(AccountSnapshotEntry) + strings_length;
+  if (payload_length > MAX_u32) {
+    printf("accounts: a snapshot of %lld accounts would be %lld bytes, more than a String can hold\n", account_count, payload_length);
+    return (String){0};
+  }
+  u8* payload = arenaAlloc(a, payload_length);
+  AccountSnapshotEntry* entries = (AccountSnapshotEntry*)(payload + sizeof(AccountSnapshotHeader));
+  u8* strings = (u8*)(entries + account_count);
+  if (header.account_count > 0) {
+    MemoryCopy(entries, previous_entries, header.account_count * sizeof(AccountSnapshotEntry));
+    MemoryCopy(strings, previous_strings, header.strings_length);
+  }
+
+  // second pass applies the records on top
+  u64 next_account = header.account_count;
+  u64 next_string = header.strings_length;
+  offset = 0;
+  while (journalNextRecord(journal, &offset, &record)) {
+    if (!parseAccountJournalRecord(record, &parsed)) {
+      continue;
+    }
+    if (parsed.type == JournalRecordAccountCreated && parsed.id == next_account) {
+      AccountSnapshotEntry* entry = &entries[next_account++];
+      entry->eid = 0;
+      entry->name_offset = next_string;
+      entry->name_length = parsed.name.length;
+      entry->pw_salt = parsed.pw_salt;
+      entry->pw_hash = parsed.pw_hash;
+      MemoryCopy(strings + next_string, parsed.name.bytes, parsed.name.length + 1);
+      next_string += parsed.name.length + 1;
+    } else if (parsed.type == JournalRecordAccountCharacter && parsed.id < next_account) {
+      entries[parsed.id].eid = parsed.eid;
+    }
   }
-  result = chunk->items[index % list->chunk_size];
+  header.account_count = account_count;
+  header.strings_length = strings_length;
+  *(AccountSnapshotHeader*)payload = header;
+
+  String result = { (u32)payload_length, (u32)payload_length, (ptr)payload };
   return result;
 }
 
-fn bool deleteLastEntity(ChunkedEntityList* list, EntityChunk* last_chunk, EntityChunk* second_to_last_chunk) {
-  last_chunk->length -= 1;
-  list->length -= 1;
-  // don't delete the room's only chunk, but otherwise move the chunk to the free-list
-  if (last_chunk->length == 0 && last_chunk != list->first) {
-    list->chunks -= 1;
-    second_to_last_chunk->next = NULL;
-    free_chunks.length += 1;
-    EntityChunk* last_free_chunk = free_chunks.first;
-    if (last_free_chunk) {
-      while (last_free_chunk->next != NULL) {
-        last_free_chunk = last_free_chunk->next;
-      }
-      last_free_chunk->next = last_chunk;
-    } else {
-      free_chunks.first = last_chunk;
+// rebuilds the accounts from the snapshot + journals. names keep pointing into the mapped files
+fn void restoreAccounts(str data_dir) {
+  u64 start = osTimeMicrosecondsNow();
+  journalInit(&state.journal, &permanent_arena, data_dir, JOURNAL_COMPACT_EVERY, &compactAccountSnapshot);
+  String snapshot = journalLoadSnapshot(&state.journal);
+  u64 from_snapshot = 0;
+  if (snapshot.length >= sizeof(AccountSnapshotHeader)) {
+    AccountSnapshotHeader* header = (AccountSnapshotHeader*)snapshot.bytes;
+    AccountSnapshotEntry* entries = (AccountSnapshotEntry*)(snapshot.bytes + sizeof(AccountSnapshotHeader));
+    u8* strings = (u8*)(entries + header->account_count);
+    u64MapReserve(&state.accounts.id_by_name_hash, header->account_count);
+    for (u64 i = 0; i < header->account_count; i++) {
+      AccountSnapshotEntry* entry = &entries[i];
+      Account details = {
+        .name = { (u32)entry->name_length, (u32)entry->name_length + 1, (ptr)(strings + entry->name_offset) },
+        .pw_salt = entry->pw_salt,
+        .pw_hash = entry->pw_hash,
+      };
+      Account* account = newAccount(&permanent_arena, details);
+      // entity handles don't survive a restart, so this isn't indexed. a non-zero eid just means
+      // "they have a character", which gets respawned (under a fresh handle) when they log in
+      account->eid = entry->eid;
     }
+    from_snapshot = header->account_count;
+  }
+  u64 replayed = journalReplay(&state.journal, &applyAccountJournalRecord);
+  printf("restored %lld accounts (%lld from snapshot, %lld journal records) in %lldus\n",
+         state.accounts.length, from_snapshot, replayed, osTimeMicrosecondsNow() - start);
+}
+
+// LANES ONLY. the calling lane's chunk cache, for entityStoreSetLane()
+fn EntityChunkLaneCache* laneChunks() {
+  assert(LaneIdx() < state.chunk_pool.lane_count);
+  return &state.chunk_pool.lanes[LaneIdx()];
+}
+
+fn u32 roomIndex(i32 x, i32 y) {
+  assert(x >= 0 && x < ROOMS_X && y >= 0 && y < ROOMS_Y);
+  return (u32)(y * ROOMS_X + x);
+}
+
+// the room store an entity handle points into
+fn EntityStore* roomStoreOf(u64 eid) {
+  u32 store_idx = EntityHandleStore(eid);
+  assert(store_idx < state.rooms.length);
+  return &state.rooms.items[store_idx].entities;
+}
+
+fn void roomsInit(RoomList* rooms, Arena* a) {
+  rooms->length = MAX_ROOMS;
+  rooms->items = arenaAllocArray(a, Room, MAX_ROOMS);
+  MemoryZero(rooms->items, sizeof(Room) * MAX_ROOMS);
+  for (i32 y = 0; y < ROOMS_Y; y++) {
+    for (i32 x = 0; x < ROOMS_X; x++) {
+      Room* room = &rooms->items[roomIndex(x, y)];
+      room->xyz = (XYZ){ x, y, 0 };
+      entityStoreInit(&room->entities, &state.chunk_pool, roomIndex(x, y), MAX_ENTITIES);
+    }
+  }
+}
+
+// cpus are sorted by numa node, so neighboring lanes (which own neighboring rooms, and so trade the most
+// entities) end up on the same node. the network threads get the last NETWORK_THREAD_CPUS of them
+fn ThreadPlacement planThreadPlacement(u64 requested_lanes, bool pin) {
+  ThreadPlacement result = {0};
+  u32 cpus[MAX_PLACEMENT_CPUS];
+  u32 nodes[MAX_PLACEMENT_CPUS];
+  u32 cpu_count = osCpusAvailable(cpus, MAX_PLACEMENT_CPUS);
+  if (cpu_count == 0) {
+    cpus[0] = 0;
+    cpu_count = 1;
+    pin = false;
+  }
+  for (u32 i = 0; i < cpu_count; i++) {
+    nodes[i] = osCpuNumaNode(cpus[i]);
+  }
+  for (u32 i = 1; i < cpu_count; i++) {
+    for (u32 j = i; j > 0 && (nodes[j-1] > nodes[j] || (nodes[j-1] == nodes[j] && cpus[j-1] > cpus[j])); j--) {
+      u32 cpu = cpus[j]; cpus[j] = cpus[j-1]; cpus[j-1] = cpu;
+      u32 node = nodes[j]; nodes[j] = nodes[j-1]; nodes[j-1] = node;
+    }
+  }
+  u32 network_cpus = cpu_count >= NETWORK_THREAD_CPUS + 2 ? NETWORK_THREAD_CPUS : 0;
+  u32 lane_cpus = cpu_count - network_cpus;
+  result.lane_count = Min(requested_lanes > 0 ? requested_lanes : lane_cpus, MAX_GAME_LANES);
+  result.pin = pin && result.lane_count <= lane_cpus;
+  for (u64 i = 0; i < result.lane_count; i++) {
+    result.lane_cpus[i] = cpus[i % lane_cpus];
+    result.lane_nodes[i] = nodes[i % lane_cpus];
+  }
+  for (u32 i = 0; i < network_cpus; i++) {
+    result.network_cpus[result.network_cpu_count++] = cpus[lane_cpus + i];
+  }
+  return result;
+}
+
+// LANES ONLY. pins the lane to its cpu. called first thing, before the lane has a ThreadContext (so lane_idx
+// is passed in) or any memory of its own. false if the lane isn't pinned
+fn bool pinLaneThread(ThreadPlacement* placement, u64 lane_idx) {
+  if (!placement->pin) {
+    return false;
+  }
+  u32 cpu = placement->lane_cpus[lane_idx];
+  if (!osThreadSetAffinity(&cpu, 1)) {
+    printf("couldn't pin lane %lld to cpu %d\n", lane_idx, cpu);
+    return false;
   }
   return true;
 }
 
+// LANES ONLY. makes the lane's arenas prefer its cpu's node. arenaInit() only reserves address space, so as long
+// as nothing's been allocated from them yet, every page they ever fault in lands on that node
+fn void placeLaneArenas(ThreadPlacement* placement, Arena** arenas, u32 arena_count) {
+  for (u32 i = 0; i < arena_count; i++) {
+    osMemoryPreferNumaNode(arenas[i]->memory, arenas[i]->max, placement->lane_nodes[LaneIdx()]);
+  }
+}
+
+fn void placeNetworkThread(ThreadPlacement* placement) {
+  if (placement->pin && placement->network_cpu_count > 0) {
+    osThreadSetAffinity(placement->network_cpus, placement->network_cpu_count);
+  }
+}
+
 fn void exitWithErrorMessage(ptr msg) {
   printf("error: %s", msg);
   exit(1);
 }
 
+fn u64 socketAddressKey(SocketAddress addr) {
+  return ((u64)addr.sin_addr.s_addr << 16) | addr.sin_port;
+}
+
+fn void clientListInit(ClientList* clients, Arena* a, u64 capacity) {
+  MemoryZeroStruct(clients, ClientList);
+  assert(capacity >= 1 && capacity <= MAX_u32 - CLIENT_CHUNK_SIZE);
+  clients->arena = a;
+  clients->capacity = ((capacity + CLIENT_CHUNK_SIZE - 1) / CLIENT_CHUNK_SIZE) * CLIENT_CHUNK_SIZE;
+  u64 chunk_count = clients->capacity / CLIENT_CHUNK_SIZE;
+  clients->chunks = arenaAllocArray(a, Client*, chunk_count);
+  MemoryZero(clients->chunks, sizeof(Client*) * chunk_count);
+  clients->free_handles = arenaAllocArray(a, u32, clients->capacity);
+  u64MapInit(&clients->handle_by_address, a, CLIENT_INDEX_INITIAL_CAPACITY);
+  u64MapInit(&clients->handle_by_eid, a, CLIENT_INDEX_INITIAL_CAPACITY);
+  clients->chunks[0] = arenaAllocArray(a, Client, CLIENT_CHUNK_SIZE);
+  MemoryZero(clients->chunks[0], sizeof(Client) * CLIENT_CHUNK_SIZE);
+  clients->length = 1; // making entry 0 to be a "null" client
+}
+
+fn Client* clientFromHandle(ClientList* clients, u32 handle) {
+  return &clients->chunks[handle / CLIENT_CHUNK_SIZE][handle % CLIENT_CHUNK_SIZE];
+}
+
+// forgets the client in `handle`'s slot, drops it from the lookup indexes, and puts the slot on the free list
+fn void releaseClient(ClientList* clients, u32 handle) {
+  Client* client = clientFromHandle(clients, handle);
+  if (!client->connected) {
+    return;
+  }
+  u64MapRemove(&clients->handle_by_address, socketAddressKey(client->address));
+  if (client->character_eid != 0) {
+    u64MapRemove(&clients->handle_by_eid, client->character_eid);
+  }
+  MemoryZeroStruct(client, Client);
+  clients->free_handles[clients->free_count++] = handle;
+}
+
+// returns 0 (the null client) if the server is full
 fn u32 pushClient(ClientList* clients, SocketAddress addr) {
   Client new_client = {0};
   new_client.last_ping = state.frame;
   new_client.address = addr;
-
-  // first, try to overwrite an old dc'ed client
-  for (u32 i = 1; i < clients->length; i++) {
-    if (clients->items[i].character_eid == 0) {
-      clients->items[i] = new_client;
-      return i;
+  new_client.connected = true;
+
+  u32 result = 0;
+  if (clients->free_count > 0) {
+    // first, reuse the slot of a client that dc'ed
+    result = clients->free_handles[--clients->free_count];
+  } else if (clients->length < clients->capacity) {
+    // otherwise take the next never-used slot, allocating its chunk if we just crossed into a new one
+    result = clients->length;
+    if (clients->chunks[result / CLIENT_CHUNK_SIZE] == NULL) {
+      Client* chunk = arenaAllocArray(clients->arena, Client, CLIENT_CHUNK_SIZE);
+      MemoryZero(chunk, sizeof(Client) * CLIENT_CHUNK_SIZE);
+      clients->chunks[result / CLIENT_CHUNK_SIZE] = chunk;
     }
+    clients->length += 1;
+  } else {
+    return 0;
   }
-
-  // if there are none, then add the client to the end of the list
-  assert(clients->capacity > clients->length);//TODO grow the list if we need to
-  clients->items[clients->length] = new_client;
-  u32 result = clients->length;
-  clients->length += 1;
+  *clientFromHandle(clients, result) = new_client;
+  u64MapPut(&clients->handle_by_address, socketAddressKey(addr), result);
   return result;
 }
 
-fn bool deleteClientByEId(ClientList* clients, u64 id) {
-  bool succeeded = false;
-  Client blank_client = {0};
-  // i=1 because first client is null-client
-  for (u32 i = 1; i < clients->length && !succeeded; i++) {
-    if (clients->items[i].character_eid == id) {
-      clients->items[i] = blank_client;
-      succeeded = true;
-    }
+// the only way a client's character_eid should change, so the eid index stays in sync
+fn void setClientCharacter(ClientList* clients, u32 handle, u64 eid) {
+  Client* client = clientFromHandle(clients, handle);
+  if (client->character_eid != 0) {
+    u64MapRemove(&clients->handle_by_eid, client->character_eid);
+  }
+  client->character_eid = eid;
+  if (eid != 0) {
+    u64MapPut(&clients->handle_by_eid, eid, handle);
   }
-  return succeeded;
 }
 
 fn u32 findClientHandleByEId(ClientList* clients, u64 id) {
-  for (u32 i = 0; i < clients->length; i++) {
-    Client c = clients->items[i];
-    if (c.character_eid == id) {
-      return i;
-    }
-  }
-  return 0;
+  u64 result = 0;
+  u64MapGet(&clients->handle_by_eid, id, &result);
+  return (u32)result;
 }
 
 fn u32 findClientHandleBySocketAddress(ClientList* clients, SocketAddress address) {
-  for (u32 i = 0; i < clients->length; i++) {
-    Client c = clients->items[i];
-    if (socketAddressEqual(address, c.address)) {
-      return i;
-    }
+  u64 result = 0;
+  u64MapGet(&clients->handle_by_address, socketAddressKey(address), &result);
+  return (u32)result;
+}
+
+fn bool deleteClientByEId(ClientList* clients, u64 id) {
+  u32 handle = findClientHandleByEId(clients, id);
+  if (handle == 0) {
+    return false;
   }
-  return 0;
+  releaseClient(clients, handle);
+  return true;
 }
 
 fn void handleIncomingMessage(u8* message, u32 len, SocketAddress sender, i32 socket) {
-  dbg("%d: %s from %s:%d\n", len, command_type_strings[message[0]], inet_ntoa(sender.sin_addr), sender.sin_port);
-  u32 msg_idx = 0;
+  dbg("%d: %s from %s:%d\n", len, command_type_strings[message[0] < CommandType_Count ? message[0] : 0], inet_ntoa(sender.sin_addr), sender.sin_port);
+  ParsedClientCommand* slot = pccRingReserve(state.network_recv_queue);
+  if (slot == NULL) {
+    dbg("recv queue full, dropping command\n");
+    return; // lane 0 is behind, better to drop than to stop reading the socket
+  }
+  BitReader r = bitReader(message, len);
   ParsedClientCommand parsed = {
-    .type = (CommandType)message[msg_idx++],
+    .type = (CommandType)bitRead(&r, 8),
     .sender_ip = sender.sin_addr.s_addr,
     .sender_port = sender.sin_port,
+    .received_us = osTimeMicrosecondsNow(),
   };
-  u8 temp_bytes[UDP_MAX_MESSAGE_LEN] = {0};
-  String temp_str = {
-    .bytes = (char*)temp_bytes,
-    .length = 0,
-    .capacity = 0,
-  };
+  bool ok = false;
   switch (parsed.type) {
     case CommandLogin: {
-      // parse the login command
-      parsed.alt_port = ~readU16FromBufferLE(message + msg_idx);
-      msg_idx += 2;
-      parsed.alt_ip = ~readI32FromBufferLE(message + msg_idx);
-      msg_idx += 4;
-
-      // parse the name
-      u8 name_len = message[msg_idx++];
-      MemoryZero(temp_bytes, UDP_MAX_MESSAGE_LEN);
-      temp_str.length = name_len;
-      temp_str.capacity = temp_str.length+1;
-      for (u32 j = 0; j < temp_str.length; j++) {
-        temp_str.bytes[j] = message[msg_idx+j];
-      }
-      parsed.name = allocStringChunkList(&state.string_arena, temp_str);
-      msg_idx += temp_str.length;
-
-      // parse the password
-      u32 pw_len = 0;
-      while (message[msg_idx+pw_len]) {
-        pw_len += 1;
-      }
-      MemoryZero(temp_bytes, UDP_MAX_MESSAGE_LEN);
-      temp_str.length = pw_len;
-      temp_str.capacity = temp_str.length+1;
-      for (u32 j = 0; j < temp_str.length; j++) {
-        temp_str.bytes[j] = message[msg_idx+j];
+      // the name and password are views into `message`, which gets reused for the next batch, so they're
+      // copied once (straight into the batch's receive arena) when the command turns out to be whole
+      LoginCommand login;
+      ok = decodeLoginCommand(&r, &login);
+      if (ok) {
+        parsed.alt_port = ~login.lan_port;
+        parsed.alt_ip = ~login.lan_ip;
+        if (!pccRingCopyString(state.network_recv_queue, &parsed, wireString(login.name), &parsed.name) ||
+            !pccRingCopyString(state.network_recv_queue, &parsed, wireString(login.pass), &parsed.pass)) {
+          dbg("receive arenas full, dropping login\n");
+          AtomicStoreRelaxed(&state.network_recv_queue->dropped, state.network_recv_queue->dropped + 1);
+          return;
+        }
+        printf("Logging in player: %s %lld\n", command_type_strings[parsed.type], login.name.len);
       }
-      parsed.pass = allocStringChunkList(&state.string_arena, temp_str);
-      msg_idx += temp_str.length;
-
-      printf("Logging in player: %s %d %s\n", MESSAGE_STRINGS[parsed.type], name_len, message + 7);
     } break;
-    case CommandKeepAlive:
-      break;
+    case CommandKeepAlive: {
+      KeepAliveCommand keep_alive;
+      ok = decodeKeepAliveCommand(&r, &keep_alive);
+    } break;
+    case CommandAckSnapshot: {
+      AckSnapshotCommand ack;
+      ok = decodeAckSnapshotCommand(&r, &ack);
+      parsed.seq = ack.seq;
+    } break;
     case CommandCreateCharacter: {
       printf("command create character received\n");
-      parsed.byte = message[1];
+      CreateCharacterCommand create;
+      ok = decodeCreateCharacterCommand(&r, &create);
+      parsed.byte = create.color;
     } break;
     case CommandInvalid:
-    case CommandType_Count: {
+    case CommandType_Count:
+    default: {
       dbg("invalid command type");
+      ok = !r.overflow; // lane 0 ignores it
     } break;
   }
+  if (!ok) {
+    dbg("malformed %s, dropping it\n", command_type_strings[parsed.type < CommandType_Count ? parsed.type : 0]);
+    return;
+  }
 
-  pccThreadSafeQueuePush(state.network_recv_queue, &parsed);
+  *slot = parsed;
+  pccRingCommit(state.network_recv_queue);
   fflush(stdout);
 }
 
+fn void handleIncomingBatch(UDPMessage* messages, u32 count, i32 socket) {
+  pccRingBeginBatch(state.network_recv_queue);
+  for (u32 i = 0; i < count; i++) {
+    handleIncomingMessage(messages[i].bytes, messages[i].bytes_len, messages[i].address, socket);
+  }
+  threadSignalNotify(&state.network_recv_queue->not_empty);
+}
+
+fn void logRecvStats(UDPRecvStats* stats) {
+  u64 syscalls = AtomicLoadRelaxed(&stats->syscalls);
+  if (syscalls == 0) {
+    return;
+  }
+  u64 datagrams = AtomicLoadRelaxed(&stats->datagrams);
+  dbg("recv: %lld datagrams over %lld syscalls (avg batch %.2f)\n", datagrams, syscalls, (f64)datagrams / (f64)syscalls);
+  for (u32 i = 1; i <= NET_RECV_BATCH_LEN; i++) {
+    u64 batches = AtomicLoadRelaxed(&stats->batch_sizes[i]);
+    if (batches > 0) {
+      dbg("  batch of %2d: %lld\n", i, batches);
+    }
+  }
+}
+
+fn void logRecvDrops(ParsedClientCommandRing* ring) {
+  u64 dropped = AtomicLoadRelaxed(&ring->dropped);
+  if (dropped > 0) {
+    dbg("recv: %lld commands dropped on a full queue\n", dropped);
+  }
+}
+
+fn void logCommandLatency(CommandLatencyStats* stats) {
+  if (stats->count == 0) {
+    return;
+  }
+  dbg("commands: %lld handled, avg latency %lldus, max %lldus, %lld replies dropped on a full send queue\n",
+      stats->count, stats->total_us / stats->count, stats->max_us, stats->replies_dropped);
+}
+
+fn void logTickStats(TickClock* clock) {
+  TickStats* stats = &clock->stats;
+  if (stats->ticks == 0) {
+    return;
+  }
+  dbg("tick: %lld ticks @ %lldus, work avg %lldus stddev %lldus max %lldus, late max %lldus, %lld overruns, %lld skipped\n",
+      stats->ticks, clock->period_us, stats->total_work_us / stats->ticks, tickWorkStddevUs(stats), stats->max_work_us, stats->max_late_us,
+      stats->overruns, stats->skipped);
+}
+
+fn void logSnapshotStats(SnapshotSendStats* stats) {
+  u64 snapshots = AtomicLoadRelaxed(&stats->snapshots);
+  if (snapshots == 0) {
+    return;
+  }
+  dbg("snapshots: %lld sent in %lld parts, %lld truncated\n", snapshots, AtomicLoadRelaxed(&stats->parts), AtomicLoadRelaxed(&stats->truncated));
+}
+
+fn void logSendStats(UDPSendStats* stats) {
+  if (stats->syscalls == 0) {
+    return;
+  }
+  dbg("send: %lld messages in %lld datagrams over %lld syscalls\n", stats->messages, stats->datagrams, stats->syscalls);
+}
+
 fn void* receiveNetworkUpdates(void* udp) {
   UDPServer server = *(UDPServer*)udp;
+  placeNetworkThread(&state.placement);
   dbg("receiveNetworkUpdates() sock=%d\n", server.server_socket);
-  infiniteReadUDPServer(&server, handleIncomingMessage);
+  infiniteBatchReadUDPServer(&server, state.network_recv_batch, handleIncomingBatch);
   return NULL;
 }
 
+// LANES ONLY, while capturing. accounts only change in processClientCommands(), which never overlaps a capture
+fn String snapshotEntityName(u64 eid) {
+  Account* account = findAccountByEId(eid);
+  String result = {0};
+  if (account != NULL) {
+    result = account->name;
+  }
+  return result;
+}
+
 fn void* sendNetworkUpdates(void* sock) {
+  placeNetworkThread(&state.placement);
   ThreadContext tctx = {0};
   tctxInit(&tctx);
   i32* socket_ptr = (i32*)sock;
   i32 socket = *socket_ptr;
+  UDPSendBatch* send_batch = state.network_send_batch;
+  UDPMessage* drained_messages = arenaAllocArray(&tctx.arena, UDPMessage, NET_OUTGOING_MESSAGE_QUEUE_LEN);
+  UDPMessage snapshot_message = {0};
+  Arena sweep_arena = {0};
+  arenaInit(&sweep_arena);
+  InterestSet* interest_sets = NULL; // by client handle, what their character can see. their snapshots only cover that
+  u64 interest_set_capacity = 0;
+  u64 next_sweep = osTimeMicrosecondsNow();
+  bool capturing = false;
   while (true) {
-    u64 loop_start = osTimeMicrosecondsNow();
-
-    // 1. clear out our "outgoingMessage" queue
-    {
-      UDPMessage to_send = { 0 };
-      UDPMessage* next_to_send = outgoingMessageNonblockingQueuePop(state.network_send_queue, &to_send);
-      u8List bytes_list = { 0 };
-      while (next_to_send != NULL) {
-        bytes_list.items = to_send.bytes;
-        bytes_list.length = to_send.bytes_len;
-        bytes_list.capacity = to_send.bytes_len;
-        sendUDPu8List(socket, &to_send.address, &bytes_list);
-        next_to_send = outgoingMessageNonblockingQueuePop(state.network_send_queue, &to_send);
+    // 1. per-client work runs on its own deadline. the lanes capture the rooms first, at the end of their next tick
+    u64 now = osTimeMicrosecondsNow();
+    if (now >= next_sweep && !capturing) {
+      AtomicStoreRelease(&state.capture_requested, 1);
+      capturing = true;
+    }
+    if (capturing && AtomicLoadAcquire(&state.capture_requested) == 0) {
+      capturing = false;
+      arenaClear(&sweep_arena);
+      SnapshotSend* sends = NULL;
+      u32 send_count = 0;
+      u32 client_count = 0;
+      SnapshotLog* log = &state.snapshots;
+      u64 seq = log->seq;
+      // only copying out what each client's snapshot needs happens while holding the client lock
+      lockMutex(&state.client_mutex); {
+        client_count = state.clients.length;
+        sends = arenaAllocArray(&sweep_arena, SnapshotSend, client_count);
+        // WARNING the `i` starts at 1 here because handle 0 is the "null" Client
+        for (u32 i = 1; i < client_count; i++) {
+          Client* client = clientFromHandle(&state.clients, i);
+          if (!client->connected) {
+            continue;
+          }
+          if (client->last_ping+CLIENT_TIMEOUT_FRAMES < state.frame) {
+            releaseClient(&state.clients, i);
+            continue;
+          }
+          u32 slot = 0;
+          if (client->character_eid == 0 || snapshotWorldFind(&log->world, client->character_eid, &slot) == NULL) {
+            continue; // they are still creating their character
+          }
+          client->last_snapshot_sent = seq;
+          sends[send_count++] = (SnapshotSend){
+            .handle = i,
+            .address = client->address,
+            .character_eid = client->character_eid,
+            .acked_snapshot = client->acked_snapshot,
+          };
+        }
+      } unlockMutex(&state.client_mutex);
+
+      if (interest_set_capacity < client_count) {
+        u64 capacity = Max(interest_set_capacity * 2, client_count);
+        InterestSet* sets = arenaAllocArray(&tctx.arena, InterestSet, capacity);
+        MemoryZero(sets, sizeof(InterestSet) * capacity);
+        if (interest_set_capacity > 0) {
+          MemoryCopy(sets, interest_sets, sizeof(InterestSet) * interest_set_capacity);
+        }
+        interest_sets = sets;
+        interest_set_capacity = capacity;
+      }
+      // a client that isn't getting a snapshot starts over once it does (sends are in handle order)
+      u32 next_handle = 0;
+      for (u32 i = 0; i < send_count; i++) {
+        MemoryZero(&interest_sets[next_handle], sizeof(InterestSet) * (sends[i].handle - next_handle));
+        next_handle = sends[i].handle + 1;
+      }
+      MemoryZero(&interest_sets[next_handle], sizeof(InterestSet) * (client_count - next_handle));
+
+      interestBeginSweep(&state.interest, log, send_count);
+      for (u32 i = 0; i < send_count; i++) {
+        interestAddViewer(&state.interest, &log->world, &interest_sets[sends[i].handle], sends[i].character_eid);
+      }
+      interestTrackChanges(&state.interest, &log->world);
+      for (u32 i = 0; i < send_count; i++) {
+        InterestSet* set = &interest_sets[sends[i].handle];
+        interestUpdate(&state.interest, set, log, sends[i].acked_snapshot);
+        u64 baseline = snapshotLogCovers(log, sends[i].acked_snapshot) ? sends[i].acked_snapshot : 0;
+        sends[i].parts = interestEncode(set, log, baseline, &sweep_arena);
+      }
+      SnapshotSendStats* stats = &state.snapshot_stats;
+      for (u32 i = 0; i < send_count; i++) {
+        AtomicStoreRelaxed(&stats->snapshots, stats->snapshots + 1);
+        AtomicStoreRelaxed(&stats->parts, stats->parts + sends[i].parts.count);
+        AtomicStoreRelaxed(&stats->truncated, stats->truncated + sends[i].parts.truncated);
+        snapshot_message.address = sends[i].address;
+        for (u32 j = 0; j < sends[i].parts.count; j++) {
+          SnapshotPart* part = &sends[i].parts.items[j];
+          snapshot_message.bytes_len = part->len;
+          MemoryCopy(snapshot_message.bytes, part->bytes, part->len);
+          if (!udpSendBatchPush(send_batch, &snapshot_message)) {
+            sendUDPBatch(socket, send_batch);
+            udpSendBatchPush(send_batch, &snapshot_message);
+          }
+        }
+      }
+      next_sweep += GOAL_NETWORK_SEND_LOOP_US;
+      if (next_sweep <= now) {
+        next_sweep = now + GOAL_NETWORK_SEND_LOOP_US; // fell behind, don't try to catch up with a burst of sweeps
       }
     }
 
-    lockMutex(&state.client_mutex); {
-      // WARNING the `i` starts at 1 here because state.clients.items[0] is a "null" Client
-      for (u32 i = 1; i < state.clients.length; i++) {
-        Client client = state.clients.items[i];
-        if (client.last_ping+CLIENT_TIMEOUT_FRAMES < state.frame) {
-          memset(&state.clients.items[i], 0, sizeof(Client));
-          continue;
+    // 2. sleep until there's something queued (or the next sweep is due), then send all of it in one go,
+    // packing messages to the same client together. lane 0 wakes us up once the capture's done, but that can
+    // come in between checking for it and going to sleep, so that's never a wait of more than a tick
+    now = osTimeMicrosecondsNow();
+    u64 until_sweep = next_sweep > now ? next_sweep - now : 0;
+    if (capturing) {
+      until_sweep = 1000000 / GOAL_GAME_LOOPS_PER_S;
+    }
+    u32 drained = outgoingMessageQueuePopBatchWait(state.network_send_queue, drained_messages, NET_OUTGOING_MESSAGE_QUEUE_LEN, until_sweep);
+    for (u32 i = 0; i < drained; i++) {
+      if (!udpSendBatchPush(send_batch, &drained_messages[i])) {
+        sendUDPBatch(socket, send_batch);
+        udpSendBatchPush(send_batch, &drained_messages[i]);
+      }
+    }
+    if (send_batch->count > 0) {
+      sendUDPBatch(socket, send_batch);
+    }
+  }
+  return NULL;
+}
+
+// the first tile along the diagonal out of the top left corner with nobody on it, so new characters don't spawn
+// on top of each other. the grid makes each check O(entities in one cell)
+// returns the tile's x (and y)
+fn u8 findFreeTile(EntityStore* store) {
+  for (u32 i = 0; i <= MAX_u8; i++) {
+    if (entityStoreQueryRect(store, (u8)i, (u8)i, (u8)i, (u8)i, NULL, 0) == 0) {
+      return (u8)i;
+    }
+  }
+  return 0;
+}
+
+// LANE 0 ONLY, while holding the client lock. the send thread only drains its queue in between sweeps, which take
+// the same lock, so waiting for room here could wait forever. a reply that doesn't fit is dropped instead, same as
+// if it got lost on the wire
+fn void queueReply(UDPMessage* outgoing) {
+  if (!outgoingMessageQueueTryPush(state.network_send_queue, outgoing)) {
+    state.command_latency.replies_dropped += 1;
+  }
+}
+
+// LANE 0 ONLY. handles every command waiting in the ring, queueing replies as it goes.
+// it runs at the top of a tick (before the other lanes are let through) and in between ticks
+// (after they're all done), so it's free to change clients, accounts and entities
+fn void processClientCommands(UDPMessage* outgoing) {
+  lockMutex(&state.client_mutex); {
+  EntityStore* spawn_room = &state.rooms.items[roomIndex(0, 0)].entities;
+  entityStoreSetLane(spawn_room, laneChunks());
+
+  u32 msg_iters = 0;
+  SocketAddress sender = {0};
+  // commands are read straight out of the ring, a contiguous batch at a time
+  ParsedClientCommand* commands = NULL;
+  u32 command_count = pccRingPeekBatch(state.network_recv_queue, &commands);
+  u32 command_idx = 0;
+  u64 newest_arena = 0; // of the commands handled, for recycling the receive arenas once we're through
+  while (command_idx < command_count) {
+    ParsedClientCommand* msg = &commands[command_idx];
+    msg_iters += 0;
+    sender.sin_addr.s_addr = msg->sender_ip;
+    sender.sin_port = msg->sender_port;
+    // find which client it is
+    u32 client_handle = findClientHandleBySocketAddress(&state.clients, sender);
+    Client* client = clientFromHandle(&state.clients, client_handle);
+    switch (msg->type) {
+      case CommandKeepAlive: {
+        dbg("KeepAlive for client_handle=%d, %ld", client_handle, state.frame);
+        client->last_ping = state.frame;
+      } break;
+      case CommandLogin: {
+        if (client_handle == 0) {
+          client_handle = pushClient(&state.clients, sender);
+          if (client_handle == 0) {
+            printf("server is full (%lld clients), ignoring login\n", state.clients.capacity);
+            break;
+          }
+          client = clientFromHandle(&state.clients, client_handle);
+          printf("pushed new client handle = %d\n", client_handle);
         }
-        if (client.character_eid == 0) {
-          continue; // they are still creating their character
+        // update/set the lan_ip/port info for p2p connections
+        client->lan_ip = htonl(msg->alt_ip);
+        client->lan_port = htons(msg->alt_port);
+
+        /*
+        struct in_addr ipaddr;
+        ipaddr.s_addr = htonl(msg->alt_ip);
+        printf("client #%d: SENDER=%s:%d\n", client_handle, inet_ntoa(sender.sin_addr), ntohs(sender.sin_port));
+        printf("            LAN=%s:%d   %d vs %d vs %d\n", inet_ntoa(ipaddr), msg->alt_port, msg->alt_ip, htonl(msg->alt_ip), sender.sin_addr.s_addr);
+        */
+
+        // both still in the receive arena, they're only copied out if they make a new account
+        String name = msg->name;
+        String pw = msg->pass;
+        Account* existing_account = findAccountByName(name);
+        printf("name(%d): %s acct?: %d\n", name.length, name.bytes, existing_account != NULL);
+        fflush(stdout);
+        if (existing_account) {
+          printf(" existing account\n");
+          bool pw_matches = passwordHash(existing_account->pw_salt, pw) == existing_account->pw_hash;
+          if (pw_matches) {
+            printf(" pw matched\n");
+          } else {
+            // tell the client they did a bad pw
+            BitWriter w = bitWriter(outgoing->bytes, UDP_MAX_MESSAGE_LEN);
+            BadPwMessage bad_pw = {0};
+            encodeBadPwMessage(&w, &bad_pw);
+            outgoing->bytes_len = (u16)bitWriterBytes(&w);
+            outgoing->address = sender;
+            queueReply(outgoing);
+            printf("MessageBadPw sent\n");
+            break;
+          }
+        } else {
+          Account new_account = {
+            .eid = 0,
+            .name = stringCopy(&permanent_arena, name),
+            .pw_salt = newPasswordSalt(),
+          };
+          new_account.pw_hash = passwordHash(new_account.pw_salt, pw);
+          existing_account = newAccount(&permanent_arena, new_account);
+          journalAccountCreated(existing_account);
+          printf("new account created id=%lld\n", existing_account->id);
+        }
+        client->account_id = existing_account->id;
+        if (existing_account->eid != 0 && (findAccountByEId(existing_account->eid) != existing_account || EntityHandleStore(existing_account->eid) >= state.rooms.length || entityStoreIndex(roomStoreOf(existing_account->eid), existing_account->eid) == ENTITY_STORE_NOT_FOUND)) {
+          // their handle is from before a restart (and may even belong to someone else's character by now),
+          // put their character back into the world under a fresh one
+          u8 spot = findFreeTile(spawn_room);
+          u64 handle = entityStoreAdd(spawn_room, EntityCharacter, playerCharacterFeatures(), spot, spot, 0);
+          if (handle == 0) {
+            printf("spawn room is full (%lld entities), can't respawn character\n", spawn_room->length);
+            break;
+          }
+          setAccountCharacter(existing_account, handle);
+          journalAccountCharacter(existing_account);
+        }
+        if (existing_account->eid != 0) {
+          setClientCharacter(&state.clients, client_handle, existing_account->eid);
+
+          // tell the client their character id
+          BitWriter w = bitWriter(outgoing->bytes, UDP_MAX_MESSAGE_LEN);
+          CharacterIdMessage character_id = { .id = existing_account->eid };
+          encodeCharacterIdMessage(&w, &character_id);
+          outgoing->bytes_len = (u16)bitWriterBytes(&w);
+          outgoing->address = sender;
+          queueReply(outgoing);
+          printf("MessageCharacterId sent\n");
+        } else {
+          // tell the client they made a new account
+          BitWriter w = bitWriter(outgoing->bytes, UDP_MAX_MESSAGE_LEN);
+          NewAccountCreatedMessage new_account = {0};
+          encodeNewAccountCreatedMessage(&w, &new_account);
+          outgoing->bytes_len = (u16)bitWriterBytes(&w);
+          outgoing->address = sender;
+          queueReply(outgoing);
+          printf("MessageNewAccountCreated sent\n");
+        }
+        printf("eid=%lld, client_handle=%d, acct_id=%lld\n", existing_account->eid, client_handle, existing_account->id);
+      } break;
+      case CommandAckSnapshot: {
+        // acks can arrive late or twice, only ever move forward (and only to snapshots we actually sent)
+        if (client->acked_snapshot < msg->seq && msg->seq <= client->last_snapshot_sent) {
+          client->acked_snapshot = msg->seq;
         }
+        client->last_ping = state.frame;
+      } break;
+      case CommandCreateCharacter: {
+        if (client->character_eid == 0) {
+          // Create new character
+          u8 spot = findFreeTile(spawn_room);
+          u64 character_id = entityStoreAdd(spawn_room, EntityCharacter, playerCharacterFeatures(), spot, spot, msg->byte);
+          if (character_id == 0) {
+            printf("spawn room is full (%lld entities), not creating character\n", spawn_room->length);
+            break;
+          }
+          dbg("made new character id=%ld\n", character_id);
+          setClientCharacter(&state.clients, client_handle, character_id);
+          Account* account = findAccountById(client->account_id);
+          setAccountCharacter(account, character_id);
+          journalAccountCharacter(account);
+          printf("character_eid=%lld, client_handle=%d, acct_id=%lld\n", account->eid, client_handle, account->id);
+
+          // tell the client their character id
+          BitWriter w = bitWriter(outgoing->bytes, UDP_MAX_MESSAGE_LEN);
+          CharacterIdMessage character_id_message = { .id = character_id };
+          encodeCharacterIdMessage(&w, &character_id_message);
+          outgoing->bytes_len = (u16)bitWriterBytes(&w);
+          outgoing->address = sender;
+          queueReply(outgoing);
+          printf("MessageCharacterId sent\n");
+        } else {
+          printf("client tried to create a character when he already has one.");
+        }
+      } break;
+      case CommandType_Count:
+      case CommandInvalid:
+        dbg("invalid message from queue");
+        break;
+    }
+    u64 latency_us = osTimeMicrosecondsNow() - msg->received_us;
+    state.command_latency.count += 1;
+    state.command_latency.total_us += latency_us;
+    state.command_latency.max_us = Max(state.command_latency.max_us, latency_us);
+    if (msg->recv_arena != 0) {
+      newest_arena = msg->recv_arena; // they only go up
+    }
+    command_idx++;
+    if (command_idx == command_count) {
+      // hand the whole batch back at once, then pick up anything that arrived since (or wrapped around)
+      pccRingConsume(state.network_recv_queue, command_count);
+      command_count = pccRingPeekBatch(state.network_recv_queue, &commands);
+      command_idx = 0;
+    }
+    msg_iters++;
+  }
+  pccRingRecycleArenas(state.network_recv_queue, newest_arena);
+
+  } unlockMutex(&state.client_mutex);
+}
+
+fn void roomOutboxPush(RoomOutbox* outbox, Arena* scratch, RoomTransfer transfer) {
+  if (outbox->count == outbox->capacity) {
+    u64 capacity = Max(outbox->capacity * 2, LEFT_ROOM_ENTITES_LEN);
+    RoomTransfer* items = arenaAllocArray(scratch, RoomTransfer, capacity);
+    if (outbox->count > 0) {
+      MemoryCopy(items, outbox->items, sizeof(RoomTransfer) * outbox->count);
+    }
+    outbox->items = items;
+    outbox->capacity = capacity;
+  }
+  outbox->items[outbox->count++] = transfer;
+}
+
+// entities that wander on their own take one step in a random direction. one that steps off the edge of
+// the room shows up on the opposite edge of the neighboring room, unless it's at the edge of the world.
+// the neighbor may belong to another lane, so it goes through `outbox` instead of straight in
+fn void simulateRoom(Room* room, u64 frame, RoomOutbox* outbox, Arena* scratch) {
+  EntityStore* store = &room->entities;
+  entityStoreSetLane(store, laneChunks());
+  EntityQuery walkers = { .required = FeatureMask(FeatureWalksAround), .excluded = FeatureMask(FeaturePlayerControlled) };
+  Range1u64 everyone = range1u64Create(0, store->length);
+  Range1u64 run;
+  u64 first_leaving = outbox->count;
+  for (u64 cursor = everyone.min; entityQueryNextRange(store, walkers, everyone, &cursor, &run);) {
+    EntityChunk* chunk = entityStoreChunk(store, run.min); // a run never leaves its chunk
+    for (u64 i = run.min; i < run.max; i++) {
+      u64 c = EntityChunkOffset(i);
+      i32 dx = 0;
+      i32 dy = 0;
+      switch (u64Hash(chunk->id[c] ^ frame) & 3) {
+        case 0: dx = 1; break;
+        case 1: dx = -1; break;
+        case 2: dy = 1; break;
+        case 3: dy = -1; break;
+      }
+      i32 x = (i32)chunk->x[c] + dx;
+      i32 y = (i32)chunk->y[c] + dy;
+      if (x >= 0 && x <= MAX_u8 && y >= 0 && y <= MAX_u8) {
+        entityStoreMove(store, i, (u8)x, (u8)y);
+        continue;
+      }
+      i32 room_x = room->xyz.x + dx;
+      i32 room_y = room->xyz.y + dy;
+      if (room_x < 0 || room_x >= ROOMS_X || room_y < 0 || room_y >= ROOMS_Y) {
+        continue; // the edge of the world, stay put
+      }
+      RoomTransfer transfer = {
+        .to_room = roomIndex(room_x, room_y),
+        .x = (u8)x, // wraps around to the neighbor's opposite edge
+        .y = (u8)y,
+        .type = chunk->type[c],
+        .color = chunk->color[c],
+        .misc = chunk->misc[c],
+        .id = chunk->id[c],
+        .features = chunk->features[c],
+      };
+      roomOutboxPush(outbox, scratch, transfer);
+    }
+  }
+  // they leave once the pass is over, since removing one swaps the room's last entity into its place
+  for (u64 i = first_leaving; i < outbox->count; i++) {
+    entityStoreRemove(store, outbox->items[i].id);
+  }
+}
+
+fn void roomAddEntity(EntityStore* store, RoomTransfer* transfer) {
+  u64 handle = entityStoreAdd(store, (EntityType)transfer->type, transfer->features, transfer->x, transfer->y, transfer->color);
+  if (handle == 0) {
+    printf("room %d is full (%lld entities), entity lost on the way in\n", transfer->to_room, store->length);
+    return;
+  }
+  u64 index = entityStoreIndex(store, handle);
+  entityStoreChunk(store, index)->misc[EntityChunkOffset(index)] = transfer->misc;
+}
 
+// every lane moves the entities that are headed for its own rooms out of everyone's (LaneGather()'d) outboxes.
+// rooms get simulated by whichever lane took them, so this is what keeps every room's store grown by one lane
+fn void mergeRoomTransfers(RoomList* rooms, Range1u64 lane_rooms, RoomOutbox* outboxes) {
+  for (u32 lane = 0; lane < LaneCount(); lane++) {
+    RoomOutbox* outbox = &outboxes[lane];
+    for (u64 i = 0; i < outbox->count; i++) {
+      RoomTransfer* transfer = &outbox->items[i];
+      if (transfer->to_room < lane_rooms.min || transfer->to_room >= lane_rooms.max) {
+        continue;
       }
-    } unlockMutex(&state.client_mutex);
+      EntityStore* store = &rooms->items[transfer->to_room].entities;
+      entityStoreSetLane(store, laneChunks());
+      roomAddEntity(store, transfer);
+    }
+  }
+}
 
-    u32 loop_duration = osTimeMicrosecondsNow() - loop_start;
-    i32 remaining_time = GOAL_NETWORK_SEND_LOOP_US - loop_duration;
-    if (remaining_time > 0) {
-      osSleepMicroseconds(remaining_time);
+// LANES ONLY. seeds the lane's own rooms with their share of `count` wanderers at random spots (--spawn N):
+// wanderer i goes into room i % rooms->length, so the rooms end up even no matter how many lanes there are
+fn void spawnWanderers(RoomList* rooms, Range1u64 lane_rooms, u64 count) {
+  for (u64 room_idx = lane_rooms.min; room_idx < lane_rooms.max; room_idx++) {
+    EntityStore* store = &rooms->items[room_idx].entities;
+    entityStoreSetLane(store, laneChunks());
+    for (u64 i = room_idx; i < count; i += rooms->length) {
+      u64 r = u64Hash(i);
+      RoomTransfer wanderer = {
+        .to_room = (u32)room_idx,
+        .x = (u8)r,
+        .y = (u8)(r >> 8),
+        .type = EntityCharacter,
+        .color = (u8)(r >> 16),
+        .features = entityFeaturesFromType(EntityCharacter),
+      };
+      roomAddEntity(store, &wanderer);
     }
   }
-  return NULL;
 }
 
 fn void* gameLoop(void* params) {
   LaneCtx* lane_ctx = (LaneCtx*)params;
+  bool pinned = pinLaneThread(&state.placement, lane_ctx->lane_idx);
+  // the arenas are only reserved here, they're placed before anything gets allocated from them
   ThreadContext tctx = {
     .lane_ctx = *lane_ctx,
   };
   tctxInit(&tctx);
-  printf("Lane %lld (%lld) of %lld starting.\n", lane_ctx->lane_idx, LaneIdx(), lane_ctx->lane_count);
+  Arena scratch_arena = {0};
+  arenaInit(&scratch_arena);
+  Arena* lane_arenas[] = { &tctx.arena, &scratch_arena, &laneChunks()->arena };
+  if (pinned) {
+    placeLaneArenas(&state.placement, lane_arenas, arrayLen(lane_arenas));
+  }
+  printf("Lane %lld (%lld) of %lld starting on cpu %d.\n", lane_ctx->lane_idx, LaneIdx(), lane_ctx->lane_count, state.placement.lane_cpus[LaneIdx()]);
   fflush(stdout);
   UDPMessage outgoing_message = {0};
-  u64 loop_start;
+  TickHeader tick = {0};
   u64 last_burn = 0;
   u64 last_hp_regen = 0;
-  Arena scratch_arena = {0};
-  arenaInit(&scratch_arena);
+  if (state.spawn_wanderers > 0) {
+    spawnWanderers(&state.rooms, LaneRange(state.rooms.length), state.spawn_wanderers);
+    LaneSync();
+  }
   while (true) {
-    loop_start = osTimeMicrosecondsNow();
-
     if (LaneIdx() == 0) { // narrow
+      tick.deadline = tickBegin(&state.tick_clock);
       state.frame += 1;
+      tick.frame = state.frame;
+      if (state.frame % NET_RECV_STATS_LOG_FRAMES == 0) {
+        logRecvStats(&state.network_recv_batch->stats);
+        logSendStats(&state.network_send_batch->stats);
+        logSnapshotStats(&state.snapshot_stats);
+        logRecvDrops(state.network_recv_queue);
+        logCommandLatency(&state.command_latency);
+        logTickStats(&state.tick_clock);
+        fflush(stdout);
+      }
 
       // 1. process client messages
-      lockMutex(&state.client_mutex); lockMutex(&state.mutex); {
-
-      u32 msg_iters = 0;
-      SocketAddress sender = {0};
-      ParsedClientCommand msg = {0};
-      ParsedClientCommand* next_net_msg = pccThreadSafeNonblockingQueuePop(state.network_recv_queue, &msg);
-      while (next_net_msg != NULL) {
-        msg_iters += 0;
-        sender.sin_addr.s_addr = msg.sender_ip;
-        sender.sin_port = msg.sender_port;
-        // find which client it is
-        u32 client_handle = findClientHandleBySocketAddress(&state.clients, sender);
-        Client* client = &state.clients.items[client_handle];
-        switch (msg.type) {
-          case CommandKeepAlive: {
-            dbg("KeepAlive for client_handle=%d, %ld", client_handle, state.frame);
-            state.clients.items[client_handle].last_ping = state.frame;
-          } break;
-          case CommandLogin: {
-            if (client_handle == 0) {
-              client_handle = pushClient(&state.clients, sender);
-              client = &state.clients.items[client_handle];
-              printf("pushed new client handle = %d\n", client_handle);
-            }
-            // update/set the lan_ip/port info for p2p connections
-            client->lan_ip = htonl(msg.alt_ip);
-            client->lan_port = htons(msg.alt_port);
-
-            /*
-            struct in_addr ipaddr;
-            ipaddr.s_addr = htonl(msg.alt_ip);
-            printf("client #%d: SENDER=%s:%d\n", client_handle, inet_ntoa(sender.sin_addr), ntohs(sender.sin_port));
-            printf("            LAN=%s:%d   %d vs %d vs %d\n", inet_ntoa(ipaddr), msg.alt_port, msg.alt_ip, htonl(msg.alt_ip), sender.sin_addr.s_addr);
-            */
-
-            String name = stringChunkToString(&permanent_arena, msg.name);
-            releaseStringChunkList(&state.string_arena, &msg.name);
-
-            String pw = stringChunkToString(&permanent_arena, msg.pass);
-            releaseStringChunkList(&state.string_arena, &msg.pass);
-
-            Account* existing_account = findAccountByName(name);
-            printf("name(%d): %s pw(%d): %s acct?: %d\n", name.length, name.bytes, pw.length, pw.bytes, existing_account != NULL);
-            fflush(stdout);
-            if (existing_account) {
-              printf(" existing account\n");
-              bool pw_matches = stringsEq(&pw, &existing_account->pw);
-              arenaDealloc(&permanent_arena, pw.capacity);
-              arenaDealloc(&permanent_arena, name.capacity);
-              if (pw_matches) {
-                printf(" pw matched\n");
-              } else {
-                // tell the client they did a bad pw
-                outgoing_message.bytes[0] = (u8)MessageBadPw;
-                outgoing_message.bytes_len = 1;
-                outgoing_message.address = sender;
-                outgoingMessageQueuePush(state.network_send_queue, &outgoing_message);
-                printf("MessageBadPw sent\n");
-                break;
-              }
-            } else {
-              Account new_account = {
-                .eid = 0,
-                .name = name,
-                .pw = pw,
-              };
-              existing_account = newAccount(&permanent_arena, new_account);
-            }
-            client->account_id = existing_account->id;
-            if (existing_account->eid != 0) {
-              client->character_eid = existing_account->eid;
-
-              // tell the client their character id
-              outgoing_message.bytes[0] = (u8)MessageCharacterId;
-              writeU64ToBufferLE(outgoing_message.bytes + 1, existing_account->eid);
-              outgoing_message.bytes_len = 9;
-              outgoing_message.address = sender;
-              outgoingMessageQueuePush(state.network_send_queue, &outgoing_message);
-              printf("MessageCharacterId sent\n");
-            } else {
-              // tell the client they made a new account
-              outgoing_message.bytes[0] = (u8)MessageNewAccountCreated;
-              outgoing_message.bytes_len = 1;
-              outgoing_message.address = sender;
-              outgoingMessageQueuePush(state.network_send_queue, &outgoing_message);
-              printf("MessageNewAccountCreated sent\n");
-            }
-            printf("eid=%lld, client_handle=%d, acct_id=%lld\n", existing_account->eid, client_handle, existing_account->id);
-          } break;
-          case CommandCreateCharacter: {
-            if (client->character_eid == 0) {
-              // Create new character
-              XYZ room_xyz = {0, 0, 0 };
-              Entity character = {
-                .type = EntityCharacter,
-                .id = state.next_eid++,
-                .changed = true,
-                .features = entityFeaturesFromType(EntityCharacter),
-                .color = msg.byte,
-              };
-              dbg("made new character id=%ld\n", character.id);
-              client->character_eid = character.id;
-              Account* account = findAccountById(client->account_id);
-              account->eid = character.id;
-              printf("character_eid=%lld, client_handle=%d, acct_id=%lld\n", account->eid, client_handle, account->id);
-
-              // tell the client their character id
-              outgoing_message.address = sender;
-              outgoing_message.bytes_len = 9;
-              outgoing_message.bytes[0] = (u8)MessageCharacterId;
-              writeU64ToBufferLE(outgoing_message.bytes + 1, character.id);
-              outgoingMessageQueuePush(state.network_send_queue, &outgoing_message);
-              printf("MessageCharacterId sent\n");
-            } else {
-              printf("client tried to create a character when he already has one.");
-            }
-          } break;
-          case CommandType_Count:
-          case CommandInvalid:
-            dbg("invalid message from queue");
-            break;
-        }
-        next_net_msg = pccThreadSafeNonblockingQueuePop(state.network_recv_queue, &msg);
-        msg_iters++;
+      processClientCommands(&outgoing_message);
+      // the send thread leaves the snapshot log alone until the capture's done
+      tick.capture = AtomicLoadAcquire(&state.capture_requested) != 0;
+      if (tick.capture) {
+        snapshotLogBegin(&state.snapshots);
       }
+    }
+
+    workBegin(&state.room_work, state.rooms.length); // nobody starts stealing until they're all queued, after the sync
+    LaneBroadcast(&tick, 0);
 
-      } unlockMutex(&state.mutex); unlockMutex(&state.client_mutex);
+    // every lane is done reading last tick's outboxes out of everyone's scratch by now
+    arenaClear(&scratch_arena);
+
+    // 2. tick non-user entities, each lane starts on its own slice of the rooms and then helps out with the others'
+    RoomOutbox outbox = {0};
+    for (u64 room_idx; workNext(&state.room_work, &room_idx);) {
+      simulateRoom(&state.rooms.items[room_idx], tick.frame, &outbox, &scratch_arena);
     }
 
+    // 3. hand off the entities that changed rooms
+    Range1u64 lane_rooms = LaneRange(state.rooms.length);
+    RoomOutbox* outboxes = LaneGather(&outbox);
+    mergeRoomTransfers(&state.rooms, lane_rooms, outboxes);
     LaneSync();
 
-    // 2. tick non-user entities
-    // iterate all the rooms
-    /*
-    Room* room = NULL;
-    Range1u64 room_range = LaneRange(MAX_ROOMS);
-    for (u32 i = room_range.min; i < room_range.max; i++) {
-      room = &state.rooms->items[i];
-      simulateRoom(&scratch_arena, room, burn_tick, regen_hp_tick);
+    // 4. capture for the send thread's sweep, every lane its own rooms
+    if (tick.capture) {
+      for (u64 room_idx = lane_rooms.min; room_idx < lane_rooms.max; room_idx++) {
+        snapshotLogCapture(&state.snapshots, (u32)LaneIdx(), &state.rooms.items[room_idx].entities, snapshotEntityName);
+      }
+      LaneSync();
+      if (LaneIdx() == 0) {
+        snapshotLogEnd(&state.snapshots);
+        AtomicStoreRelease(&state.capture_requested, 0);
+        threadSignalNotify(&state.network_send_queue->not_empty); // it sleeps on its queue in between sweeps
+      }
     }
-    */
 
-    // 3. scratch cleanup
-    arenaClear(&scratch_arena);
-
-    // 4. loop timing
-    u32 loop_duration = osTimeMicrosecondsNow() - loop_start;
-    i32 remaining_time = GOAL_GAME_LOOP_US - loop_duration;
-    if (remaining_time > 0) {
-      osSleepMicroseconds(remaining_time);
+    // 5. loop timing
+    if (LaneIdx() == 0) {
+      tickEnd(&state.tick_clock);
+      // rather than sleeping out the tick, handle commands the moment they arrive so replies don't wait for the next tick
+      ParsedClientCommandRing* ring = state.network_recv_queue;
+      ParsedClientCommand* waiting = NULL;
+      for (u64 now = osTimeMicrosecondsNow(); now < tick.deadline; now = osTimeMicrosecondsNow()) {
+        u32 epoch = threadSignalPrepareWait(&ring->not_empty);
+        if (pccRingPeekBatch(ring, &waiting) > 0) {
+          threadSignalCancelWait(&ring->not_empty);
+          processClientCommands(&outgoing_message);
+          continue;
+        }
+        threadSignalWait(&ring->not_empty, epoch, tick.deadline - now);
+      }
+    } else {
+      osSleepUntilMicroseconds(tick.deadline);
     }
   }
   return NULL;
@@ -730,8 +1593,8 @@ i32 main(i32 argc, ptr argv[]) {
   osInit();
   // multi-thread architecture:
   //  - the gameLoop() which just inifinite loops every "tick" and processes user input and updates gameworld state
-  //    - TODO: actually make this N "lanes" as described https://www.rfleury.com/p/multi-core-by-default
-  //      such that we can split room-work among all the various cores on our machine
+  //    - it runs as N "lanes" as described https://www.rfleury.com/p/multi-core-by-default
+  //      lane 0 handles user input, then the rooms are split among all the lanes
   //  - one is the sendNetworkUpdates() infinite loop, which sends a UDP snapshot-or-delta update to each connected client N/sec
   //  - one is the receiveNetworkUpdates() infinte loop, which waits for new UDP messages from clients
 
@@ -742,19 +1605,55 @@ i32 main(i32 argc, ptr argv[]) {
   // 1. initialize gameworld, and spin off infinite game-loop thread
   arenaInit(&permanent_arena);
   arenaInit(&state.game_scratch);
-  arenaInit(&state.string_arena.a);
-  state.string_arena.mutex = newMutex();
   state.client_mutex = newMutex();
-  state.mutex = newMutex();
-  state.network_recv_queue = newPCCThreadQueue(&permanent_arena);
-  state.network_send_queue = newOutgoingMessageQueue(&permanent_arena);
-  // alloc the global hashmap of rooms
+  state.network_recv_queue = newPCCRing(&permanent_arena);
+  state.network_send_queue = outgoingMessageQueueAlloc(&permanent_arena, NET_OUTGOING_MESSAGE_QUEUE_LEN);
+  state.network_recv_batch = newUDPRecvBatch(&permanent_arena);
+  state.network_send_batch = newUDPSendBatch(&permanent_arena);
+  roomsInit(&state.rooms, &permanent_arena); // the stores only keep a pointer to state.chunk_pool, it's set up once the lane count is known
   // init + alloc clients
-  state.clients.capacity = SERVER_MAX_CLIENTS;
-  state.clients.length = 1; // making entry 0 to be a "null" client 
-  state.clients.items = (Client*)arenaAllocArray(&permanent_arena, Client, SERVER_MAX_CLIENTS);
-  state.accounts.capacity = ACCOUNT_CHUNK_SIZE;
-  state.accounts.items = arenaAllocArray(&permanent_arena, Account, ACCOUNT_CHUNK_SIZE);
+  u64 max_clients = SERVER_DEFAULT_MAX_CLIENTS;
+  for (i32 i = 1; i + 1 < argc; i++) {
+    if (strcmp(argv[i], "--max-clients") == 0) {
+      // handles are u32s, and the capacity gets rounded up to a whole chunk
+      char* end = NULL;
+      max_clients = strtoull(argv[i+1], &end, 10);
+      if (end == argv[i+1] || *end != 0 || max_clients < 1 || max_clients > MAX_u32 - CLIENT_CHUNK_SIZE) {
+        printf("error: --max-clients takes a number from 1 to %lld\n", (u64)MAX_u32 - CLIENT_CHUNK_SIZE);
+        exit(1);
+      }
+    }
+  }
+  clientListInit(&state.clients, &permanent_arena, max_clients);
+  accountStoreInit(&state.accounts, &permanent_arena);
+  interestTrackerInit(&state.interest);
+  str data_dir = SERVER_DATA_DIR;
+  for (i32 i = 1; i + 1 < argc; i++) {
+    if (strcmp(argv[i], "--data-dir") == 0) {
+      data_dir = argv[i+1];
+    }
+  }
+  restoreAccounts(data_dir);
+  journalStart(&state.journal);
+  u64 requested_lanes = 0;
+  bool pin = true;
+  for (i32 i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--lanes") == 0 && i + 1 < argc) {
+      requested_lanes = strtoull(argv[i+1], NULL, 10);
+    } else if (strcmp(argv[i], "--no-pin") == 0) {
+      pin = false;
+    } else if (strcmp(argv[i], "--spawn") == 0 && i + 1 < argc) {
+      state.spawn_wanderers = strtoull(argv[i+1], NULL, 10); // for load testing, the lanes seed them before the first tick
+    } else if (strcmp(argv[i], "--debug") == 0) {
+      debug_mode = true; // dbg() output, including the tick/network stats every NET_RECV_STATS_LOG_FRAMES
+    }
+  }
+  state.placement = planThreadPlacement(requested_lanes, pin);
+  printf("%lld lanes%s, %d cpus for the network threads\n", state.placement.lane_count, state.placement.pin ? " (pinned)" : "", state.placement.network_cpu_count);
+  snapshotLogInit(&state.snapshots, (u32)state.rooms.length, (u32)state.placement.lane_count);
+  if (state.spawn_wanderers > 0) {
+    printf("spawning %lld wanderers over %lld rooms\n", state.spawn_wanderers, state.rooms.length);
+  }
 
   // 2. spin off sendNetworkUpdates() infinite loop thread
   UDPServer listener = createUDPServer(SERVER_PORT);
@@ -765,18 +1664,16 @@ i32 main(i32 argc, ptr argv[]) {
   // 3. infinitely wait for incoming UDP messages and process them (usually by just dropping user-commands into the relevant block of shared memory)
   Thread recv_thread = spawnThread(&receiveNetworkUpdates, &listener);
 
-  u64 lane_broadcast_val = 0;
-  Barrier barrier = osBarrierAlloc(GAME_THREAD_CONCURRENCY);
-  LaneCtx lane_ctxs[GAME_THREAD_CONCURRENCY] = {0};
-  Thread game_threads[GAME_THREAD_CONCURRENCY] = {0};
-  for (u32 i = 0; i < GAME_THREAD_CONCURRENCY; i++) {
-    lane_ctxs[i].lane_idx = i;
-    lane_ctxs[i].lane_count = GAME_THREAD_CONCURRENCY;
-    lane_ctxs[i].barrier = barrier;
-    lane_ctxs[i].broadcast_memory = &lane_broadcast_val;
+  tickClockInit(&state.tick_clock, GOAL_GAME_LOOPS_PER_S);
+  u64 lane_count = state.placement.lane_count;
+  chunkPoolInit(&state.chunk_pool, &permanent_arena, lane_count);
+  workInit(&state.room_work, &permanent_arena, lane_count, MAX_ROOMS);
+  LaneCtx* lane_ctxs = laneGroupAlloc(&permanent_arena, lane_count, LANE_BROADCAST_SIZE);
+  Thread* game_threads = arenaAllocArray(&permanent_arena, Thread, lane_count);
+  for (u32 i = 0; i < lane_count; i++) {
     game_threads[i] = spawnThread(&gameLoop, &lane_ctxs[i]);
   }
-  for (u32 i = 0; i < GAME_THREAD_CONCURRENCY; i++) {
+  for (u32 i = 0; i < lane_count; i++) {
     osThreadJoin(game_threads[i], MAX_u64);
   }
 
@@ -1,4 +1,5 @@
 #include "base/all.h"
+#include "lib/wire.h"
 
 #ifndef GAMESHARED_H
 #define GAMESHARED_H
@@ -10,6 +11,7 @@
 typedef enum EntityFeature {
   FeatureWalksAround,
   FeatureCanFight,
+  FeaturePlayerControlled, // it only moves when its client says so
   EntityFeature_Count
 } EntityFeature;
 
@@ -44,34 +46,110 @@ typedef enum Direction {
   Direction_Count
 } Direction;
 
+///// PROTOCOL
+// this is the whole protocol: every message (both ways) is listed here with its fields, and the structs,
+// encoders and decoders both ends use are generated from these lists (see DefineWireMessage in lib/wire.h).
+// Command<Name> is the type of <Name>Command, its fields are <Name>CommandFields. same for Message<Name>.
+// the enums are in wire order, only ever add to the end of a list
+
+// client -> server
+#define COMMAND_TYPES(X) \
+  X(KeepAlive) \
+  X(Login) \
+  X(CreateCharacter) \
+  X(AckSnapshot)
+
+#define KeepAliveCommandFields(F)
+#define LoginCommandFields(F) \
+  F(U16, lan_port) /* sent as ~port */ \
+  F(U32, lan_ip) /* sent as ~ip */ \
+  F(Bytes, name) \
+  F(Bytes, pass)
+#define CreateCharacterCommandFields(F) \
+  F(U8, color)
+#define AckSnapshotCommandFields(F) \
+  F(Var, seq) /* every part of snapshot `seq` arrived */
+
+#define CommandTypeValue(name) Command##name,
+#define CommandTypeString(name) #name,
 typedef enum CommandType {
   CommandInvalid,
-  CommandKeepAlive,
-  CommandLogin,
-  CommandCreateCharacter,
+  COMMAND_TYPES(CommandTypeValue)
   CommandType_Count,
 } CommandType;
 static const char* command_type_strings[] = {
   "Invalid",
-  "KeepAlive",
-  "Login",
-  "CreateCharacter",
+  COMMAND_TYPES(CommandTypeString)
 };
 
-#define ENTITY_HEADER_MESSAGE_SIZE (8+8+1+1+1)
-#define ENTITY_MESSAGE_SIZE (ENTITY_HEADER_MESSAGE_SIZE+2+2+2+2+8+1+1)
+// an entity's id is a generational handle: the low 32 bits pick a slot in the sparse set, the high 32 bits
+// must match that slot's current generation. removing an entity bumps its slot's generation, so handles to
+// it (held by a client that dc'ed, an account, etc) stop resolving instead of silently pointing at whatever
+// reuses the slot. generations start at 1, so 0 is never a valid handle
+#define EntityHandleSlot(handle) ((u32)(handle))
+#define EntityHandleGeneration(handle) ((u32)((handle) >> 32))
+#define EntityHandleMake(slot, generation) (((u64)(generation) << 32) | (u64)(slot))
+
+// the fields of an entity a snapshot can carry, as bit indices into its field mask. a snapshot sends an
+// entity's fields in this order, and only the ones in its mask
+typedef enum EntityField {
+  EntityFieldPosition, // [8 x][8 y]
+  EntityFieldType, // [ENTITY_TYPE_BITS EntityType]
+  EntityFieldColor, // [8 color]
+  EntityFieldFeatures, // [var features]
+  EntityFieldName, // [var len][len bytes], characters only
+  EntityField_Count
+} EntityField;
+#define ENTITY_FIELDS_ALL ((1 << EntityField_Count) - 1)
+#define ENTITY_FIELD_MASK_BITS EntityField_Count
+#define ENTITY_TYPE_BITS 2 // bitsForCount(EntityType_Count)
+
+// server -> client
+#define MESSAGE_TYPES(X) \
+  X(CharacterId) \
+  X(BadPw) \
+  X(NewAccountCreated) \
+  X(Snapshot)
+
+#define CharacterIdMessageFields(F) \
+  F(Var, id)
+#define BadPwMessageFields(F)
+#define NewAccountCreatedMessageFields(F)
+#define SnapshotMessageFields(F) \
+  F(Var, seq) \
+  F(Var, since_baseline) /* seq - baseline */ \
+  F(Var16, part) \
+  F(Var16, part_count) \
+  F(Var16, entity_count) \
+  F(Var16, removed_count) \
+  F(Bytes, body)
+
+// MessageSnapshot is one datagram's worth (a "part") of the world as of snapshot `seq`, its body is bits:
+//   entity_count * [var slot delta][var generation][ENTITY_FIELD_MASK_BITS field mask][fields...]
+//   removed_count * [var zigzag slot delta][var generation]
+// ids are entity handles sent as their slot and generation. entities go in increasing slot order and each
+// slot is sent as the difference from the previous one's (the first from 0), so a dense run costs a byte or so
+// an id. removed ones aren't in any order, so theirs are signed.
+// seq - baseline = 0 is a full snapshot (the client drops anything it doesn't get told about), otherwise it
+// only has what changed since `baseline`, a snapshot the client acked. fields are absolute values, so
+// applying one more than once is harmless
+#define SNAPSHOT_MAX_PARTS 4096 // the client tracks which parts arrived in a bitmap this big
+
+#define MessageValue(name) Message##name,
+#define MessageString(name) #name,
 typedef enum Message {
   MessageInvalid,
-  MessageCharacterId,
-  MessageBadPw,
-  MessageNewAccountCreated,
+  MESSAGE_TYPES(MessageValue)
   Message_Count,
 } Message;
 static const char* MESSAGE_STRINGS[] = {
   "Invalid",
-  "CharacterId",
-  "BadPw",
-  "NewAccountCreated",
+  MESSAGE_TYPES(MessageString)
 };
 
+#define DefineCommand(name) DefineWireMessage(name##Command, Command##name)
+#define DefineMessage(name) DefineWireMessage(name##Message, Message##name)
+COMMAND_TYPES(DefineCommand)
+MESSAGE_TYPES(DefineMessage)
+
 #endif //GAMESHARED_H
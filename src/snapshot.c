@@ -0,0 +1,376 @@
+#include "snapshot.h"
+
+fn void snapshotLogInit(SnapshotLog* log, u32 store_count, u32 capture_count) {
+  MemoryZeroStruct(log, SnapshotLog);
+  SnapshotWorld* world = &log->world;
+  arenaInit(&world->arena);
+  world->store_count = store_count;
+  world->stores = arenaAllocArray(&world->arena, SnapshotStore, store_count);
+  MemoryZero(world->stores, sizeof(SnapshotStore) * store_count);
+  log->capture_count = capture_count;
+  log->captures = arenaAllocArray(&world->arena, SnapshotCapture, capture_count);
+  MemoryZero(log->captures, sizeof(SnapshotCapture) * capture_count);
+  for (u32 i = 0; i < capture_count; i++) {
+    arenaInit(&log->captures[i].scratch);
+    arenaInit(&log->captures[i].arena);
+  }
+}
+
+fn u64 snapshotLogBegin(SnapshotLog* log) {
+  log->seq += 1;
+  log->world.move_count = 0;
+  for (u32 i = 0; i < log->capture_count; i++) {
+    log->captures[i].move_count = 0;
+  }
+  return log->seq;
+}
+
+fn void snapshotLogEnd(SnapshotLog* log) {
+  SnapshotWorld* world = &log->world;
+  u64 total = 0;
+  for (u32 i = 0; i < log->capture_count; i++) {
+    total += log->captures[i].move_count;
+  }
+  if (total > world->move_capacity) {
+    world->move_capacity = Max(total, world->move_capacity * 2);
+    world->moves = arenaAllocArray(&world->arena, SnapshotMove, world->move_capacity);
+  }
+  world->move_count = 0;
+  for (u32 i = 0; i < log->capture_count; i++) {
+    SnapshotCapture* capture = &log->captures[i];
+    if (capture->move_count > 0) {
+      MemoryCopy(world->moves + world->move_count, capture->moves, sizeof(SnapshotMove) * capture->move_count);
+      world->move_count += capture->move_count;
+    }
+  }
+}
+
+fn void snapshotStoreReserve(SnapshotCapture* capture, SnapshotStore* mirror, u64 capacity) {
+  if (capacity <= mirror->capacity) {
+    return;
+  }
+  capacity = Max(capacity, mirror->capacity * 2);
+  Arena* a = &capture->arena;
+  SnapshotStore old = *mirror;
+  mirror->capacity = capacity;
+  mirror->id = arenaAllocArray(a, u64, capacity);
+  mirror->x = arenaAllocArray(a, u8, capacity);
+  mirror->y = arenaAllocArray(a, u8, capacity);
+  mirror->type = arenaAllocArray(a, u8, capacity);
+  mirror->color = arenaAllocArray(a, u8, capacity);
+  mirror->features = arenaAllocArray(a, u64, capacity);
+  mirror->name = arenaAllocArray(a, String, capacity);
+  mirror->changed_in = arenaAllocArray(a, SnapshotFieldSeqs, capacity);
+  MemoryZero(mirror->id + old.capacity, sizeof(u64) * (capacity - old.capacity));
+  if (old.capacity > 0) {
+    MemoryCopy(mirror->id, old.id, sizeof(u64) * old.capacity);
+    MemoryCopy(mirror->x, old.x, old.capacity);
+    MemoryCopy(mirror->y, old.y, old.capacity);
+    MemoryCopy(mirror->type, old.type, old.capacity);
+    MemoryCopy(mirror->color, old.color, old.capacity);
+    MemoryCopy(mirror->features, old.features, sizeof(u64) * old.capacity);
+    MemoryCopy(mirror->name, old.name, sizeof(String) * old.capacity);
+    MemoryCopy(mirror->changed_in, old.changed_in, sizeof(SnapshotFieldSeqs) * old.capacity);
+  }
+  if (mirror->grid != NULL) {
+    spatialGridReserve(mirror->grid, capacity);
+  }
+}
+
+fn void snapshotCapturePushMove(SnapshotCapture* capture, SnapshotMove move) {
+  if (capture->move_count == capture->move_capacity) {
+    u64 capacity = Max(capture->move_capacity * 2, 64);
+    SnapshotMove* moves = arenaAllocArray(&capture->arena, SnapshotMove, capacity);
+    if (capture->move_count > 0) {
+      MemoryCopy(moves, capture->moves, sizeof(SnapshotMove) * capture->move_count);
+    }
+    capture->moves = moves;
+    capture->move_capacity = capacity;
+  }
+  capture->moves[capture->move_count++] = move;
+}
+
+fn void snapshotLogCapture(SnapshotLog* log, u32 capture_idx, EntityStore* store, SnapshotNameLookup* name_of) {
+  assert(capture_idx < log->capture_count);
+  SnapshotCapture* capture = &log->captures[capture_idx];
+  EntityChanges* changes = &capture->changes;
+  entityStoreTakeChanges(store, &capture->scratch, changes);
+
+  SnapshotWorld* world = &log->world;
+  u32 store_idx = store->slot_base >> ENTITY_STORE_SLOT_BITS;
+  assert(store_idx < world->store_count);
+  SnapshotStore* mirror = &world->stores[store_idx];
+  // the mirror and its grid grow out of the arena of whichever capture got to their store
+  if (mirror->grid != NULL) {
+    mirror->grid->arena = &capture->arena;
+  }
+  snapshotStoreReserve(capture, mirror, store->slot_capacity);
+  // removals before changes, a slot can have been emptied and filled again since the last capture
+  for (u64 i = 0; i < changes->removed.count; i++) {
+    u64 id = changes->removed.items[i];
+    u32 slot = EntityHandleSlot(id) - store->slot_base;
+    if (mirror->id[slot] != id) {
+      continue; // it came and went in between captures, nobody saw it
+    }
+    snapshotCapturePushMove(capture, (SnapshotMove){ .id = id, .was_there = true, .old_x = mirror->x[slot], .old_y = mirror->y[slot] });
+    mirror->id[slot] = 0;
+    if (mirror->grid != NULL) {
+      spatialGridRemove(mirror->grid, slot);
+    }
+  }
+  for (u64 i = 0; i < changes->count; i++) {
+    u64 id = changes->ids[i];
+    u64 index = entityStoreIndex(store, id); // always there, taking changes skips the ones that are gone
+    EntityChunk* chunk = entityStoreChunk(store, index);
+    u64 c = EntityChunkOffset(index);
+    u32 slot = chunk->slot[c];
+    u8 x = chunk->x[c];
+    u8 y = chunk->y[c];
+    bool was_there = mirror->id[slot] == id; // false if it's new
+    if (!was_there || mirror->x[slot] != x || mirror->y[slot] != y) {
+      snapshotCapturePushMove(capture, (SnapshotMove){ .id = id, .was_there = was_there, .old_x = mirror->x[slot], .old_y = mirror->y[slot], .is_there = true, .new_x = x, .new_y = y });
+      if (mirror->grid != NULL) {
+        if (was_there) {
+          spatialGridMove(mirror->grid, slot, x, y);
+        } else {
+          spatialGridInsert(mirror->grid, slot, x, y);
+        }
+      }
+    }
+    mirror->id[slot] = id;
+    mirror->x[slot] = x;
+    mirror->y[slot] = y;
+    mirror->type[slot] = chunk->type[c];
+    mirror->color[slot] = chunk->color[c];
+    mirror->features[slot] = chunk->features[c];
+    if (chunk->type[c] == EntityCharacter && CheckFlag(changes->fields[i], EntityFieldName)) {
+      mirror->name[slot] = name_of(id);
+    } else if (!was_there) {
+      mirror->name[slot] = (String){0};
+    }
+    // a new entity is new in all its fields, whatever the slot's last one did
+    u8 fields = was_there ? changes->fields[i] : ENTITY_FIELDS_ALL;
+    for (u32 field = 0; field < EntityField_Count; field++) {
+      if (CheckFlag(fields, field)) {
+        mirror->changed_in[slot].seq[field] = (u32)log->seq;
+      }
+    }
+  }
+}
+
+// any baseline would do, but a client that's this far behind may as well start over
+fn bool snapshotLogCovers(SnapshotLog* log, u64 baseline) {
+  return baseline != 0 && baseline <= log->seq && log->seq - baseline <= SNAPSHOT_LOG_LEN;
+}
+
+fn SnapshotStore* snapshotWorldFind(SnapshotWorld* world, u64 id, u32* slot) {
+  u32 store_idx = EntityHandleStore(id);
+  if (store_idx >= world->store_count) {
+    return NULL;
+  }
+  SnapshotStore* mirror = &world->stores[store_idx];
+  *slot = EntityHandleSlot(id) & ((1 << ENTITY_STORE_SLOT_BITS) - 1);
+  if (*slot >= mirror->capacity || mirror->id[*slot] != id) {
+    return NULL;
+  }
+  return mirror;
+}
+
+fn void snapshotWorldAddGrid(SnapshotWorld* world, u32 store_idx) {
+  SnapshotStore* mirror = &world->stores[store_idx];
+  if (mirror->grid != NULL) {
+    return;
+  }
+  mirror->grid = arenaAlloc(&world->arena, sizeof(SpatialGrid));
+  spatialGridInit(mirror->grid, &world->arena, mirror->capacity);
+  for (u32 slot = 0; slot < mirror->capacity; slot++) {
+    if (mirror->id[slot] != 0) {
+      spatialGridInsert(mirror->grid, slot, mirror->x[slot], mirror->y[slot]);
+    }
+  }
+}
+
+fn u64 snapshotWorldQueryRadius(SnapshotWorld* world, u32 store_idx, u8 x, u8 y, u8 radius, u32* out, u64 max) {
+  SnapshotStore* mirror = &world->stores[store_idx];
+  assert(mirror->grid != NULL);
+  u32 slot_base = store_idx << ENTITY_STORE_SLOT_BITS;
+  u64 result = 0;
+  u8 min_x = x > radius ? x - radius : 0;
+  u8 min_y = y > radius ? y - radius : 0;
+  u8 max_x = x < 255 - radius ? x + radius : 255;
+  u8 max_y = y < 255 - radius ? y + radius : 255;
+  i32 radius_sq = (i32)radius * (i32)radius;
+  SpatialCellRange cells = spatialGridCellsInRect(min_x, min_y, max_x, max_y);
+  for (u32 cy = cells.min_y; cy <= cells.max_y; cy++) {
+    for (u32 cx = cells.min_x; cx <= cells.max_x; cx++) {
+      SpatialCell* cell = &mirror->grid->cells[cy * SPATIAL_GRID_DIM + cx];
+      for (u32 i = 0; i < cell->count; i++) {
+        u32 slot = cell->ids[i];
+        i32 dx = (i32)mirror->x[slot] - (i32)x;
+        i32 dy = (i32)mirror->y[slot] - (i32)y;
+        if (dx*dx + dy*dy <= radius_sq) {
+          if (result < max) {
+            out[result] = slot_base + slot;
+          }
+          result += 1;
+        }
+      }
+    }
+  }
+  return result;
+}
+
+fn u8 snapshotWorldChangedSince(SnapshotWorld* world, u64 id, u64 baseline) {
+  u32 slot = 0;
+  SnapshotStore* mirror = snapshotWorldFind(world, id, &slot);
+  assert(mirror != NULL);
+  u8 result = 0;
+  for (u32 field = 0; field < EntityField_Count; field++) {
+    if (mirror->changed_in[slot].seq[field] > (u32)baseline) {
+      SetFlag(result, field);
+    }
+  }
+  return result;
+}
+
+#define SNAPSHOT_PART_BODY_MAX_LEN (SNAPSHOT_PART_MAX_LEN - SnapshotMessageMaxFixedSize)
+
+fn void snapshotWriterBeginPart(SnapshotWriter* w) {
+  if (w->parts.count == w->capacity) {
+    u32 capacity = Max(w->capacity * 2, 4);
+    SnapshotPart* items = arenaAllocArray(w->a, SnapshotPart, capacity);
+    if (w->parts.count > 0) {
+      MemoryCopy(items, w->parts.items, sizeof(SnapshotPart) * w->parts.count);
+    }
+    w->parts.items = items;
+    w->capacity = capacity;
+  }
+  SnapshotPart* part = &w->parts.items[w->parts.count++];
+  part->len = 0;
+  part->entity_count = 0;
+  part->removed_count = 0;
+  w->body = bitWriter(part->bytes + SnapshotMessageMaxFixedSize, SNAPSHOT_PART_BODY_MAX_LEN);
+  w->prev_slot = 0;
+}
+
+fn void snapshotWriterEndPart(SnapshotWriter* w) {
+  w->parts.items[w->parts.count - 1].len = (u16)bitWriterBytes(&w->body);
+}
+
+// turns the body into a whole MessageSnapshot, now that every part exists
+fn void snapshotWriterFinishPart(SnapshotWriter* w, u32 part_idx) {
+  SnapshotPart* part = &w->parts.items[part_idx];
+  SnapshotMessage message = {
+    .seq = w->seq,
+    .since_baseline = w->baseline == 0 ? 0 : w->seq - w->baseline,
+    .part = (u16)part_idx,
+    .part_count = (u16)w->parts.count,
+    .entity_count = part->entity_count,
+    .removed_count = part->removed_count,
+    .body = wireBytes(part->bytes + SnapshotMessageMaxFixedSize, part->len),
+  };
+  // the header's usually shorter than the room left for it, so the body moves down
+  u8 bytes[SNAPSHOT_PART_MAX_LEN];
+  BitWriter m = bitWriter(bytes, SNAPSHOT_PART_MAX_LEN);
+  encodeSnapshotMessage(&m, &message);
+  assert(!m.overflow);
+  part->len = (u16)bitWriterBytes(&m);
+  MemoryCopy(part->bytes, bytes, part->len);
+}
+
+// every record is written the same way: try it in the current part, and if it ran off the end, take it back
+// and write it into a fresh one. false once we're out of parts
+#define SnapshotWriteRecord(w, write) \
+  do { \
+    u64 mark = (w)->body.bit_pos; \
+    u32 prev_slot = (w)->prev_slot; \
+    write; \
+    if ((w)->body.overflow) { \
+      (w)->body.bit_pos = mark; \
+      (w)->prev_slot = prev_slot; \
+      if ((w)->parts.count == SNAPSHOT_MAX_PARTS) { \
+        (w)->parts.truncated = true; \
+        return false; \
+      } \
+      snapshotWriterEndPart(w); \
+      snapshotWriterBeginPart(w); \
+      write; \
+      assert(!(w)->body.overflow); /* a record always fits in an empty part */ \
+    } \
+  } while (0)
+
+fn void snapshotWriteEntityRecord(SnapshotWriter* w, SnapshotStore* mirror, u32 slot, u8 fields, String name) {
+  BitWriter* b = &w->body;
+  u64 id = mirror->id[slot];
+  bitWriteVarU64(b, EntityHandleSlot(id) - w->prev_slot);
+  bitWriteVarU64(b, EntityHandleGeneration(id));
+  w->prev_slot = EntityHandleSlot(id);
+  bitWrite(b, fields, ENTITY_FIELD_MASK_BITS);
+  if (CheckFlag(fields, EntityFieldPosition)) {
+    bitWrite(b, mirror->x[slot], 8);
+    bitWrite(b, mirror->y[slot], 8);
+  }
+  if (CheckFlag(fields, EntityFieldType)) {
+    bitWrite(b, mirror->type[slot], ENTITY_TYPE_BITS);
+  }
+  if (CheckFlag(fields, EntityFieldColor)) {
+    bitWrite(b, mirror->color[slot], 8);
+  }
+  if (CheckFlag(fields, EntityFieldFeatures)) {
+    bitWriteVarU64(b, mirror->features[slot]);
+  }
+  if (CheckFlag(fields, EntityFieldName)) {
+    bitWriteVarU64(b, name.length);
+    bitWriteBytes(b, (u8*)name.bytes, name.length);
+  }
+}
+
+// entities have to be written in increasing slot order
+fn bool snapshotWriteEntity(SnapshotWriter* w, SnapshotWorld* world, u64 id, u8 fields) {
+  u32 slot = 0;
+  SnapshotStore* mirror = snapshotWorldFind(world, id, &slot);
+  assert(mirror != NULL);
+  String name = {0};
+  if (mirror->type[slot] != EntityCharacter) {
+    fields &= ~(1 << EntityFieldName);
+  } else if (CheckFlag(fields, EntityFieldName)) {
+    name = mirror->name[slot];
+    name.length = Min(name.length, 255);
+  }
+  SnapshotWriteRecord(w, snapshotWriteEntityRecord(w, mirror, slot, fields, name));
+  w->parts.items[w->parts.count - 1].entity_count += 1;
+  return true;
+}
+
+fn void snapshotWriteRemovedRecord(SnapshotWriter* w, u64 id) {
+  bitWriteVarI64(&w->body, (i64)EntityHandleSlot(id) - (i64)w->prev_slot);
+  bitWriteVarU64(&w->body, EntityHandleGeneration(id));
+  w->prev_slot = EntityHandleSlot(id);
+}
+
+// after all the entities
+fn bool snapshotWriteRemoved(SnapshotWriter* w, u64 id) {
+  SnapshotPart* part = &w->parts.items[w->parts.count - 1];
+  if (part->removed_count == 0) {
+    w->prev_slot = 0; // the removed slots start over
+  }
+  SnapshotWriteRecord(w, snapshotWriteRemovedRecord(w, id));
+  w->parts.items[w->parts.count - 1].removed_count += 1;
+  return true;
+}
+
+fn void snapshotWriterBegin(SnapshotWriter* w, SnapshotLog* log, u64 baseline, Arena* a) {
+  MemoryZeroStruct(w, SnapshotWriter);
+  w->a = a;
+  w->seq = log->seq;
+  w->baseline = baseline;
+  snapshotWriterBeginPart(w);
+}
+
+fn SnapshotParts snapshotWriterFinish(SnapshotWriter* w) {
+  snapshotWriterEndPart(w);
+  for (u32 i = 0; i < w->parts.count; i++) {
+    snapshotWriterFinishPart(w, i);
+  }
+  return w->parts;
+}
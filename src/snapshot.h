@@ -0,0 +1,134 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "base/all.h"
+#include "shared.h"
+#include "entity_store.h"
+#include "spatial_grid.h"
+
+// world snapshots for clients, as deltas against the last snapshot each client acked.
+// rather than keeping a copy of the world per client, there's one copy as of the latest snapshot, and every
+// slot in it remembers which snapshot each of its fields last changed in. a client only has to remember the seq
+// of the last snapshot it acked (its baseline): the delta for it is every field that changed after that seq.
+// so what a client costs scales with how much changed, not how much there is, and what the world costs doesn't
+// depend on how much changes in between snapshots.
+// a baseline more than SNAPSHOT_LOG_LEN snapshots back (or 0, nothing acked yet) gets a full snapshot instead
+#define SNAPSHOT_LOG_LEN 32
+#define SNAPSHOT_PART_MAX_LEN 508 // one UDP_MAX_MESSAGE_LEN datagram
+
+typedef String SnapshotNameLookup(u64 eid); // a character's name, for EntityFieldName
+
+// the snapshot each EntityField last changed in, truncated to u32 (that's 34 years of snapshots)
+typedef struct SnapshotFieldSeqs {
+  u32 seq[EntityField_Count];
+} SnapshotFieldSeqs;
+
+// one entity store as of the latest snapshot, by slot (without the store's slot_base)
+typedef struct SnapshotStore {
+  u64 capacity; // # of slots there's room for, grows with the store
+  u64* id; // 0 if the slot's empty
+  u8* x;
+  u8* y;
+  u8* type;
+  u8* color;
+  u64* features;
+  String* name; // characters only, looked up when their name changes
+  SnapshotFieldSeqs* changed_in;
+  SpatialGrid* grid; // keyed by slot, NULL until snapshotWorldAddGrid()
+} SnapshotStore;
+
+// something that showed up (!was_there), moved, or went away (!is_there) in the latest snapshot
+typedef struct SnapshotMove {
+  u64 id;
+  bool was_there;
+  u8 old_x;
+  u8 old_y;
+  bool is_there;
+  u8 new_x;
+  u8 new_y;
+} SnapshotMove;
+
+// every store as of the latest snapshot. capturing brings it up to date, and snapshots are written from it
+// instead of from the stores themselves, so only capturing needs the stores to hold still
+typedef struct SnapshotWorld {
+  SnapshotStore* stores; // stores[EntityHandleStore(handle)]
+  u32 store_count;
+  SnapshotMove* moves; // the latest snapshot's
+  u64 move_count;
+  u64 move_capacity;
+  Arena arena;
+} SnapshotWorld;
+
+// one of the captures a snapshot is taken with. the stores are split between them, so they can run on their own
+// threads: everything capturing a store touches is that store's mirror or its capture's
+typedef struct SnapshotCapture {
+  EntityChanges changes; // what it took from a store, reused store after store
+  Arena scratch; // for `changes`, only grows as far as the busiest store needs
+  Arena arena; // the mirrors (and their grids) of the stores it grew
+  SnapshotMove* moves; // its share of the latest snapshot's
+  u64 move_count;
+  u64 move_capacity;
+} SnapshotCapture;
+
+typedef struct SnapshotLog {
+  u64 seq; // the latest snapshot, 0 before the first one
+  SnapshotCapture* captures;
+  u32 capture_count;
+  SnapshotWorld world;
+} SnapshotLog;
+
+typedef struct SnapshotPart {
+  u16 len;
+  u16 entity_count;
+  u16 removed_count;
+  u8 bytes[SNAPSHOT_PART_MAX_LEN];
+} SnapshotPart;
+
+// one encoded snapshot, each part is a whole MessageSnapshot ready to send
+typedef struct SnapshotParts {
+  SnapshotPart* items;
+  u32 count;
+  bool truncated; // it ran out of parts, whatever didn't make it stays missing on the client until it changes again
+} SnapshotParts;
+
+// builds one snapshot's parts. parts are filled one at a time, a new one is started whenever the next record
+// won't fit. a part's body is written after room for the biggest header, and the header goes in once
+// part_count is known
+typedef struct SnapshotWriter {
+  SnapshotParts parts;
+  u32 capacity;
+  Arena* a;
+  u64 seq;
+  u64 baseline;
+  BitWriter body; // the current part's
+  u32 prev_slot; // slots are sent relative to this
+} SnapshotWriter;
+
+// for stores 0..store_count-1, captured in up to capture_count parts at once
+fn void snapshotLogInit(SnapshotLog* log, u32 store_count, u32 capture_count);
+// a snapshot goes: snapshotLogBegin(), then snapshotLogCapture() for every store (each through one of the
+// captures, those can run in parallel), then snapshotLogEnd() once they're all done. begin returns the new seq
+fn u64  snapshotLogBegin(SnapshotLog* log);
+// takes the store's changes since its last capture, and brings the world up to date with them as of log->seq
+fn void snapshotLogCapture(SnapshotLog* log, u32 capture_idx, EntityStore* store, SnapshotNameLookup* name_of);
+fn void snapshotLogEnd(SnapshotLog* log); // gathers the captures' moves into the world's
+fn bool snapshotLogCovers(SnapshotLog* log, u64 baseline); // whether to send a delta from `baseline` to log->seq
+// the handle's store in the world and its slot there, NULL if it's gone (or never existed)
+fn SnapshotStore* snapshotWorldFind(SnapshotWorld* world, u64 id, u32* slot);
+// keeps the store's entities in a spatial grid from now on, for snapshotWorldQueryRadius()
+fn void snapshotWorldAddGrid(SnapshotWorld* world, u32 store_idx);
+// the slots (with the store's slot_base, so like EntityHandleSlot()) of the store's entities within `radius`.
+// returns how many there were, which may be more than `max` (only `max` are written)
+fn u64  snapshotWorldQueryRadius(SnapshotWorld* world, u32 store_idx, u8 x, u8 y, u8 radius, u32* out, u64 max);
+// the EntityField bits of the entity that changed after snapshot `baseline`
+fn u8   snapshotWorldChangedSince(SnapshotWorld* world, u64 id, u64 baseline);
+// writing snapshot log->seq for a client that acked `baseline` (a full snapshot if that's 0):
+// the entities (in increasing slot order), then the ones it should drop (only in a delta). the writes are false
+// once it's out of parts, then the rest is dropped and the parts come out truncated
+fn void snapshotWriterBegin(SnapshotWriter* w, SnapshotLog* log, u64 baseline, Arena* a);
+fn bool snapshotWriteEntity(SnapshotWriter* w, SnapshotWorld* world, u64 id, u8 fields);
+fn bool snapshotWriteRemoved(SnapshotWriter* w, u64 id);
+// always at least one (maybe empty) part, so the client has something to ack
+fn SnapshotParts snapshotWriterFinish(SnapshotWriter* w);
+
+#endif //SNAPSHOT_H
@@ -0,0 +1,80 @@
+#include "spatial_grid.h"
+
+fn void spatialGridInit(SpatialGrid* grid, Arena* a, u64 id_capacity) {
+  MemoryZeroStruct(grid, SpatialGrid);
+  grid->arena = a;
+  spatialGridReserve(grid, id_capacity);
+}
+
+fn void spatialGridReserve(SpatialGrid* grid, u64 id_capacity) {
+  if (id_capacity <= grid->id_capacity) {
+    return;
+  }
+  u16* cell_of = arenaAllocArray(grid->arena, u16, id_capacity);
+  u32* index_in_cell = arenaAllocArray(grid->arena, u32, id_capacity);
+  if (grid->id_capacity > 0) {
+    MemoryCopy(cell_of, grid->cell_of, sizeof(u16) * grid->id_capacity);
+    MemoryCopy(index_in_cell, grid->index_in_cell, sizeof(u32) * grid->id_capacity);
+  }
+  grid->cell_of = cell_of;
+  grid->index_in_cell = index_in_cell;
+  grid->id_capacity = id_capacity;
+}
+
+fn u16 spatialGridCellOf(u8 x, u8 y) {
+  return (u16)((y >> SPATIAL_GRID_CELL_SHIFT) * SPATIAL_GRID_DIM + (x >> SPATIAL_GRID_CELL_SHIFT));
+}
+
+fn void spatialCellPush(SpatialGrid* grid, u16 cell_idx, u32 id) {
+  SpatialCell* cell = &grid->cells[cell_idx];
+  if (cell->count == cell->capacity) {
+    u32 capacity = Max(cell->capacity * 2, SPATIAL_GRID_CELL_INITIAL_CAPACITY);
+    u32* ids = arenaAllocArray(grid->arena, u32, capacity);
+    if (cell->count > 0) {
+      MemoryCopy(ids, cell->ids, sizeof(u32) * cell->count);
+    }
+    cell->ids = ids;
+    cell->capacity = capacity;
+  }
+  grid->cell_of[id] = cell_idx;
+  grid->index_in_cell[id] = cell->count;
+  cell->ids[cell->count++] = id;
+}
+
+// swap-remove, so the cell stays packed
+fn void spatialCellRemove(SpatialGrid* grid, u32 id) {
+  SpatialCell* cell = &grid->cells[grid->cell_of[id]];
+  u32 index = grid->index_in_cell[id];
+  u32 last = cell->ids[--cell->count];
+  cell->ids[index] = last;
+  grid->index_in_cell[last] = index;
+}
+
+fn void spatialGridInsert(SpatialGrid* grid, u32 id, u8 x, u8 y) {
+  assert(id < grid->id_capacity);
+  spatialCellPush(grid, spatialGridCellOf(x, y), id);
+}
+
+fn void spatialGridRemove(SpatialGrid* grid, u32 id) {
+  spatialCellRemove(grid, id);
+}
+
+fn bool spatialGridMove(SpatialGrid* grid, u32 id, u8 x, u8 y) {
+  u16 cell_idx = spatialGridCellOf(x, y);
+  if (cell_idx == grid->cell_of[id]) {
+    return false;
+  }
+  spatialCellRemove(grid, id);
+  spatialCellPush(grid, cell_idx, id);
+  return true;
+}
+
+fn SpatialCellRange spatialGridCellsInRect(u8 min_x, u8 min_y, u8 max_x, u8 max_y) {
+  SpatialCellRange result = {
+    .min_x = min_x >> SPATIAL_GRID_CELL_SHIFT,
+    .min_y = min_y >> SPATIAL_GRID_CELL_SHIFT,
+    .max_x = max_x >> SPATIAL_GRID_CELL_SHIFT,
+    .max_y = max_y >> SPATIAL_GRID_CELL_SHIFT,
+  };
+  return result;
+}
@@ -0,0 +1,44 @@
+#ifndef SPATIAL_GRID_H
+#define SPATIAL_GRID_H
+
+#include "base/all.h"
+
+// a uniform grid over the u8 x/y coordinate space. every cell holds a packed array of the ids in it, and
+// every id remembers its cell + position in that array, so insert/remove/move are all O(1).
+// the grid only knows ids, callers keep the real positions (and do the exact filtering on a query)
+#define SPATIAL_GRID_CELL_SHIFT 3 // 8x8 cells
+#define SPATIAL_GRID_DIM (256 >> SPATIAL_GRID_CELL_SHIFT)
+#define SPATIAL_GRID_CELL_COUNT (SPATIAL_GRID_DIM*SPATIAL_GRID_DIM)
+#define SPATIAL_GRID_CELL_INITIAL_CAPACITY 8
+
+typedef struct SpatialCell {
+  u32* ids;
+  u32 count;
+  u32 capacity; // doubles when full
+} SpatialCell;
+
+typedef struct SpatialGrid {
+  SpatialCell cells[SPATIAL_GRID_CELL_COUNT];
+  u16* cell_of; // id -> cell
+  u32* index_in_cell; // id -> index into cells[cell_of[id]].ids
+  u64 id_capacity;
+  Arena* arena;
+} SpatialGrid;
+
+// the cells overlapping a rectangle, in cell coordinates (inclusive)
+typedef struct SpatialCellRange {
+  u32 min_x;
+  u32 min_y;
+  u32 max_x;
+  u32 max_y;
+} SpatialCellRange;
+
+fn void spatialGridInit(SpatialGrid* grid, Arena* a, u64 id_capacity);
+fn void spatialGridReserve(SpatialGrid* grid, u64 id_capacity); // ids must stay below id_capacity
+fn u16  spatialGridCellOf(u8 x, u8 y);
+fn void spatialGridInsert(SpatialGrid* grid, u32 id, u8 x, u8 y);
+fn void spatialGridRemove(SpatialGrid* grid, u32 id);
+fn bool spatialGridMove(SpatialGrid* grid, u32 id, u8 x, u8 y); // true if it changed cells
+fn SpatialCellRange spatialGridCellsInRect(u8 min_x, u8 min_y, u8 max_x, u8 max_y);
+
+#endif //SPATIAL_GRID_H